@@ -55,6 +55,8 @@ class GetBlockTemplateLPTest(BitcoinTestFramework):
         thr.join(5)  # wait 5 seconds or until thread exits
         assert(not thr.is_alive())
 
+        templat = self.nodes[0].getblocktemplate()
+
         # Test 4: test that introducing a new transaction into the mempool will terminate the longpoll
         thr = LongpollThread(self.nodes[0])
         thr.start()
@@ -64,6 +66,17 @@ class GetBlockTemplateLPTest(BitcoinTestFramework):
         thr.join(60 + 20)
         assert(not thr.is_alive())
 
+        # Test 5: a client passing the templateid of a recent template only receives the changes
+        full = self.nodes[0].getblocktemplate()
+        delta = self.nodes[0].getblocktemplate({'templateid':templat['templateid']})
+        assert_equal(delta['basetemplateid'], templat['templateid'])
+        assert_equal(delta['templateid'], full['templateid'])
+        assert_equal(delta['removed'], [])
+        assert_equal([tx['hash'] for tx in delta['transactions']], [tx['hash'] for tx in full['transactions'] if tx['hash'] == txid])
+        assert_equal(delta['coinbasevalue'], full['coinbasevalue'])
+        # an unknown templateid gets the whole template
+        assert('basetemplateid' not in self.nodes[0].getblocktemplate({'templateid':'0'}))
+
 if __name__ == '__main__':
     GetBlockTemplateLPTest().main()
 
@@ -8,6 +8,11 @@
 
 #include "uint256.h"
 #include "amount.h"
+#include "crypto/common.h"
+#include "random.h"
+
+#include <string.h>
+#include <utility>
 
 struct CMempoolAddressDelta
 {
@@ -79,4 +84,25 @@ struct CMempoolAddressDeltaKeyCompare
     }
 };
 
+/**
+ * Hasher for the (address hash, type) buckets of the mempool address index.
+ * Salted like CCoinsKeyHasher, as the address hashes are chosen by whoever
+ * sends the transactions.
+ */
+class CMempoolAddressHasher
+{
+private:
+    uint256 salt;
+
+public:
+    CMempoolAddressHasher() : salt(GetRandHash()) {}
+
+    size_t operator()(const std::pair<uint160, int>& address) const {
+        uint256 key;
+        memcpy(key.begin(), address.first.begin(), address.first.size());
+        WriteLE32(key.begin() + address.first.size(), address.second);
+        return key.GetHash(salt);
+    }
+};
+
 #endif // BITCOIN_ADDRESSINDEX_H
@@ -0,0 +1,88 @@
+// Copyright (c) 2017 The DigitSlate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "miner.h"
+#include "random.h"
+#include "txmempool.h"
+#include "utiltime.h"
+
+// Selects block template transactions from a mempool of a few thousand
+// transactions, a third of them in chains and most paying about the same low
+// fee, while ten transactions arrive in the second between two templates, as
+// when a pool polls getblocktemplate. Both modes use the package selection;
+// the full one clears the builder first, so it compares reusing the last
+// selection against selecting from scratch. TestBlockValidity is not timed.
+
+static const int BLOCKTEMPLATE_BENCH_TXS = 4000;
+static const int BLOCKTEMPLATE_BENCH_ARRIVALS = 10;
+
+static CMutableTransaction BenchTx(const uint256& hashPrev, uint32_t n)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(hashPrev, n);
+    tx.vin[0].scriptSig = CScript() << OP_1;
+    tx.vout.resize(1);
+    tx.vout[0].scriptPubKey = CScript() << OP_1;
+    tx.vout[0].nValue = n;
+    return tx;
+}
+
+static void AddBenchTx(CTxMemPool& pool, uint256& hashLast, uint32_t& n)
+{
+    uint256 hashPrev;
+    // Every third transaction spends the last one, so chains of a few form
+    if (n % 3 == 2 && pool.exists(hashLast))
+        hashPrev = hashLast;
+    else
+        hashPrev = GetRandHash();
+    CMutableTransaction tx = BenchTx(hashPrev, n++);
+    CAmount nFee = 10000 + insecure_rand() % 1000;
+    if (insecure_rand() % 10 == 0)
+        nFee += insecure_rand() % 100000;
+    pool.addUnchecked(tx.GetHash(), CTxMemPoolEntry(tx, nFee, GetTime(), 0.0, 1, false, 0, false, 1, LockPoints()));
+    hashLast = tx.GetHash();
+}
+
+static void BlockTemplateSelect(benchmark::State& state, bool fIncremental)
+{
+    CTxMemPool pool(CFeeRate(0));
+    LOCK(pool.cs);
+    int64_t nTime = GetTime();
+    SetMockTime(nTime);
+    uint256 hashLast;
+    uint32_t n = 0;
+    for (int i = 0; i < BLOCKTEMPLATE_BENCH_TXS; i++)
+        AddBenchTx(pool, hashLast, n);
+
+    CBlockTemplateLimits limits;
+    // Half of the mempool fits into the block
+    limits.nBlockMaxSize = BLOCKTEMPLATE_BENCH_TXS * 70 / 2;
+    limits.nBlockPrioritySize = 0;
+    CBlockTemplateBuilder builder(pool);
+    while (state.KeepRunning()) {
+        SetMockTime(++nTime);
+        for (int i = 0; i < BLOCKTEMPLATE_BENCH_ARRIVALS; i++)
+            AddBenchTx(pool, hashLast, n);
+        if (!fIncremental)
+            builder.Clear();
+        builder.Select(uint256(), 1, 0, limits);
+        builder.SetValid();
+    }
+    SetMockTime(0);
+}
+
+static void BlockTemplateFull(benchmark::State& state)
+{
+    BlockTemplateSelect(state, false);
+}
+
+static void BlockTemplateIncremental(benchmark::State& state)
+{
+    BlockTemplateSelect(state, true);
+}
+
+BENCHMARK(BlockTemplateFull);
+BENCHMARK(BlockTemplateIncremental);
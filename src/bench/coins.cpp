@@ -0,0 +1,129 @@
+// Copyright (c) 2017 The DigitSlate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "coins.h"
+#include "random.h"
+#include "script/script.h"
+
+#include <vector>
+
+#include <boost/unordered_map.hpp>
+
+// The map benchmarks keep a cache of a hundred thousand transactions, and
+// for every cached transaction that is looked up, add one and drop the
+// oldest, like coins_tests' simulation. The unordered_map is what CCoinsMap
+// was before it became a flatmap. The replay connects blocks of a hundred
+// transactions, each spending a random unspent output and creating two
+// P2PKH outputs, on a cache that is flushed every hundred blocks as during
+// initial block download.
+
+static const size_t COINS_BENCH_TXS = 100000;
+static const int COINS_BENCH_BLOCK_TXS = 100;
+static const int COINS_BENCH_FLUSH_BLOCKS = 100;
+
+namespace {
+
+class CCoinsViewEmpty : public CCoinsView
+{
+public:
+    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
+    {
+        mapCoins.clear();
+        return true;
+    }
+};
+
+uint256 BenchHash()
+{
+    uint256 hash;
+    for (int i = 0; i < 8; i++) {
+        uint32_t n = insecure_rand();
+        memcpy(hash.begin() + 4 * i, &n, 4);
+    }
+    return hash;
+}
+
+CScript BenchScript()
+{
+    return CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, 1) << OP_EQUALVERIFY << OP_CHECKSIG;
+}
+
+void FillCoins(CCoins& coins, const CScript& script, int nHeight)
+{
+    coins.fCoinBase = false;
+    coins.nVersion = 1;
+    coins.nHeight = nHeight;
+    coins.vout.resize(2);
+    coins.vout[0].nValue = 1000;
+    coins.vout[0].scriptPubKey = script;
+    coins.vout[1].nValue = 2000;
+    coins.vout[1].scriptPubKey = script;
+}
+
+template <typename Map>
+void CoinsMapChurn(benchmark::State& state)
+{
+    Map map;
+    CScript script = BenchScript();
+    std::vector<uint256> vTxids;
+    vTxids.reserve(COINS_BENCH_TXS);
+    for (size_t i = 0; i < COINS_BENCH_TXS; i++) {
+        vTxids.push_back(BenchHash());
+        FillCoins(map[vTxids.back()].coins, script, 1);
+    }
+
+    size_t nOldest = 0;
+    while (state.KeepRunning()) {
+        typename Map::iterator it = map.find(vTxids[insecure_rand() % COINS_BENCH_TXS]);
+        it->second.flags |= CCoinsCacheEntry::DIRTY;
+        map.erase(vTxids[nOldest]);
+        vTxids[nOldest] = BenchHash();
+        FillCoins(map[vTxids[nOldest]].coins, script, 2);
+        nOldest = (nOldest + 1) % COINS_BENCH_TXS;
+    }
+}
+
+} // namespace
+
+static void CoinsMapUnordered(benchmark::State& state)
+{
+    CoinsMapChurn<boost::unordered_map<uint256, CCoinsCacheEntry, CCoinsKeyHasher> >(state);
+}
+
+static void CoinsMapFlat(benchmark::State& state)
+{
+    CoinsMapChurn<CCoinsMap>(state);
+}
+
+static void CoinsViewCacheReplay(benchmark::State& state)
+{
+    CCoinsViewEmpty viewEmpty;
+    CCoinsViewCache viewBase(&viewEmpty);
+    CCoinsViewCache viewTip(&viewBase);
+    CScript script = BenchScript();
+    std::vector<COutPoint> vUnspent;
+    int nHeight = 0;
+    while (state.KeepRunning()) {
+        nHeight++;
+        for (int i = 0; i < COINS_BENCH_BLOCK_TXS; i++) {
+            if (!vUnspent.empty()) {
+                size_t nPos = insecure_rand() % vUnspent.size();
+                viewTip.ModifyCoins(vUnspent[nPos].hash)->Spend(vUnspent[nPos].n);
+                vUnspent[nPos] = vUnspent.back();
+                vUnspent.pop_back();
+            }
+            uint256 txid = BenchHash();
+            FillCoins(*viewTip.ModifyNewCoins(txid), script, nHeight);
+            vUnspent.push_back(COutPoint(txid, 0));
+            vUnspent.push_back(COutPoint(txid, 1));
+        }
+        if (nHeight % COINS_BENCH_FLUSH_BLOCKS == 0)
+            viewTip.Flush();
+    }
+}
+
+BENCHMARK(CoinsMapUnordered);
+BENCHMARK(CoinsMapFlat);
+BENCHMARK(CoinsViewCacheReplay);
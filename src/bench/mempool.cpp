@@ -0,0 +1,70 @@
+// Copyright (c) 2017 The DigitSlate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "coins.h"
+#include "pubkey.h"
+#include "script/standard.h"
+#include "txmempool.h"
+
+#include <vector>
+
+// Adds and removes a batch of transactions to the mempool address index per
+// iteration. Every transaction pays one of a hundred addresses and sends its
+// change to a single busy address, as exchange withdrawals do during a spam
+// wave, so both small and large buckets are exercised.
+
+static const int MEMPOOL_BENCH_TXS = 1000;
+
+static CScript AddressScript(int n)
+{
+    std::vector<unsigned char> hash(20, 0);
+    hash[0] = n & 0xff;
+    hash[1] = (n >> 8) & 0xff;
+    return GetScriptForDestination(CKeyID(uint160(hash)));
+}
+
+static void MempoolAddressIndex(benchmark::State& state)
+{
+    CMutableTransaction txFund;
+    txFund.vin.resize(1);
+    txFund.vout.resize(MEMPOOL_BENCH_TXS);
+    for (int i = 0; i < MEMPOOL_BENCH_TXS; i++) {
+        txFund.vout[i].scriptPubKey = AddressScript(i % 100);
+        txFund.vout[i].nValue = 100000;
+    }
+    CCoinsView base;
+    CCoinsViewCache view(&base);
+    view.ModifyCoins(txFund.GetHash())->FromTx(txFund, 1);
+
+    CScript scriptBusy = AddressScript(1000);
+    std::vector<CTxMemPoolEntry> entries;
+    for (int i = 0; i < MEMPOOL_BENCH_TXS; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout = COutPoint(txFund.GetHash(), i);
+        tx.vout.resize(2);
+        tx.vout[0].scriptPubKey = AddressScript((i * 7) % 100);
+        tx.vout[0].nValue = 60000;
+        tx.vout[1].scriptPubKey = scriptBusy;
+        tx.vout[1].nValue = 30000;
+        entries.push_back(CTxMemPoolEntry(tx, 10000, i, 0.0, 1, true, 100000, false, 1, LockPoints()));
+    }
+
+    std::vector<std::pair<uint160, int> > addresses;
+    addresses.push_back(std::make_pair(uint160(std::vector<unsigned char>(scriptBusy.begin() + 3, scriptBusy.begin() + 23)), 1));
+
+    CTxMemPool pool(CFeeRate(0));
+    while (state.KeepRunning()) {
+        for (int i = 0; i < MEMPOOL_BENCH_TXS; i++)
+            pool.addAddressIndex(entries[i], view);
+        std::vector<std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta> > results;
+        pool.getAddressIndex(addresses, results);
+        // Blocks tend to confirm the oldest transactions first
+        for (int i = 0; i < MEMPOOL_BENCH_TXS; i++)
+            pool.removeAddressIndex(entries[i].GetTx().GetHash());
+    }
+}
+
+BENCHMARK(MempoolAddressIndex);
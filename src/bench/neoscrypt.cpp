@@ -0,0 +1,64 @@
+// Copyright (c) 2017 The DigitSlate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#if defined(HAVE_CONFIG_H)
+#include "config/digitslate-config.h"
+#endif
+
+#include "bench.h"
+#include "crypto/neoscrypt.h"
+
+#include <string.h>
+#include <vector>
+
+// Hashes an 80 byte block header per iteration with every NeoScrypt
+// implementation compiled in, so their cost can be compared directly.
+
+static void PrepareHeader(unsigned char* header)
+{
+    for (int i = 0; i < 80; i++)
+        header[i] = (unsigned char)(i * 7 + 3);
+}
+
+static void NeoScrypt(benchmark::State& state)
+{
+    unsigned char header[80], hash[32];
+    PrepareHeader(header);
+    while (state.KeepRunning()) {
+        neoscrypt(header, hash, 0);
+        header[76]++;
+    }
+}
+
+#ifdef USE_NEOSCRYPT_SSE2
+static void NeoScryptSSE2(benchmark::State& state)
+{
+    unsigned char header[80], hash[32];
+    PrepareHeader(header);
+    while (state.KeepRunning()) {
+        neoscrypt_sse2(header, hash, 0);
+        header[76]++;
+    }
+}
+#endif
+
+// Each iteration produces four hashes; divide the reported time by four
+// to compare it with the single hash benchmarks.
+static void NeoScrypt4WayNonces(benchmark::State& state)
+{
+    unsigned char header[80], hashes[4 * 32];
+    std::vector<unsigned char> scratchpad(NEOSCRYPT_4WAY_SCRATCHPAD_SIZE + 63);
+    unsigned char* aligned = (unsigned char*)(((size_t)&scratchpad[0] + 63) & ~(size_t)63);
+    PrepareHeader(header);
+    while (state.KeepRunning()) {
+        neoscrypt_4way_nonces(header, hashes, aligned);
+        header[76] += 4;
+    }
+}
+
+BENCHMARK(NeoScrypt);
+#ifdef USE_NEOSCRYPT_SSE2
+BENCHMARK(NeoScryptSSE2);
+#endif
+BENCHMARK(NeoScrypt4WayNonces);
@@ -0,0 +1,167 @@
+// Copyright (c) 2017 The DigitSlate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "script/sigcache.h"
+
+#include "cuckoocache.h"
+#include "memusage.h"
+#include "random.h"
+#include "uint256.h"
+
+#include <atomic>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <boost/unordered_set.hpp>
+
+// Times signature cache hits on one thread while the other threads of a
+// script check pool keep looking up entries too, and insert one new entry
+// for every eight lookups, like transactions arriving while a block connects.
+// The unordered_set cache is the implementation the cuckoo cache replaced.
+
+static const size_t SIGCACHE_BENCH_BYTES = 8 << 20;
+static const size_t SIGCACHE_BENCH_HITS = 100000;
+
+namespace {
+
+class CheapHasher
+{
+public:
+    size_t operator()(const uint256& key) const { return key.GetCheapHash(); }
+};
+
+class UnorderedSetSigCache
+{
+private:
+    typedef boost::unordered_set<uint256, CheapHasher> map_type;
+    map_type setValid;
+    boost::shared_mutex cs_sigcache;
+    size_t nMaxCacheSize;
+
+public:
+    explicit UnorderedSetSigCache(size_t nBytes) : nMaxCacheSize(nBytes) {}
+
+    bool Get(const uint256& entry)
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
+        return setValid.count(entry);
+    }
+
+    void Set(const uint256& entry)
+    {
+        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
+        while (memusage::DynamicUsage(setValid) > nMaxCacheSize) {
+            map_type::size_type s = GetRand(setValid.bucket_count());
+            map_type::local_iterator it = setValid.begin(s);
+            if (it != setValid.end(s))
+                setValid.erase(*it);
+        }
+        setValid.insert(entry);
+    }
+};
+
+class CuckooSigCache
+{
+private:
+    CuckooCache::cache<uint256, CSignatureCacheHasher> setValid;
+    boost::shared_mutex cs_sigcache;
+
+public:
+    explicit CuckooSigCache(size_t nBytes) { setValid.setup_bytes(nBytes); }
+
+    bool Get(const uint256& entry)
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
+        return setValid.contains(entry, false);
+    }
+
+    void Set(const uint256& entry)
+    {
+        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
+        setValid.insert(entry);
+    }
+};
+
+/** xorshift, as insecure_rand's state is shared between threads */
+uint32_t NextRand(uint32_t& n)
+{
+    n ^= n << 13;
+    n ^= n >> 17;
+    n ^= n << 5;
+    return n;
+}
+
+uint256 RandHash(uint32_t& n)
+{
+    uint256 hash;
+    for (int i = 0; i < 8; i++) {
+        uint32_t r = NextRand(n);
+        memcpy(hash.begin() + 4 * i, &r, 4);
+    }
+    return hash;
+}
+
+template <typename Cache>
+void ThreadSigCacheLoad(Cache* cache, const std::vector<uint256>* vHits, std::atomic<bool>* fStop, uint32_t nSeed)
+{
+    while (!fStop->load(std::memory_order_relaxed)) {
+        for (int i = 0; i < 8; i++)
+            cache->Get((*vHits)[NextRand(nSeed) % vHits->size()]);
+        cache->Set(RandHash(nSeed));
+    }
+}
+
+template <typename Cache>
+void SigCacheHits(benchmark::State& state, int nThreads)
+{
+    Cache cache(SIGCACHE_BENCH_BYTES);
+    uint32_t nSeed = 0x12345678;
+    std::vector<uint256> vHits;
+    vHits.reserve(SIGCACHE_BENCH_HITS);
+    for (size_t i = 0; i < SIGCACHE_BENCH_HITS; i++) {
+        vHits.push_back(RandHash(nSeed));
+        cache.Set(vHits.back());
+    }
+
+    std::atomic<bool> fStop(false);
+    boost::thread_group threadGroup;
+    for (int i = 1; i < nThreads; i++)
+        threadGroup.create_thread(boost::bind(&ThreadSigCacheLoad<Cache>, &cache, &vHits, &fStop, nSeed + i));
+
+    size_t n = 0;
+    while (state.KeepRunning())
+        cache.Get(vHits[n++ % vHits.size()]);
+
+    fStop = true;
+    threadGroup.join_all();
+}
+
+} // namespace
+
+static void SigCacheUnorderedSet8Threads(benchmark::State& state)
+{
+    SigCacheHits<UnorderedSetSigCache>(state, 8);
+}
+
+static void SigCacheUnorderedSet16Threads(benchmark::State& state)
+{
+    SigCacheHits<UnorderedSetSigCache>(state, 16);
+}
+
+static void SigCacheCuckoo8Threads(benchmark::State& state)
+{
+    SigCacheHits<CuckooSigCache>(state, 8);
+}
+
+static void SigCacheCuckoo16Threads(benchmark::State& state)
+{
+    SigCacheHits<CuckooSigCache>(state, 16);
+}
+
+BENCHMARK(SigCacheUnorderedSet8Threads);
+BENCHMARK(SigCacheUnorderedSet16Threads);
+BENCHMARK(SigCacheCuckoo8Threads);
+BENCHMARK(SigCacheCuckoo16Threads);
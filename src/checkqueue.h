@@ -5,10 +5,17 @@
 #ifndef BITCOIN_CHECKQUEUE_H
 #define BITCOIN_CHECKQUEUE_H
 
+#include "utiltime.h"
+
 #include <algorithm>
+#include <assert.h>
+#include <atomic>
+#include <deque>
+#include <stdint.h>
 #include <vector>
 
 #include <boost/foreach.hpp>
+#include <boost/scoped_array.hpp>
 #include <boost/thread/condition_variable.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/thread/mutex.hpp>
@@ -16,7 +23,24 @@
 template <typename T>
 class CCheckQueueControl;
 
-/** 
+/** Counters of one round of verifications, from the first Add to the end of Wait */
+struct CCheckQueueStats
+{
+    unsigned int nChecks;
+    //! batches taken from another worker's queue
+    unsigned int nSteals;
+    //! workers that could have helped, including the master
+    unsigned int nWorkers;
+    //! time from the first Add to the end of Wait
+    int64_t nTimeMicros;
+    //! time the workers were waiting for work during the round, and the master
+    //! after calling Wait, summed over all of them
+    int64_t nIdleMicros;
+
+    CCheckQueueStats() : nChecks(0), nSteals(0), nWorkers(0), nTimeMicros(0), nIdleMicros(0) {}
+};
+
+/**
  * Queue for verifications that have to be performed.
   * The verifications are represented by a type T, which must provide an
   * operator(), returning a bool.
@@ -25,12 +49,23 @@ class CCheckQueueControl;
   * onto the queue, where they are processed by N-1 worker threads. When
   * the master is done adding work, it temporarily joins the worker pool
   * as an N'th worker, until all jobs are done.
+  *
+  * Every worker has its own queue, which the master fills round-robin, so
+  * workers rarely touch the same lock. A worker whose queue runs dry steals
+  * half of the oldest verifications of another one.
   */
 template <typename T>
 class CCheckQueue
 {
 private:
-    //! Mutex to protect the inner state
+    /** Verifications assigned to one worker */
+    struct WorkerQueue
+    {
+        boost::mutex mutex;
+        std::deque<T> checks;
+    };
+
+    //! Mutex to register workers and to wait on
     boost::mutex mutex;
 
     //! Worker threads block on this when out of work
@@ -39,121 +74,210 @@ private:
     //! Master thread blocks on this when out of work
     boost::condition_variable condMaster;
 
-    //! The queue of elements to be processed.
-    //! As the order of booleans doesn't matter, it is used as a LIFO (stack)
-    std::vector<T> queue;
+    //! One queue per worker. The master uses the first one, but only fills
+    //! it when there are no workers.
+    boost::scoped_array<WorkerQueue> queues;
 
-    //! The number of workers (including the master) that are idle.
-    int nIdle;
+    //! The number of queues allocated
+    const unsigned int nMaxWorkers;
 
-    //! The total number of workers (including the master).
-    int nTotal;
+    //! The number of queues in use, including the master's
+    std::atomic<unsigned int> nQueues;
 
-    //! The temporary evaluation result.
-    bool fAllOk;
+    //! Number of verifications in the worker queues, or about to be added to
+    //! them. Workers only wait when this is zero, checking it with mutex held.
+    std::atomic<unsigned int> nQueued;
 
     /**
      * Number of verifications that haven't completed yet.
      * This includes elements that are no longer queued, but still in the
      * worker's own batches.
      */
-    unsigned int nTodo;
+    std::atomic<unsigned int> nTodo;
 
-    //! Whether we're shutting down.
-    bool fQuit;
+    //! The temporary evaluation result.
+    std::atomic<bool> fAllOk;
 
     //! The maximum number of elements to be processed in one batch
     unsigned int nBatchSize;
 
+    //! Queue the next Add starts with, so single verifications are spread too (master only)
+    unsigned int nNextQueue;
+
+    //! Counters of the current round. The first ones are only used by the master.
+    bool fRoundStarted;
+    int64_t nRoundStart;
+    int64_t nWaitStart;
+    unsigned int nRoundChecks;
+    std::atomic<unsigned int> nRoundSteals;
+    //! time spent running verifications, by all workers
+    std::atomic<int64_t> nRoundBusyMicros;
+    CCheckQueueStats lastStats;
+
+    /**
+     * Move a batch of verifications into vChecks: from the back of the
+     * worker's own queue, or else from the front of another one.
+     */
+    bool Take(unsigned int nQueue, std::vector<T>& vChecks)
+    {
+        unsigned int nCount = nQueues.load();
+        for (unsigned int i = 0; i < nCount; i++) {
+            WorkerQueue& queue = queues[(nQueue + i) % nCount];
+            boost::unique_lock<boost::mutex> lock(queue.mutex);
+            if (queue.checks.empty())
+                continue;
+            // Take half of what is left, so there is something left to
+            // steal while the batch runs, but not more than nBatchSize.
+            unsigned int nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.checks.size() / 2));
+            vChecks.resize(nNow);
+            for (unsigned int j = 0; j < nNow; j++) {
+                if (i == 0) {
+                    vChecks[j].swap(queue.checks.back());
+                    queue.checks.pop_back();
+                } else {
+                    vChecks[j].swap(queue.checks.front());
+                    queue.checks.pop_front();
+                }
+            }
+            nQueued -= nNow;
+            if (i != 0)
+                nRoundSteals++;
+            return true;
+        }
+        return false;
+    }
+
     /** Internal function that does bulk of the verification work. */
-    bool Loop(bool fMaster = false)
+    bool Loop(unsigned int nQueue, bool fMaster = false)
     {
-        boost::condition_variable& cond = fMaster ? condMaster : condWorker;
         std::vector<T> vChecks;
         vChecks.reserve(nBatchSize);
-        unsigned int nNow = 0;
-        bool fOk = true;
         do {
-            {
-                boost::unique_lock<boost::mutex> lock(mutex);
-                // first do the clean-up of the previous loop run (allowing us to do it in the same critsect)
-                if (nNow) {
-                    fAllOk &= fOk;
-                    nTodo -= nNow;
-                    if (nTodo == 0 && !fMaster)
-                        // We processed the last element; inform the master it can exit and return the result
-                        condMaster.notify_one();
-                } else {
-                    // first iteration
-                    nTotal++;
-                }
-                // logically, the do loop starts here
-                while (queue.empty()) {
-                    if ((fMaster || fQuit) && nTodo == 0) {
-                        nTotal--;
-                        bool fRet = fAllOk;
-                        // reset the status for new work later
-                        if (fMaster)
-                            fAllOk = true;
-                        // return the current status
-                        return fRet;
-                    }
-                    nIdle++;
-                    cond.wait(lock); // wait
-                    nIdle--;
-                }
-                // Decide how many work units to process now.
-                // * Do not try to do everything at once, but aim for increasingly smaller batches so
-                //   all workers finish approximately simultaneously.
-                // * Try to account for idle jobs which will instantly start helping.
-                // * Don't do batches smaller than 1 (duh), or larger than nBatchSize.
-                nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
-                vChecks.resize(nNow);
-                for (unsigned int i = 0; i < nNow; i++) {
-                    // We want the lock on the mutex to be as short as possible, so swap jobs from the global
-                    // queue to the local batch vector instead of copying.
-                    vChecks[i].swap(queue.back());
-                    queue.pop_back();
-                }
+            if (Take(nQueue, vChecks)) {
+                unsigned int nNow = vChecks.size();
+                int64_t nStart = GetTimeMicros();
                 // Check whether we need to do work at all
-                fOk = fAllOk;
+                bool fOk = fAllOk;
+                BOOST_FOREACH (T& check, vChecks)
+                    if (fOk)
+                        fOk = check();
+                vChecks.clear();
+                if (!fOk)
+                    fAllOk = false;
+                nRoundBusyMicros += GetTimeMicros() - nStart;
+                if (nTodo.fetch_sub(nNow) == nNow && !fMaster) {
+                    // We processed the last element; inform the master it can exit and return the result
+                    boost::unique_lock<boost::mutex> lock(mutex);
+                    condMaster.notify_one();
+                }
+                continue;
             }
-            // execute work
-            BOOST_FOREACH (T& check, vChecks)
-                if (fOk)
-                    fOk = check();
-            vChecks.clear();
+
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (fMaster) {
+                // Nothing is left to take and the master adds no more, so wait
+                // for the workers to finish their batches
+                while (nTodo != 0)
+                    condMaster.wait(lock);
+                return FinishRound();
+            }
+            while (nQueued == 0)
+                condWorker.wait(lock);
         } while (true);
     }
 
+    /** Called by the master, once all verifications are done */
+    bool FinishRound()
+    {
+        int64_t nNow = GetTimeMicros();
+        lastStats.nChecks = nRoundChecks;
+        lastStats.nSteals = nRoundSteals;
+        lastStats.nWorkers = nQueues;
+        lastStats.nTimeMicros = nNow - nRoundStart;
+        // The master only joins the workers once it calls Wait
+        lastStats.nIdleMicros = std::max((int64_t)0, (int64_t)(lastStats.nWorkers - 1) * lastStats.nTimeMicros + (nNow - nWaitStart) - nRoundBusyMicros);
+
+        fRoundStarted = false;
+        nRoundChecks = 0;
+        nRoundSteals = 0;
+        nRoundBusyMicros = 0;
+
+        bool fRet = fAllOk;
+        // reset the status for new work later
+        fAllOk = true;
+        return fRet;
+    }
+
+    void StartRound()
+    {
+        if (!fRoundStarted) {
+            fRoundStarted = true;
+            nRoundStart = GetTimeMicros();
+        }
+    }
+
 public:
-    //! Create a new check queue
-    CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), fQuit(false), nBatchSize(nBatchSizeIn) {}
+    //! Create a new check queue, for at most nMaxWorkersIn - 1 worker threads
+    CCheckQueue(unsigned int nBatchSizeIn, unsigned int nMaxWorkersIn = 64) :
+        queues(new WorkerQueue[nMaxWorkersIn]), nMaxWorkers(nMaxWorkersIn), nQueues(1), nQueued(0), nTodo(0), fAllOk(true),
+        nBatchSize(nBatchSizeIn), nNextQueue(0), fRoundStarted(false), nRoundStart(0), nWaitStart(0), nRoundChecks(0),
+        nRoundSteals(0), nRoundBusyMicros(0) {}
 
     //! Worker thread
     void Thread()
     {
-        Loop();
+        unsigned int nQueue;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            assert(nQueues < nMaxWorkers);
+            nQueue = nQueues++;
+        }
+        Loop(nQueue);
     }
 
     //! Wait until execution finishes, and return whether all evaluations were successful.
     bool Wait()
     {
-        return Loop(true);
+        StartRound();
+        nWaitStart = GetTimeMicros();
+        return Loop(0, true);
     }
 
     //! Add a batch of checks to the queue
     void Add(std::vector<T>& vChecks)
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
-        BOOST_FOREACH (T& check, vChecks) {
-            queue.push_back(T());
-            check.swap(queue.back());
-        }
+        if (vChecks.empty())
+            return;
+        StartRound();
+        nRoundChecks += vChecks.size();
+        // Count the checks before anyone can take them, so neither counter
+        // drops below the number of checks that are really left
         nTodo += vChecks.size();
+        nQueued += vChecks.size();
+
+        unsigned int nCount = nQueues.load();
+        unsigned int nFirst = nCount > 1 ? 1 : 0;
+        unsigned int nWorkers = nCount - nFirst;
+        unsigned int nPerQueue = (vChecks.size() + nWorkers - 1) / nWorkers;
+        unsigned int nQueue = std::max(nFirst, std::min(nNextQueue, nCount - 1));
+        for (unsigned int i = 0; i < vChecks.size(); i += nPerQueue) {
+            WorkerQueue& queue = queues[nQueue];
+            {
+                boost::unique_lock<boost::mutex> lock(queue.mutex);
+                for (unsigned int j = i; j < std::min(i + nPerQueue, (unsigned int)vChecks.size()); j++) {
+                    queue.checks.push_back(T());
+                    vChecks[j].swap(queue.checks.back());
+                }
+            }
+            if (++nQueue == nCount)
+                nQueue = nFirst;
+        }
+        nNextQueue = nQueue;
+
+        boost::unique_lock<boost::mutex> lock(mutex);
         if (vChecks.size() == 1)
             condWorker.notify_one();
-        else if (vChecks.size() > 1)
+        else
             condWorker.notify_all();
     }
 
@@ -164,12 +288,17 @@ public:
     bool IsIdle()
     {
         boost::unique_lock<boost::mutex> lock(mutex);
-        return (nTotal == nIdle && nTodo == 0 && fAllOk == true);
+        return (nTodo == 0 && nQueued == 0 && fAllOk == true);
     }
 
+    //! Counters of the last round that finished (master only)
+    const CCheckQueueStats& GetStats() const
+    {
+        return lastStats;
+    }
 };
 
-/** 
+/**
  * RAII-style controller object for a CCheckQueue that guarantees the passed
  * queue is finished before continuing.
  */
@@ -205,6 +334,14 @@ public:
             pqueue->Add(vChecks);
     }
 
+    //! Counters of the verifications, once Wait returned
+    CCheckQueueStats GetStats() const
+    {
+        if (pqueue == NULL)
+            return CCheckQueueStats();
+        return pqueue->GetStats();
+    }
+
     ~CCheckQueueControl()
     {
         if (!fDone)
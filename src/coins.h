@@ -8,6 +8,7 @@
 
 #include "compressor.h"
 #include "core_memusage.h"
+#include "flatmap.h"
 #include "memusage.h"
 #include "serialize.h"
 #include "uint256.h"
@@ -286,6 +287,7 @@ struct CCoinsCacheEntry
 {
     CCoins coins; // The actual cached data.
     unsigned char flags;
+    std::vector<bool> vDirtyOutputs; // Outputs that are potentially different from the parent view; not kept for FRESH entries.
 
     enum Flags {
         DIRTY = (1 << 0), // This cache entry is potentially different from the version in the parent view.
@@ -293,9 +295,23 @@ struct CCoinsCacheEntry
     };
 
     CCoinsCacheEntry() : coins(), flags(0) {}
+
+    bool IsOutputDirty(unsigned int nPos) const {
+        return nPos < vDirtyOutputs.size() && vDirtyOutputs[nPos];
+    }
+
+    void SetOutputDirty(unsigned int nPos) {
+        if (nPos >= vDirtyOutputs.size())
+            vDirtyOutputs.resize(nPos + 1);
+        vDirtyOutputs[nPos] = true;
+    }
+
+    size_t DynamicMemoryUsage() const {
+        return coins.DynamicMemoryUsage() + memusage::DynamicUsage(vDirtyOutputs);
+    }
 };
 
-typedef boost::unordered_map<uint256, CCoinsCacheEntry, CCoinsKeyHasher> CCoinsMap;
+typedef flatmap<uint256, CCoinsCacheEntry, CCoinsKeyHasher> CCoinsMap;
 
 struct CCoinsStats
 {
@@ -367,6 +383,7 @@ private:
     CCoinsViewCache& cache;
     CCoinsMap::iterator it;
     size_t cachedCoinUsage; // Cached memory usage of the CCoins object before modification
+    std::vector<bool> vAvailableBefore; // Unspent outputs before modification, to find the dirty ones; not kept for FRESH entries
     CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_, size_t usage);
 
 public:
@@ -28,6 +28,10 @@
  */
 
 
+#if defined(HAVE_CONFIG_H)
+#include "config/digitslate-config.h"
+#endif
+
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
@@ -3261,3 +3265,53 @@ uint cpu_vec_exts() {
     return(0);
 }
 #endif
+
+#ifndef ASM
+
+#ifdef USE_NEOSCRYPT_SSE2
+extern uint neoscrypt_sse2_cpu_vec_exts(void);
+extern void neoscrypt_4way(const uchar *password, uchar *output,
+  uchar *scratchpad);
+#endif
+
+/* Tells whether the SSE2 4-way kernel may be used on this processor */
+static int neoscrypt_have_sse2(void) {
+#ifdef USE_NEOSCRYPT_SSE2
+    static volatile int have_sse2 = -1;
+
+    if(have_sse2 < 0)
+      have_sse2 = (neoscrypt_sse2_cpu_vec_exts() & 0x20) ? 1 : 0;
+
+    return(have_sse2);
+#else
+    return(0);
+#endif
+}
+
+void neoscrypt_4way_nonces(const uchar *password, uchar *output,
+  uchar *scratchpad) {
+    uint P[20], k;
+
+#ifdef USE_NEOSCRYPT_SSE2
+    if(neoscrypt_have_sse2()) {
+        neoscrypt_4way(password, output, scratchpad);
+        return;
+    }
+#endif
+
+    neoscrypt_copy(&P[0], password, 80);
+    for(k = 0; k < 4; k++) {
+        neoscrypt((uchar *) &P[0], &output[k * 32], 0);
+        P[19]++;
+    }
+}
+
+const char *neoscrypt_4way_impl(void) {
+
+    if(neoscrypt_have_sse2())
+      return("sse2");
+
+    return("generic");
+}
+
+#endif /* !(ASM) */
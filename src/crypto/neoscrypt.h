@@ -32,6 +32,27 @@ void neoscrypt_fastkdf_4way(const unsigned char *password,
 
 unsigned int cpu_vec_exts(void);
 
+/* Scratchpad bytes needed by neoscrypt_4way_nonces() */
+#define NEOSCRYPT_4WAY_SCRATCHPAD_SIZE (4 * ((128 + 3) * 2 * 128 + 80))
+
+/* NeoScrypt of four consecutive nonces: output[32 * k] receives the hash of
+ * password with k added to its nonce (bytes 76 to 79, native byte order).
+ * The SSE2 4-way kernel is used if it is compiled in and the processor
+ * supports it; otherwise the portable neoscrypt() is run four times.
+ * The scratchpad must be 64-byte aligned */
+void neoscrypt_4way_nonces(const unsigned char *password, unsigned char *output,
+  unsigned char *scratchpad);
+
+/* Name of the kernel neoscrypt_4way_nonces() runs on this processor */
+const char *neoscrypt_4way_impl(void);
+
+#ifdef USE_NEOSCRYPT_SSE2
+/* Single NeoScrypt through the x86-64 assembly; not used for validation
+ * because the portable neoscrypt() is as fast with current compilers */
+void neoscrypt_sse2(const unsigned char *password, unsigned char *output,
+  unsigned int profile);
+#endif
+
 #if (__cplusplus)
 }
 #else
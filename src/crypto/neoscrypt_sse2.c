@@ -0,0 +1,7 @@
+/*
+ * NeoScrypt linked against the x86-64 assembly kernels of neoscrypt_asm.S,
+ * built under the names from neoscrypt_sse2.h.
+ */
+
+#include "neoscrypt_sse2.h"
+#include "neoscrypt.c"
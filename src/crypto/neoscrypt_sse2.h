@@ -0,0 +1,34 @@
+/*
+ * Symbol renames for the x86-64 assembly build of NeoScrypt.
+ *
+ * neoscrypt_sse2.c and neoscrypt_sse2_asm.S compile neoscrypt.c and
+ * neoscrypt_asm.S a second time with ASM, OPT and MINER_4WAY defined.
+ * Every global they share with the portable build gets a distinct name here
+ * so both objects can live in libbitcoin_crypto; neoscrypt_4way_nonces()
+ * selects between them at run time. Only preprocessor definitions may
+ * appear in this file, it is included from assembly.
+ */
+
+#ifndef BITCOIN_CRYPTO_NEOSCRYPT_SSE2_H
+#define BITCOIN_CRYPTO_NEOSCRYPT_SSE2_H
+
+#define ASM 1
+#define OPT 1
+#define MINER_4WAY 1
+
+#define neoscrypt neoscrypt_sse2
+#define _neoscrypt _neoscrypt_sse2
+#define neoscrypt_copy neoscrypt_sse2_copy
+#define _neoscrypt_copy _neoscrypt_sse2_copy
+#define neoscrypt_erase neoscrypt_sse2_erase
+#define _neoscrypt_erase _neoscrypt_sse2_erase
+#define neoscrypt_xor neoscrypt_sse2_xor
+#define _neoscrypt_xor _neoscrypt_sse2_xor
+#define neoscrypt_blake2s neoscrypt_sse2_blake2s
+#define _neoscrypt_blake2s _neoscrypt_sse2_blake2s
+#define blake2s_compress neoscrypt_sse2_blake2s_compress
+#define _blake2s_compress _neoscrypt_sse2_blake2s_compress
+#define cpu_vec_exts neoscrypt_sse2_cpu_vec_exts
+#define _cpu_vec_exts _neoscrypt_sse2_cpu_vec_exts
+
+#endif /* BITCOIN_CRYPTO_NEOSCRYPT_SSE2_H */
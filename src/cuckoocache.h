@@ -0,0 +1,245 @@
+// Copyright (c) 2016 Jeremy Rubin
+// Copyright (c) 2017 The DigitSlate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CUCKOOCACHE_H
+#define BITCOIN_CUCKOOCACHE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+/**
+ * A fixed-size set for elements that already are uniformly distributed, like
+ * salted hashes. All memory is allocated up front by setup(), inserts never
+ * allocate and old entries are dropped by generation instead of by searching
+ * for something to evict.
+ *
+ * Every element has 8 candidate slots, given by the 8 32-bit hashes the Hash
+ * type computes for it. An insert takes the first of them that may be
+ * overwritten, or else moves the element found in one of them to another of
+ * its own slots, up to depth_limit times, after which the element in hand is
+ * dropped.
+ *
+ * Slots are grouped in two generations: entries inserted since the current
+ * generation began, and older ones. Once about 45% of the slots are taken by
+ * the current generation, a new one begins and the entries from before the
+ * previous one may be overwritten.
+ *
+ * Concurrency: contains() may run in parallel with other contains() calls,
+ * also when they erase, as erasing only sets an atomic flag. insert() and
+ * setup() need exclusive access.
+ */
+namespace CuckooCache
+{
+
+/** One atomic bit per slot, set if the slot may be overwritten */
+class bit_packed_atomic_flags
+{
+private:
+    std::unique_ptr<std::atomic<uint8_t>[]> mem;
+
+public:
+    bit_packed_atomic_flags() {}
+
+    /** All bits start set, as all slots start empty */
+    explicit bit_packed_atomic_flags(uint32_t size)
+    {
+        size = (size + 7) / 8;
+        mem.reset(new std::atomic<uint8_t>[size]);
+        for (uint32_t i = 0; i < size; ++i)
+            mem[i].store(0xFF);
+    }
+
+    void setup(uint32_t size)
+    {
+        bit_packed_atomic_flags flags(size);
+        std::swap(mem, flags.mem);
+    }
+
+    void bit_set(uint32_t s)
+    {
+        mem[s >> 3].fetch_or(1 << (s & 7), std::memory_order_relaxed);
+    }
+
+    void bit_unset(uint32_t s)
+    {
+        mem[s >> 3].fetch_and(~(1 << (s & 7)), std::memory_order_relaxed);
+    }
+
+    bool bit_is_set(uint32_t s) const
+    {
+        return (1 << (s & 7)) & mem[s >> 3].load(std::memory_order_relaxed);
+    }
+};
+
+/**
+ * @tparam Element  Needs to be default constructible, swappable and comparable
+ * @tparam Hash     Needs uint32_t operator()(const Element&, int n) const, giving
+ *                  8 (n = 0..7) independent, uniformly distributed hashes
+ */
+template <typename Element, typename Hash>
+class cache
+{
+private:
+    std::vector<Element> table;
+    uint32_t size;
+    //! set for slots that are empty or whose entry was erased or aged out,
+    //! mutable so contains() can erase under a shared lock
+    mutable bit_packed_atomic_flags collection_flags;
+    //! set for slots filled in the current generation
+    std::vector<bool> epoch_flags;
+    //! inserts left before epoch_check() counts the current generation again
+    uint32_t epoch_heuristic_counter;
+    //! number of entries a generation holds before the next one begins
+    uint32_t epoch_size;
+    //! how many times an insert moves other elements before giving up
+    uint8_t depth_limit;
+    const Hash hash_function;
+
+    /** Map the 8 hashes of e onto table positions, without a modulo */
+    void compute_hashes(const Element& e, uint32_t locs[8]) const
+    {
+        for (int n = 0; n < 8; ++n)
+            locs[n] = (uint32_t)(((uint64_t)hash_function(e, n) * (uint64_t)size) >> 32);
+    }
+
+    static uint32_t invalid()
+    {
+        return ~(uint32_t)0;
+    }
+
+    void allow_erase(uint32_t n) const
+    {
+        collection_flags.bit_set(n);
+    }
+
+    void please_keep(uint32_t n) const
+    {
+        collection_flags.bit_unset(n);
+    }
+
+    /**
+     * Begin a new generation when the current one holds epoch_size live entries.
+     * Counting them is O(size), so it is only done again after as many inserts
+     * as could at most be missing for the generation to fill up.
+     */
+    void epoch_check()
+    {
+        if (epoch_heuristic_counter != 0) {
+            --epoch_heuristic_counter;
+            return;
+        }
+
+        uint32_t epoch_unused_count = 0;
+        for (uint32_t i = 0; i < size; ++i)
+            epoch_unused_count += epoch_flags[i] && !collection_flags.bit_is_set(i);
+
+        if (epoch_unused_count >= epoch_size) {
+            // entries older than the generation that just ended may be overwritten now
+            for (uint32_t i = 0; i < size; ++i) {
+                if (epoch_flags[i])
+                    epoch_flags[i] = false;
+                else
+                    allow_erase(i);
+            }
+            epoch_heuristic_counter = epoch_size;
+        } else {
+            epoch_heuristic_counter = std::max((uint32_t)1, std::max(epoch_size / 16, epoch_size - epoch_unused_count));
+        }
+    }
+
+public:
+    cache() : size(0), epoch_heuristic_counter(0), epoch_size(0), depth_limit(0), hash_function() {}
+
+    /** Allocate room for new_size elements (at least 2), dropping all entries. Returns the number of slots. */
+    uint32_t setup(uint32_t new_size)
+    {
+        size = std::max((uint32_t)2, new_size);
+        depth_limit = static_cast<uint8_t>(std::log2(static_cast<float>(size)));
+        table.assign(size, Element());
+        collection_flags.setup(size);
+        epoch_flags.assign(size, false);
+        epoch_size = std::max((uint32_t)1, (45 * size) / 100);
+        epoch_heuristic_counter = epoch_size;
+        return size;
+    }
+
+    /** Like setup, for as many elements as fit into the given number of bytes */
+    uint32_t setup_bytes(size_t bytes)
+    {
+        return setup((uint32_t)std::min(bytes / sizeof(Element), (size_t)invalid()));
+    }
+
+    /** Does nothing until setup() was called */
+    void insert(Element e)
+    {
+        if (size == 0)
+            return;
+        epoch_check();
+        uint32_t locs[8];
+        compute_hashes(e, locs);
+
+        // refresh an entry that is already there
+        for (int n = 0; n < 8; ++n) {
+            if (table[locs[n]] == e) {
+                please_keep(locs[n]);
+                epoch_flags[locs[n]] = true;
+                return;
+            }
+        }
+
+        uint32_t last_loc = invalid();
+        bool last_epoch = true;
+        for (uint8_t depth = 0; depth < depth_limit; ++depth) {
+            for (int n = 0; n < 8; ++n) {
+                if (!collection_flags.bit_is_set(locs[n]))
+                    continue;
+                std::swap(table[locs[n]], e);
+                please_keep(locs[n]);
+                epoch_flags[locs[n]] = last_epoch;
+                return;
+            }
+
+            // all slots are taken: move e into the slot after the one it was
+            // moved out of (the first one for the new element), and go on
+            // with the element it displaced
+            int pos = std::find(locs, locs + 8, last_loc) - locs;
+            last_loc = locs[(1 + pos) & 7];
+            std::swap(table[last_loc], e);
+            bool epoch = last_epoch;
+            last_epoch = epoch_flags[last_loc];
+            epoch_flags[last_loc] = epoch;
+
+            compute_hashes(e, locs);
+        }
+    }
+
+    /**
+     * @param erase  mark the entry as no longer needed if found, it stays
+     *               visible until its slot is reused
+     */
+    bool contains(const Element& e, const bool erase) const
+    {
+        if (size == 0)
+            return false;
+        uint32_t locs[8];
+        compute_hashes(e, locs);
+        for (int n = 0; n < 8; ++n) {
+            if (table[locs[n]] == e) {
+                if (erase)
+                    allow_erase(locs[n]);
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+} // namespace CuckooCache
+
+#endif // BITCOIN_CUCKOOCACHE_H
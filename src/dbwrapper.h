@@ -25,6 +25,37 @@ public:
 
 void HandleError(const leveldb::Status& status) throw(dbwrapper_error);
 
+//! Default uncompressed size of the data blocks of a table file
+static const size_t DEFAULT_DB_BLOCK_SIZE = 4096;
+//! LevelDB keeps the number of open files in this range, 64 table files plus its own files at least
+static const int MIN_DB_MAX_OPEN_FILES = 74;
+static const int MAX_DB_MAX_OPEN_FILES = 50000;
+//! Default number of files LevelDB may keep open, the least it accepts
+static const int DEFAULT_DB_MAX_OPEN_FILES = MIN_DB_MAX_OPEN_FILES;
+//! Default bloom filter size per key in bits, 0 for no filter
+static const int DEFAULT_DB_BLOOM_BITS = 10;
+
+/** LevelDB settings of a CDBWrapper */
+struct CDBOptions
+{
+    //! memory for the block cache
+    size_t nBlockCacheSize;
+    //! memory for one write buffer, up to two of them may be held in memory simultaneously
+    size_t nWriteBufferSize;
+    //! uncompressed size of the data blocks, the unit of reads and of compression
+    size_t nBlockSize;
+    int nMaxOpenFiles;
+    int nBloomBits;
+    bool fCompression;
+
+    /** Split nCacheSize between the block cache and the write buffers, without compression */
+    explicit CDBOptions(size_t nCacheSize) :
+        nBlockCacheSize(nCacheSize / 2), nWriteBufferSize(nCacheSize / 4), nBlockSize(DEFAULT_DB_BLOCK_SIZE),
+        nMaxOpenFiles(DEFAULT_DB_MAX_OPEN_FILES), nBloomBits(DEFAULT_DB_BLOOM_BITS), fCompression(false) {}
+
+    std::string ToString() const;
+};
+
 /** Batch of changes queued to be written to a CDBWrapper */
 class CDBBatch
 {
@@ -88,6 +119,7 @@ public:
     bool Valid();
 
     void SeekToFirst();
+    void SeekToLast();
 
     template<typename K> void Seek(const K& key) {
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
@@ -98,6 +130,7 @@ public:
     }
 
     void Next();
+    void Prev();
 
     template<typename K> bool GetKey(K& key) {
         leveldb::Slice slKey = piter->key();
@@ -132,8 +165,28 @@ public:
 
 };
 
+class CDBWrapper;
+
+/** A consistent, read-only view of a CDBWrapper as of the moment it was taken */
+class CDBSnapshot
+{
+private:
+    leveldb::DB* pdb;
+    const leveldb::Snapshot* psnapshot;
+
+    CDBSnapshot(const CDBSnapshot&);
+    void operator=(const CDBSnapshot&);
+
+public:
+    CDBSnapshot(const CDBWrapper& db);
+    ~CDBSnapshot();
+
+    const leveldb::Snapshot* Get() const { return psnapshot; }
+};
+
 class CDBWrapper
 {
+    friend class CDBSnapshot;
 private:
     //! custom environment this database is using (may be NULL in case of default environment)
     leveldb::Env* penv;
@@ -167,6 +220,8 @@ private:
 
     std::vector<unsigned char> CreateObfuscateKey() const;
 
+    void Open(const boost::filesystem::path& path, const CDBOptions& dbOptions, bool fMemory, bool fWipe, bool obfuscate);
+
 public:
     /**
      * @param[in] path        Location in the filesystem where leveldb data will be stored.
@@ -177,6 +232,8 @@ public:
      *                        with a zero'd byte array.
      */
     CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false, bool obfuscate = false);
+    /** Like above, with the cache sizes and compression given explicitly */
+    CDBWrapper(const boost::filesystem::path& path, const CDBOptions& dbOptions, bool fMemory = false, bool fWipe = false, bool obfuscate = false);
     ~CDBWrapper();
 
     template <typename K, typename V>
@@ -259,11 +316,25 @@ public:
         return new CDBIterator(pdb->NewIterator(iteroptions), &obfuscate_key);
     }
 
+    /** Iterate over the database as it was when snapshot was taken */
+    CDBIterator *NewIterator(const CDBSnapshot& snapshot)
+    {
+        leveldb::ReadOptions options = iteroptions;
+        options.snapshot = snapshot.Get();
+        return new CDBIterator(pdb->NewIterator(options), &obfuscate_key);
+    }
+
     /**
      * Return true if the database managed by this class contains no entries.
      */
     bool IsEmpty();
 
+    /**
+     * Read one of LevelDB's "leveldb.*" properties, like "leveldb.stats".
+     * Returns false if the property is unknown.
+     */
+    bool GetProperty(const std::string& strProperty, std::string& strValue) const;
+
     /**
      * Accessor for obfuscate_key.
      */
@@ -0,0 +1,360 @@
+// Copyright (c) 2017 The DigitSlate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_FLATMAP_H
+#define BITCOIN_FLATMAP_H
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * Hash map with open addressing, for maps with many small entries like the
+ * UTXO cache.
+ *
+ * The table holds one control byte and one pointer per slot, and is probed
+ * linearly. A control byte is either empty, deleted, or 7 bits of the hash of
+ * the key in the slot, so most slots that do not hold the key are passed over
+ * without touching the entry. Entries are allocated from chunks of a pool,
+ * without a malloc per entry, and never move, so pointers and references to
+ * them stay valid until they are erased, as with boost::unordered_map.
+ * Iterators are invalidated by inserts, but not by erasing other entries.
+ *
+ * The memory of erased entries is reused, but only returned to the system by
+ * clear(), so the memory usage of a map is that of its largest size.
+ */
+template <typename K, typename T, typename Hash>
+class flatmap
+{
+public:
+    typedef K key_type;
+    typedef T mapped_type;
+    typedef std::pair<const K, T> value_type;
+    typedef size_t size_type;
+    typedef Hash hasher;
+
+private:
+    static const unsigned char SLOT_EMPTY = 0x80;
+    static const unsigned char SLOT_DELETED = 0xfe;
+
+    //! Smallest table, allocated by the first insert
+    static const size_t MIN_SLOTS = 16;
+    //! Nodes in the first pool chunk; every chunk doubles the pool up to MAX_CHUNK_NODES
+    static const size_t MIN_CHUNK_NODES = 16;
+    static const size_t MAX_CHUNK_NODES = 4096;
+
+    /** Storage of one entry, which holds the next free node while it is unused */
+    union node
+    {
+        node* next_free;
+        typename std::aligned_storage<sizeof(value_type), std::alignment_of<value_type>::value>::type storage;
+
+        value_type* value() { return reinterpret_cast<value_type*>(&storage); }
+    };
+
+    struct chunk
+    {
+        node* nodes;
+        size_t count;
+    };
+
+    Hash hash_function;
+
+    //! Slot pointers, followed by the control bytes, in one allocation
+    value_type** slots;
+    unsigned char* control;
+    size_t slot_count;
+    size_t entry_count;
+    size_t deleted_count;
+
+    std::vector<chunk> chunks;
+    //! Nodes of the last chunk that were never handed out
+    size_t chunk_unused;
+    node* free_nodes;
+
+    static unsigned char control_byte(size_t hash)
+    {
+        return (hash >> (sizeof(size_t) * 8 - 7)) & 0x7f;
+    }
+
+    value_type* allocate_node()
+    {
+        node* n;
+        if (free_nodes) {
+            n = free_nodes;
+            free_nodes = n->next_free;
+        } else {
+            if (chunk_unused == 0) {
+                size_t count = MIN_CHUNK_NODES;
+                for (size_t i = 0; i < chunks.size() && count < MAX_CHUNK_NODES; i++)
+                    count *= 2;
+                chunk c;
+                c.nodes = static_cast<node*>(::operator new(sizeof(node) * count));
+                c.count = count;
+                chunks.push_back(c);
+                chunk_unused = count;
+            }
+            n = &chunks.back().nodes[chunks.back().count - chunk_unused--];
+        }
+        return n->value();
+    }
+
+    void free_node(value_type* value)
+    {
+        value->~value_type();
+        node* n = reinterpret_cast<node*>(value);
+        n->next_free = free_nodes;
+        free_nodes = n;
+    }
+
+    void release()
+    {
+        for (size_t i = 0; i < slot_count; i++)
+            if (!(control[i] & SLOT_EMPTY))
+                slots[i]->~value_type();
+        for (size_t i = 0; i < chunks.size(); i++)
+            ::operator delete(chunks[i].nodes);
+        std::vector<chunk>().swap(chunks);
+        chunk_unused = 0;
+        free_nodes = NULL;
+        ::operator delete(slots);
+        slots = NULL;
+        control = NULL;
+        slot_count = 0;
+        entry_count = 0;
+        deleted_count = 0;
+    }
+
+    /** Move all entries into a table of new_count slots, dropping the deleted ones */
+    void rehash(size_t new_count)
+    {
+        value_type** new_slots = static_cast<value_type**>(::operator new(new_count * (sizeof(value_type*) + 1)));
+        unsigned char* new_control = reinterpret_cast<unsigned char*>(new_slots + new_count);
+        memset(new_control, SLOT_EMPTY, new_count);
+        size_t mask = new_count - 1;
+        for (size_t i = 0; i < slot_count; i++) {
+            if (control[i] & SLOT_EMPTY)
+                continue;
+            size_t pos = hash_function(slots[i]->first) & mask;
+            while (new_control[pos] != SLOT_EMPTY)
+                pos = (pos + 1) & mask;
+            new_control[pos] = control[i];
+            new_slots[pos] = slots[i];
+        }
+        ::operator delete(slots);
+        slots = new_slots;
+        control = new_control;
+        slot_count = new_count;
+        deleted_count = 0;
+    }
+
+    /** Position of key, or slot_count if it is not in the map */
+    size_t find_position(const K& key) const
+    {
+        if (entry_count == 0)
+            return slot_count;
+        size_t hash = hash_function(key);
+        unsigned char c = control_byte(hash);
+        size_t mask = slot_count - 1;
+        for (size_t pos = hash & mask; ; pos = (pos + 1) & mask) {
+            if (control[pos] == c && slots[pos]->first == key)
+                return pos;
+            if (control[pos] == SLOT_EMPTY)
+                return slot_count;
+        }
+    }
+
+    /** Insert the entry constructed by make unless key is present, returning its position */
+    template <typename F>
+    std::pair<size_t, bool> emplace_with(const K& key, F make)
+    {
+        // At most three quarters of the slots are in use, so probes stay short
+        if ((entry_count + deleted_count + 1) * 4 > slot_count * 3) {
+            if ((entry_count + 1) * 2 > slot_count)
+                rehash(slot_count ? slot_count * 2 : MIN_SLOTS);
+            else
+                rehash(slot_count);
+        }
+        size_t hash = hash_function(key);
+        unsigned char c = control_byte(hash);
+        size_t mask = slot_count - 1;
+        size_t insert_pos = slot_count;
+        size_t pos = hash & mask;
+        for (; control[pos] != SLOT_EMPTY; pos = (pos + 1) & mask) {
+            if (control[pos] == c && slots[pos]->first == key)
+                return std::make_pair(pos, false);
+            if (control[pos] == SLOT_DELETED && insert_pos == slot_count)
+                insert_pos = pos;
+        }
+        if (insert_pos == slot_count)
+            insert_pos = pos;
+        else
+            deleted_count--;
+        value_type* value = allocate_node();
+        try {
+            make(value);
+        } catch (...) {
+            node* n = reinterpret_cast<node*>(value);
+            n->next_free = free_nodes;
+            free_nodes = n;
+            throw;
+        }
+        control[insert_pos] = c;
+        slots[insert_pos] = value;
+        entry_count++;
+        return std::make_pair(insert_pos, true);
+    }
+
+    struct copy_value
+    {
+        const value_type& v;
+        copy_value(const value_type& v_) : v(v_) {}
+        void operator()(value_type* p) const { new (p) value_type(v); }
+    };
+
+    struct default_value
+    {
+        const K& key;
+        default_value(const K& key_) : key(key_) {}
+        void operator()(value_type* p) const { new (p) value_type(key, T()); }
+    };
+
+    void erase_position(size_t pos)
+    {
+        free_node(slots[pos]);
+        // A probe that reaches an empty next slot stops there anyway
+        if (control[(pos + 1) & (slot_count - 1)] == SLOT_EMPTY) {
+            control[pos] = SLOT_EMPTY;
+        } else {
+            control[pos] = SLOT_DELETED;
+            deleted_count++;
+        }
+        entry_count--;
+    }
+
+    flatmap(const flatmap&);
+    flatmap& operator=(const flatmap&);
+
+public:
+    template <typename V, typename M>
+    class base_iterator
+    {
+        friend class flatmap;
+        M* map;
+        size_t pos;
+
+        base_iterator(M* map_, size_t pos_) : map(map_), pos(pos_) {}
+
+        void skip_unused()
+        {
+            while (pos < map->slot_count && (map->control[pos] & SLOT_EMPTY))
+                pos++;
+        }
+
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef V value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef V* pointer;
+        typedef V& reference;
+
+        base_iterator() : map(NULL), pos(0) {}
+        template <typename V2, typename M2>
+        base_iterator(const base_iterator<V2, M2>& other) : map(other.map), pos(other.pos) {}
+
+        V& operator*() const { return *map->slots[pos]; }
+        V* operator->() const { return map->slots[pos]; }
+        base_iterator& operator++() { pos++; skip_unused(); return *this; }
+        base_iterator operator++(int) { base_iterator copy(*this); ++(*this); return copy; }
+        template <typename V2, typename M2>
+        bool operator==(const base_iterator<V2, M2>& other) const { return pos == other.pos; }
+        template <typename V2, typename M2>
+        bool operator!=(const base_iterator<V2, M2>& other) const { return pos != other.pos; }
+
+        template <typename V2, typename M2> friend class base_iterator;
+    };
+
+    typedef base_iterator<value_type, flatmap> iterator;
+    typedef base_iterator<const value_type, const flatmap> const_iterator;
+
+    explicit flatmap(const Hash& hash_function_ = Hash()) :
+        hash_function(hash_function_), slots(NULL), control(NULL), slot_count(0), entry_count(0), deleted_count(0),
+        chunk_unused(0), free_nodes(NULL) {}
+
+    ~flatmap() { release(); }
+
+    iterator begin() { iterator it(this, 0); it.skip_unused(); return it; }
+    const_iterator begin() const { const_iterator it(this, 0); it.skip_unused(); return it; }
+    iterator end() { return iterator(this, slot_count); }
+    const_iterator end() const { return const_iterator(this, slot_count); }
+
+    size_type size() const { return entry_count; }
+    bool empty() const { return entry_count == 0; }
+    size_type bucket_count() const { return slot_count; }
+
+    iterator find(const K& key) { return iterator(this, find_position(key)); }
+    const_iterator find(const K& key) const { return const_iterator(this, find_position(key)); }
+    size_type count(const K& key) const { return find_position(key) != slot_count; }
+
+    std::pair<iterator, bool> insert(const value_type& value)
+    {
+        std::pair<size_t, bool> ret = emplace_with(value.first, copy_value(value));
+        return std::make_pair(iterator(this, ret.first), ret.second);
+    }
+
+    T& operator[](const K& key)
+    {
+        size_t pos = emplace_with(key, default_value(key)).first;
+        return slots[pos]->second;
+    }
+
+    void erase(const_iterator it) { erase_position(it.pos); }
+
+    size_type erase(const K& key)
+    {
+        size_t pos = find_position(key);
+        if (pos == slot_count)
+            return 0;
+        erase_position(pos);
+        return 1;
+    }
+
+    /** Remove all entries and free all memory */
+    void clear() { release(); }
+
+    void swap(flatmap& other)
+    {
+        std::swap(hash_function, other.hash_function);
+        std::swap(slots, other.slots);
+        std::swap(control, other.control);
+        std::swap(slot_count, other.slot_count);
+        std::swap(entry_count, other.entry_count);
+        std::swap(deleted_count, other.deleted_count);
+        chunks.swap(other.chunks);
+        std::swap(chunk_unused, other.chunk_unused);
+        std::swap(free_nodes, other.free_nodes);
+    }
+
+    /** Sum of usage(bytes) over the blocks of memory the map allocated */
+    template <typename F>
+    size_t allocated_usage(F usage) const
+    {
+        size_t ret = 0;
+        if (slot_count)
+            ret += usage(slot_count * (sizeof(value_type*) + 1));
+        for (size_t i = 0; i < chunks.size(); i++)
+            ret += usage(sizeof(node) * chunks[i].count);
+        return ret;
+    }
+};
+
+#endif // BITCOIN_FLATMAP_H
@@ -76,6 +76,7 @@ private:
     bool running;
     size_t maxDepth;
     int numThreads;
+    int numIdle;
 
     /** RAII object to keep track of number of running worker threads */
     class ThreadCounter
@@ -98,7 +99,8 @@ private:
 public:
     WorkQueue(size_t maxDepth) : running(true),
                                  maxDepth(maxDepth),
-                                 numThreads(0)
+                                 numThreads(0),
+                                 numIdle(0)
     {
     }
     /*( Precondition: worker threads have all stopped
@@ -122,6 +124,17 @@ public:
         cond.notify_one();
         return true;
     }
+    /** Enqueue a work item only if a worker thread is idle to take it */
+    bool EnqueueIfIdle(WorkItem* item)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (queue.size() >= (size_t)numIdle) {
+            return false;
+        }
+        queue.push_back(item);
+        cond.notify_one();
+        return true;
+    }
     /** Thread function */
     void Run()
     {
@@ -130,8 +143,10 @@ public:
             WorkItem* i = 0;
             {
                 boost::unique_lock<boost::mutex> lock(cs);
+                numIdle += 1;
                 while (running && queue.empty())
                     cond.wait(lock);
+                numIdle -= 1;
                 if (!running)
                     break;
                 i = queue.front();
@@ -187,6 +202,24 @@ struct evhttp* eventHTTP = 0;
 static std::vector<CSubNet> rpc_allow_subnets;
 //! Work queue for handling longer requests off the event loop thread
 static WorkQueue<HTTPClosure>* workQueue = 0;
+
+/** Work item that keeps calling a function while no request is waiting, for HTTPRunOnIdleWorker */
+class HTTPFunctionItem : public HTTPClosure
+{
+public:
+    HTTPFunctionItem(const boost::function<bool()>& func): func(func)
+    {
+    }
+    void operator()()
+    {
+        while (func() && workQueue->Depth() == 0)
+            ;
+    }
+
+private:
+    boost::function<bool()> func;
+};
+
 //! Handlers for (sub)paths
 std::vector<HTTPPathHandler> pathHandlers;
 //! Bound listening sockets
@@ -677,3 +710,14 @@ void UnregisterHTTPHandler(const std::string &prefix, bool exactMatch)
     }
 }
 
+bool HTTPRunOnIdleWorker(const boost::function<bool()>& func)
+{
+    if (!workQueue)
+        return false;
+    std::auto_ptr<HTTPFunctionItem> item(new HTTPFunctionItem(func));
+    if (!workQueue->EnqueueIfIdle(item.get()))
+        return false;
+    item.release(); /* queue took ownership */
+    return true;
+}
+
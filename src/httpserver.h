@@ -44,6 +44,12 @@ void RegisterHTTPHandler(const std::string &prefix, bool exactMatch, const HTTPR
 /** Unregister handler for prefix */
 void UnregisterHTTPHandler(const std::string &prefix, bool exactMatch);
 
+/** Run a function on an idle HTTP worker thread, for handlers that split up
+ * their work. The function is called again as long as it returns true and no
+ * other request is waiting for a worker. Fails if no worker is idle.
+ */
+bool HTTPRunOnIdleWorker(const boost::function<bool()>& func);
+
 /** Return evhttp event base. This can be used by submodules to
  * queue timers or custom events.
  */
@@ -0,0 +1,594 @@
+// Copyright (c) 2017 The DigitSlate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "indexbuilder.h"
+
+#include "chainparams.h"
+#include "main.h"
+#include "sync.h"
+#include "txdb.h"
+#include "undo.h"
+#include "util.h"
+
+#include <deque>
+
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+using namespace std;
+
+/** Number of blocks read from disk ahead of the index builder */
+static const size_t INDEXBUILD_READ_AHEAD = 16;
+/** Number of index entries kept in memory before they are written */
+static const size_t INDEXBUILD_BATCH_ENTRIES = 200000;
+/** Number of blocks after which the progress is written, even if few entries were collected */
+static const int INDEXBUILD_BATCH_BLOCKS = 1000;
+
+namespace {
+
+/** An optional index and how far it was built */
+struct CBuildIndex
+{
+    const char *name;         //! name of its flag and of its progress in the block tree database
+    const char *arg;
+    bool fDefault;
+    bool *pfEnabled;
+    bool fPending;            //! requested but not built yet
+    CBlockIndex *pindexBest;  //! last block in the index while it is being built
+};
+
+enum {
+    BUILD_ADDRESSINDEX,
+    BUILD_SPENTINDEX,
+    BUILD_TIMESTAMPINDEX,
+    BUILD_INDEXES
+};
+
+/** Protects fPending and pindexBest */
+CCriticalSection cs_indexbuilder;
+
+CBuildIndex vIndexes[BUILD_INDEXES] = {
+    {"addressindex", "-addressindex", DEFAULT_ADDRESSINDEX, &fAddressIndex, false, NULL},
+    {"spentindex", "-spentindex", DEFAULT_SPENTINDEX, &fSpentIndex, false, NULL},
+    {"timestampindex", "-timestampindex", DEFAULT_TIMESTAMPINDEX, &fTimestampIndex, false, NULL},
+};
+
+/** Index entries of a run of blocks, in the order they have to be applied */
+struct CIndexEntries
+{
+    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > addressUnspentIndex;
+    std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > spentIndex;
+    std::vector<CTimestampIndexKey> timestampIndex;
+    //! Blocks whose address deltas are in addressIndex
+    std::vector<uint256> addressBlocks;
+
+    size_t size() const {
+        return addressIndex.size() + addressUnspentIndex.size() + spentIndex.size() + timestampIndex.size();
+    }
+
+    void clear() {
+        addressIndex.clear();
+        addressUnspentIndex.clear();
+        spentIndex.clear();
+        timestampIndex.clear();
+        addressBlocks.clear();
+    }
+};
+
+/** A block with the undo data of its inputs */
+struct CBuildBlock
+{
+    CBlockIndex *pindex;
+    CBlock block;
+    CBlockUndo blockundo;
+};
+
+typedef boost::shared_ptr<CBuildBlock> CBuildBlockRef;
+
+/** Reads blocks of the active chain and their undo data from disk ahead of the index builder */
+class CBuildBlockReader
+{
+private:
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    std::deque<CBuildBlockRef> queue;
+    //! last block queued, NULL before the genesis block
+    CBlockIndex *pindexRead;
+    //! bumped on every reset, so a block read from before the reset is dropped
+    unsigned int nGeneration;
+    bool fFailed;
+    boost::thread thread;
+
+    void ThreadRead();
+
+public:
+    CBuildBlockReader(CBlockIndex *pindexFrom);
+    ~CBuildBlockReader();
+
+    /** Continue reading after pindexFrom, dropping everything read ahead */
+    void Reset(CBlockIndex *pindexFrom);
+    /** Get the next block read, or an empty reference if none arrived in time */
+    CBuildBlockRef Pop(int64_t nTimeoutMillis);
+    bool Failed();
+};
+
+} // anon namespace
+
+static bool ReadBuildBlock(CBuildBlock& item)
+{
+    if (!ReadBlockFromDisk(item.block, item.pindex, Params().GetConsensus()))
+        return error("%s: failed to read block %s", __func__, item.pindex->GetBlockHash().ToString());
+
+    // the genesis block has no undo data, and no index entries either
+    if (item.pindex->pprev == NULL)
+        return true;
+
+    CDiskBlockPos pos = item.pindex->GetUndoPos();
+    if (pos.IsNull())
+        return error("%s: no undo data available for block %s", __func__, item.pindex->GetBlockHash().ToString());
+    if (!UndoReadFromDisk(item.blockundo, pos, item.pindex->pprev->GetBlockHash()))
+        return error("%s: failed to read undo data of block %s", __func__, item.pindex->GetBlockHash().ToString());
+    if (item.blockundo.vtxundo.size() + 1 != item.block.vtx.size())
+        return error("%s: block and undo data of %s inconsistent", __func__, item.pindex->GetBlockHash().ToString());
+    return true;
+}
+
+CBuildBlockReader::CBuildBlockReader(CBlockIndex *pindexFrom) : pindexRead(pindexFrom), nGeneration(0), fFailed(false)
+{
+    thread = boost::thread(boost::bind(&TraceThread<boost::function<void()> >, "indexread",
+                                       boost::function<void()>(boost::bind(&CBuildBlockReader::ThreadRead, this))));
+}
+
+CBuildBlockReader::~CBuildBlockReader()
+{
+    thread.interrupt();
+    thread.join();
+}
+
+void CBuildBlockReader::ThreadRead()
+{
+    while (true) {
+        CBlockIndex *pindexPrev;
+        unsigned int nReadGeneration;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (queue.size() >= INDEXBUILD_READ_AHEAD)
+                cond.wait(lock);
+            pindexPrev = pindexRead;
+            nReadGeneration = nGeneration;
+        }
+
+        CBlockIndex *pindex;
+        {
+            LOCK(cs_main);
+            pindex = pindexPrev ? chainActive.Next(pindexPrev) : chainActive.Genesis();
+            if (pindex == NULL && pindexPrev != NULL && !chainActive.Contains(pindexPrev)) {
+                // read ahead into a fork that got disconnected, go on from where it forked off
+                // (the builder drops the stale blocks it is handed)
+                CBlockIndex *pindexFork = pindexPrev;
+                while (!chainActive.Contains(pindexFork))
+                    pindexFork = pindexFork->pprev;
+                boost::unique_lock<boost::mutex> lock(mutex);
+                if (nReadGeneration == nGeneration)
+                    pindexRead = pindexFork;
+                continue;
+            }
+        }
+
+        if (pindex == NULL) {
+            // caught up with the tip, wait for the next block
+            boost::unique_lock<boost::mutex> lock(mutex);
+            cond.timed_wait(lock, boost::posix_time::milliseconds(100));
+            continue;
+        }
+
+        CBuildBlockRef item(new CBuildBlock());
+        item->pindex = pindex;
+        bool fRead = ReadBuildBlock(*item);
+
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (nReadGeneration != nGeneration)
+            continue;
+        if (!fRead) {
+            fFailed = true;
+            cond.notify_all();
+            return;
+        }
+        queue.push_back(item);
+        pindexRead = pindex;
+        cond.notify_all();
+    }
+}
+
+void CBuildBlockReader::Reset(CBlockIndex *pindexFrom)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    queue.clear();
+    pindexRead = pindexFrom;
+    nGeneration++;
+    cond.notify_all();
+}
+
+CBuildBlockRef CBuildBlockReader::Pop(int64_t nTimeoutMillis)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if (queue.empty() && !fFailed)
+        cond.timed_wait(lock, boost::posix_time::milliseconds(nTimeoutMillis));
+    if (queue.empty())
+        return CBuildBlockRef();
+    CBuildBlockRef item = queue.front();
+    queue.pop_front();
+    cond.notify_all();
+    return item;
+}
+
+bool CBuildBlockReader::Failed()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    return fFailed;
+}
+
+static bool GetScriptAddress(const CScript& script, int& type, uint160& hashBytes)
+{
+    if (script.IsPayToScriptHash()) {
+        hashBytes = uint160(vector<unsigned char>(script.begin()+2, script.begin()+22));
+        type = 2;
+    } else if (script.IsPayToPublicKeyHash()) {
+        hashBytes = uint160(vector<unsigned char>(script.begin()+3, script.begin()+23));
+        type = 1;
+    } else {
+        hashBytes.SetNull();
+        type = 0;
+    }
+    return type > 0;
+}
+
+static void GetOutputEntries(const CTransaction& tx, int nHeight, int i, bool fErase, CIndexEntries& entries)
+{
+    const uint256 txhash = tx.GetHash();
+    for (unsigned int k = 0; k < tx.vout.size(); k++) {
+        const CTxOut &out = tx.vout[k];
+        int type;
+        uint160 hashBytes;
+        if (!GetScriptAddress(out.scriptPubKey, type, hashBytes))
+            continue;
+
+        entries.addressIndex.push_back(make_pair(CAddressIndexKey(type, hashBytes, nHeight, i, txhash, k, false), out.nValue));
+        entries.addressUnspentIndex.push_back(make_pair(CAddressUnspentKey(type, hashBytes, txhash, k),
+                                                        fErase ? CAddressUnspentValue() : CAddressUnspentValue(out.nValue, out.scriptPubKey, nHeight)));
+    }
+}
+
+static void GetInputEntries(const CTransaction& tx, const CTxUndo& txundo, int nHeight, int i,
+                            bool fAddress, bool fSpent, bool fErase, CIndexEntries& entries)
+{
+    const uint256 txhash = tx.GetHash();
+    for (unsigned int j = 0; j < tx.vin.size(); j++) {
+        const COutPoint &prevout = tx.vin[j].prevout;
+        const CTxInUndo &undo = txundo.vprevout[j];
+        const CTxOut &out = undo.txout;
+        int type;
+        uint160 hashBytes;
+        GetScriptAddress(out.scriptPubKey, type, hashBytes);
+
+        if (fAddress && type > 0) {
+            entries.addressIndex.push_back(make_pair(CAddressIndexKey(type, hashBytes, nHeight, i, txhash, j, true), out.nValue * -1));
+            entries.addressUnspentIndex.push_back(make_pair(CAddressUnspentKey(type, hashBytes, prevout.hash, prevout.n),
+                                                            fErase ? CAddressUnspentValue(out.nValue, out.scriptPubKey, undo.nHeight) : CAddressUnspentValue()));
+        }
+
+        if (fSpent) {
+            entries.spentIndex.push_back(make_pair(CSpentIndexKey(prevout.hash, prevout.n),
+                                                   fErase ? CSpentIndexValue() : CSpentIndexValue(txhash, j, nHeight, out.nValue, type, hashBytes)));
+        }
+    }
+}
+
+/**
+ * Collect the entries ConnectBlock writes for a block, or with fErase the
+ * entries that remove it again. Those are collected in reverse, like
+ * DisconnectBlock does, so an output created and spent within the block ends
+ * up without an unspent entry either way.
+ */
+static void GetBlockEntries(const CBuildBlock& item, bool fAddress, bool fSpent, bool fTimestamp, bool fErase, CIndexEntries& entries)
+{
+    const CBlockIndex *pindex = item.pindex;
+    if (pindex->pprev == NULL)
+        return;
+
+    if (fTimestamp)
+        entries.timestampIndex.push_back(CTimestampIndexKey(pindex->nTime, pindex->GetBlockHash()));
+    if (fAddress)
+        entries.addressBlocks.push_back(pindex->GetBlockHash());
+    if (!fAddress && !fSpent)
+        return;
+
+    const std::vector<CTransaction> &vtx = item.block.vtx;
+    for (unsigned int n = 0; n < vtx.size(); n++) {
+        const unsigned int i = fErase ? vtx.size() - 1 - n : n;
+        const CTransaction &tx = vtx[i];
+        if (fAddress && fErase)
+            GetOutputEntries(tx, pindex->nHeight, i, fErase, entries);
+        if (i > 0)
+            GetInputEntries(tx, item.blockundo.vtxundo[i-1], pindex->nHeight, i, fAddress, fSpent, fErase, entries);
+        if (fAddress && !fErase)
+            GetOutputEntries(tx, pindex->nHeight, i, fErase, entries);
+    }
+}
+
+/** Write the entries collected so far together with the progress of the indexes being built */
+static bool WriteBuildEntries(CIndexEntries& entries, bool fErase)
+{
+    std::vector<std::pair<std::string, uint256> > progress;
+    {
+        LOCK(cs_indexbuilder);
+        for (int n = 0; n < BUILD_INDEXES; n++) {
+            if (vIndexes[n].fPending)
+                progress.push_back(make_pair(std::string(vIndexes[n].name), vIndexes[n].pindexBest ? vIndexes[n].pindexBest->GetBlockHash() : uint256()));
+        }
+    }
+    if (!pindexdb->WriteIndexBuildBatch(entries.addressIndex, entries.addressUnspentIndex, entries.spentIndex,
+                                          entries.timestampIndex, entries.addressBlocks, fErase, progress))
+        return false;
+    entries.clear();
+    return true;
+}
+
+/** Remove the blocks that are no longer in the active chain from the indexes being built, most recent first */
+static bool UnwindBuildIndexes()
+{
+    while (true) {
+        boost::this_thread::interruption_point();
+
+        CBuildBlock item;
+        item.pindex = NULL;
+        {
+            LOCK2(cs_main, cs_indexbuilder);
+            for (int n = 0; n < BUILD_INDEXES; n++) {
+                CBlockIndex *pindexBest = vIndexes[n].pindexBest;
+                if (vIndexes[n].fPending && pindexBest && !chainActive.Contains(pindexBest) &&
+                    (item.pindex == NULL || pindexBest->nHeight > item.pindex->nHeight))
+                    item.pindex = pindexBest;
+            }
+        }
+        if (item.pindex == NULL)
+            return true;
+
+        if (!ReadBuildBlock(item))
+            return false;
+
+        bool fBuild[BUILD_INDEXES];
+        {
+            LOCK(cs_indexbuilder);
+            for (int n = 0; n < BUILD_INDEXES; n++) {
+                fBuild[n] = vIndexes[n].fPending && vIndexes[n].pindexBest == item.pindex;
+                if (fBuild[n])
+                    vIndexes[n].pindexBest = item.pindex->pprev;
+            }
+        }
+
+        LogPrint("indexbuild", "%s: removing block %s at height %d\n", __func__, item.pindex->GetBlockHash().ToString(), item.pindex->nHeight);
+        CIndexEntries entries;
+        GetBlockEntries(item, fBuild[BUILD_ADDRESSINDEX], fBuild[BUILD_SPENTINDEX], fBuild[BUILD_TIMESTAMPINDEX], true, entries);
+        if (!WriteBuildEntries(entries, true))
+            return error("%s: failed to write index entries", __func__);
+    }
+}
+
+/** Get the block every index being built has reached, which is where the builder continues */
+static CBlockIndex *GetBuildStart()
+{
+    LOCK(cs_indexbuilder);
+    CBlockIndex *pindexStart = NULL;
+    bool fFirst = true;
+    for (int n = 0; n < BUILD_INDEXES; n++) {
+        if (!vIndexes[n].fPending)
+            continue;
+        CBlockIndex *pindexBest = vIndexes[n].pindexBest;
+        if (fFirst || pindexBest == NULL || (pindexStart != NULL && pindexBest->nHeight < pindexStart->nHeight))
+            pindexStart = pindexBest;
+        fFirst = false;
+    }
+    return pindexStart;
+}
+
+/**
+ * Enable the indexes once they include the tip. This happens with cs_main held,
+ * so ConnectBlock takes over with the next block.
+ */
+static bool FinishBuildIndexes(CIndexEntries& entries, CBlockIndex *pindexLast, bool& fDone)
+{
+    fDone = false;
+
+    LOCK2(cs_main, cs_indexbuilder);
+    if (pindexLast != chainActive.Tip())
+        return true;
+
+    std::vector<std::string> names;
+    for (int n = 0; n < BUILD_INDEXES; n++) {
+        if (!vIndexes[n].fPending)
+            continue;
+        if (vIndexes[n].pindexBest != pindexLast)
+            return true;
+        names.push_back(vIndexes[n].name);
+        if (n == BUILD_ADDRESSINDEX)
+            names.push_back("addressbalanceindex");
+    }
+
+    if (!WriteBuildEntries(entries, false) || !pindexdb->Sync())
+        return error("%s: failed to write index entries", __func__);
+    // drop the progress only after the flags are set, otherwise a restart in between would build on top of the finished indexes
+    for (std::vector<std::string>::const_iterator it = names.begin(); it != names.end(); ++it) {
+        if (!pblocktree->WriteFlag(*it, true))
+            return error("%s: failed to write index flags", __func__);
+    }
+    if (!pblocktree->Sync() || !pindexdb->EraseIndexBuildProgress(names))
+        return error("%s: failed to write index flags", __func__);
+
+    for (int n = 0; n < BUILD_INDEXES; n++) {
+        if (!vIndexes[n].fPending)
+            continue;
+        LogPrintf("%s: %s built up to height %d and enabled\n", __func__, vIndexes[n].name, pindexLast ? pindexLast->nHeight : -1);
+        *vIndexes[n].pfEnabled = true;
+        vIndexes[n].fPending = false;
+        vIndexes[n].pindexBest = NULL;
+    }
+    fDone = true;
+    return true;
+}
+
+/** Whether a reorg disconnected blocks that some index being built already includes */
+static bool HaveStaleBuildIndexes()
+{
+    LOCK2(cs_main, cs_indexbuilder);
+    for (int n = 0; n < BUILD_INDEXES; n++) {
+        if (vIndexes[n].fPending && vIndexes[n].pindexBest && !chainActive.Contains(vIndexes[n].pindexBest))
+            return true;
+    }
+    return false;
+}
+
+static bool BuildIndexes()
+{
+    if (!UnwindBuildIndexes())
+        return false;
+
+    CBlockIndex *pindexLast = GetBuildStart();
+    LogPrintf("%s: building indexes from height %d\n", __func__, pindexLast ? pindexLast->nHeight + 1 : 0);
+
+    CBuildBlockReader reader(pindexLast);
+    CIndexEntries entries;
+    int nBlocks = 0;
+
+    while (true) {
+        boost::this_thread::interruption_point();
+
+        CBuildBlockRef item = reader.Pop(500);
+        if (!item && reader.Failed())
+            return false;
+
+        if (HaveStaleBuildIndexes()) {
+            // the active chain changed under us, take back what left it and continue from there
+            if (!WriteBuildEntries(entries, false))
+                return error("%s: failed to write index entries", __func__);
+            nBlocks = 0;
+            if (!UnwindBuildIndexes())
+                return false;
+            pindexLast = GetBuildStart();
+            reader.Reset(pindexLast);
+            continue;
+        }
+
+        if (!item) {
+            // nothing left to read, which is the case once the builder reached the tip
+            bool fDone;
+            if (!FinishBuildIndexes(entries, pindexLast, fDone))
+                return false;
+            if (fDone)
+                return true;
+            continue;
+        }
+
+        {
+            LOCK(cs_main);
+            if (item->pindex->pprev != pindexLast || !chainActive.Contains(item->pindex)) {
+                // read ahead into a fork that got disconnected
+                reader.Reset(pindexLast);
+                continue;
+            }
+        }
+
+        // indexes that are ahead, from an earlier run, wait until the others caught up with them
+        bool fBuild[BUILD_INDEXES];
+        {
+            LOCK(cs_indexbuilder);
+            for (int n = 0; n < BUILD_INDEXES; n++) {
+                fBuild[n] = vIndexes[n].fPending && vIndexes[n].pindexBest == pindexLast;
+                if (fBuild[n])
+                    vIndexes[n].pindexBest = item->pindex;
+            }
+        }
+        GetBlockEntries(*item, fBuild[BUILD_ADDRESSINDEX], fBuild[BUILD_SPENTINDEX], fBuild[BUILD_TIMESTAMPINDEX], false, entries);
+        pindexLast = item->pindex;
+
+        if (entries.size() >= INDEXBUILD_BATCH_ENTRIES || ++nBlocks >= INDEXBUILD_BATCH_BLOCKS) {
+            if (!WriteBuildEntries(entries, false))
+                return error("%s: failed to write index entries", __func__);
+            nBlocks = 0;
+        }
+        if (pindexLast->nHeight % 10000 == 0)
+            LogPrintf("%s: indexes built up to height %d\n", __func__, pindexLast->nHeight);
+    }
+}
+
+static void ThreadIndexBuilder()
+{
+    if (!BuildIndexes())
+        LogPrintf("%s: building the indexes failed, they stay disabled until the node is restarted\n", __func__);
+}
+
+bool InitIndexBuilder(std::string& strError)
+{
+    LOCK2(cs_main, cs_indexbuilder);
+    std::string strPending;
+    for (int n = 0; n < BUILD_INDEXES; n++) {
+        CBuildIndex &index = vIndexes[n];
+        index.fPending = !*index.pfEnabled && GetBoolArg(index.arg, index.fDefault);
+        index.pindexBest = NULL;
+        if (!index.fPending)
+            continue;
+
+        uint256 hashBest;
+        if (pindexdb->ReadIndexBuildProgress(index.name, hashBest)) {
+            BlockMap::iterator mi = mapBlockIndex.find(hashBest);
+            if (mi != mapBlockIndex.end())
+                index.pindexBest = mi->second;
+        }
+        LogPrintf("%s: %s will be built in the background, from height %d\n", __func__, index.name,
+                  index.pindexBest ? index.pindexBest->nHeight + 1 : 0);
+        strPending += strPending.empty() ? index.arg : std::string(", ") + index.arg;
+    }
+
+    // building the indexes needs all blocks and their undo data
+    if (fPruneMode && !strPending.empty()) {
+        strError = strprintf(_("You need to rebuild the database using -reindex to enable %s in prune mode"), strPending);
+        return false;
+    }
+    return true;
+}
+
+void StartIndexBuilder(boost::thread_group& threadGroup)
+{
+    {
+        LOCK(cs_indexbuilder);
+        bool fPending = false;
+        for (int n = 0; n < BUILD_INDEXES; n++)
+            fPending |= vIndexes[n].fPending;
+        if (!fPending)
+            return;
+    }
+    threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "indexbuild", &ThreadIndexBuilder));
+}
+
+void GetIndexBuildStatus(std::vector<CIndexBuildStatus>& vStatus)
+{
+    LOCK2(cs_main, cs_indexbuilder);
+    for (int n = 0; n < BUILD_INDEXES; n++) {
+        CIndexBuildStatus status;
+        status.name = vIndexes[n].name;
+        if (*vIndexes[n].pfEnabled) {
+            status.fSynced = true;
+            status.nHeight = chainActive.Height();
+        } else if (vIndexes[n].fPending) {
+            status.fSynced = false;
+            status.nHeight = vIndexes[n].pindexBest ? vIndexes[n].pindexBest->nHeight : -1;
+        } else {
+            continue;
+        }
+        vStatus.push_back(status);
+    }
+}
@@ -0,0 +1,35 @@
+// Copyright (c) 2017 The DigitSlate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_INDEXBUILDER_H
+#define BITCOIN_INDEXBUILDER_H
+
+#include <string>
+#include <vector>
+
+namespace boost {
+class thread_group;
+} // namespace boost
+
+/** State of one of the optional block indexes */
+struct CIndexBuildStatus
+{
+    std::string name;
+    bool fSynced;
+    int nHeight; //! height of the last block in the index, -1 if none
+};
+
+/**
+ * Look for optional indexes (-addressindex, -spentindex, -timestampindex) that
+ * are requested but missing from the block tree database. Those are built by
+ * StartIndexBuilder while the node is running, instead of with a full -reindex.
+ * Must be called after the block index is loaded.
+ */
+bool InitIndexBuilder(std::string& strError);
+/** Start building the indexes found by InitIndexBuilder, if any */
+void StartIndexBuilder(boost::thread_group& threadGroup);
+/** Get the state of the optional indexes that are enabled or being built */
+void GetIndexBuildStatus(std::vector<CIndexBuildStatus>& vStatus);
+
+#endif // BITCOIN_INDEXBUILDER_H
@@ -19,6 +19,7 @@
 #include "consensus/validation.h"
 #include "httpserver.h"
 #include "httprpc.h"
+#include "indexbuilder.h"
 #include "key.h"
 #include "main.h"
 #include "miner.h"
@@ -107,6 +108,7 @@ static CDSNotificationInterface* pdsNotificationInterface = NULL;
 // anyway.
 #define MIN_CORE_FILEDESCRIPTORS 0
 #else
+// Block files, logs, the wallet and the like; the databases are counted by GetDBFileDescriptors()
 #define MIN_CORE_FILEDESCRIPTORS 150
 #endif
 
@@ -182,7 +184,6 @@ public:
     // Writes do not need similar protection, as failure to write is handled by the caller.
 };
 
-static CCoinsViewDB *pcoinsdbview = NULL;
 static CCoinsViewErrorCatcher *pcoinscatcher = NULL;
 static boost::scoped_ptr<ECCVerifyHandle> globalVerifyHandle;
 
@@ -260,6 +261,8 @@ void PrepareShutdown()
         pcoinsdbview = NULL;
         delete pblocktree;
         pblocktree = NULL;
+        delete pindexdb;
+        pindexdb = NULL;
     }
 #ifdef ENABLE_WALLET
     if (pwalletMain)
@@ -368,6 +371,18 @@ void OnRPCPreCommand(const CRPCCommand& cmd)
         throw JSONRPCError(RPC_FORBIDDEN_BY_SAFE_MODE, string("Safe mode: ") + strWarning);
 }
 
+/** Help for the LevelDB settings of one database, -<strDB>dbcompression etc. */
+static std::string HelpMessageDBOpts(const std::string& strDB, const std::string& strName, bool fCompression)
+{
+    std::string strUsage;
+    strUsage += HelpMessageOpt("-" + strDB + "dbblocksize=<n>", strprintf(_("Size of the data blocks of the %s database in bytes, the unit of disk reads (default: %u)"), strName, DEFAULT_DB_BLOCK_SIZE));
+    strUsage += HelpMessageOpt("-" + strDB + "dbbloombits=<n>", strprintf(_("Bits per key of the bloom filters of the %s database, 0 = no filters (default: %d)"), strName, DEFAULT_DB_BLOOM_BITS));
+    strUsage += HelpMessageOpt("-" + strDB + "dbcompression", strprintf(_("Compress the %s database with Snappy (default: %u)"), strName, fCompression));
+    strUsage += HelpMessageOpt("-" + strDB + "dbmaxopenfiles=<n>", strprintf(_("Number of files of the %s database to keep open (%d to %d, default: %d)"), strName, MIN_DB_MAX_OPEN_FILES, MAX_DB_MAX_OPEN_FILES, DEFAULT_DB_MAX_OPEN_FILES));
+    strUsage += HelpMessageOpt("-" + strDB + "dbwritebuffer=<n>", strprintf(_("Size of the write buffer of the %s database in megabytes (default: derived from the cache size)"), strName));
+    return strUsage;
+}
+
 std::string HelpMessage(HelpMessageMode mode)
 {
     const bool showDebug = GetBoolArg("-help-debug", false);
@@ -393,6 +408,7 @@ std::string HelpMessage(HelpMessageMode mode)
     }
     strUsage += HelpMessageOpt("-datadir=<dir>", _("Specify data directory"));
     strUsage += HelpMessageOpt("-dbcache=<n>", strprintf(_("Set database cache size in megabytes (%d to %d, default: %d)"), nMinDbCache, nMaxDbCache, nDefaultDbCache));
+    strUsage += HelpMessageOpt("-indexdbcache=<n>", strprintf(_("Set the cache size of the transaction, address, spent and timestamp index database in megabytes, on top of -dbcache (%d to %d, default: %d)"), nMinDbCache, nMaxDbCache, nDefaultIndexDbCache));
     strUsage += HelpMessageOpt("-loadblock=<file>", _("Imports blocks from external blk000??.dat file on startup"));
     strUsage += HelpMessageOpt("-maxorphantx=<n>", strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS));
     strUsage += HelpMessageOpt("-maxmempool=<n>", strprintf(_("Keep the transaction memory pool below <n> megabytes (default: %u)"), DEFAULT_MAX_MEMPOOL_SIZE));
@@ -415,6 +431,12 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-timestampindex", strprintf(_("Maintain a timestamp index for block hashes, used to query blocks hashes by a range of timestamps (default: %u)"), DEFAULT_TIMESTAMPINDEX));
     strUsage += HelpMessageOpt("-spentindex", strprintf(_("Maintain a full spent index, used to query the spending txid and input index for an outpoint (default: %u)"), DEFAULT_SPENTINDEX));
 
+    strUsage += HelpMessageGroup(_("Database options:"));
+    strUsage += HelpMessageOpt("-dbbackgroundflush", strprintf(_("Write the chain state cache to disk in a background thread, which halves the part of -dbcache it can fill before it is written (default: %u)"), DEFAULT_DB_BACKGROUND_FLUSH));
+    strUsage += HelpMessageDBOpts("blocktree", _("block index"), false);
+    strUsage += HelpMessageDBOpts("chainstate", _("chain state"), false);
+    strUsage += HelpMessageDBOpts("index", _("transaction, address, spent and timestamp index"), DEFAULT_INDEXDB_COMPRESSION);
+
     strUsage += HelpMessageGroup(_("Connection options:"));
     strUsage += HelpMessageOpt("-addnode=<ip>", _("Add a node to connect to and attempt to keep the connection open"));
     strUsage += HelpMessageOpt("-banscore=<n>", strprintf(_("Threshold for disconnecting misbehaving peers (default: %u)"), DEFAULT_BANSCORE_THRESHOLD));
@@ -441,6 +463,9 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-proxy=<ip:port>", _("Connect through SOCKS5 proxy"));
     strUsage += HelpMessageOpt("-proxyrandomize", strprintf(_("Randomize credentials for every proxy connection. This enables Tor stream isolation (default: %u)"), DEFAULT_PROXYRANDOMIZE));
     strUsage += HelpMessageOpt("-seednode=<ip>", _("Connect to a node to retrieve peer addresses, and disconnect"));
+#ifdef HAVE_SYS_EPOLL_H
+    strUsage += HelpMessageOpt("-socketevents=<mode>", strprintf(_("Socket events mode, which must be one of: %s (default: %s)"), "select, epoll", "epoll"));
+#endif
     strUsage += HelpMessageOpt("-timeout=<n>", strprintf(_("Specify connection timeout in milliseconds (minimum: 1, default: %d)"), DEFAULT_CONNECT_TIMEOUT));
     strUsage += HelpMessageOpt("-torcontrol=<ip>:<port>", strprintf(_("Tor control port to use if onion listening enabled (default: %s)"), DEFAULT_TOR_CONTROL));
     strUsage += HelpMessageOpt("-torpassword=<pass>", _("Tor control port password (default: empty)"));
@@ -507,6 +532,7 @@ std::string HelpMessage(HelpMessageMode mode)
     if (showDebug)
     {
         strUsage += HelpMessageOpt("-checkblockindex", strprintf("Do a full consistency check for mapBlockIndex, setBlockIndexCandidates, chainActive and mapBlocksUnlinked occasionally. Also sets -checkmempool (default: %u)", Params(CBaseChainParams::MAIN).DefaultConsistencyChecks()));
+        strUsage += HelpMessageOpt("-checkblockreads", strprintf("Verify the merkle root of blocks read from disk through the block index (default: %u)", DEFAULT_CHECKBLOCKREADS));
         strUsage += HelpMessageOpt("-checkmempool=<n>", strprintf("Run checks every <n> transactions (default: %u)", Params(CBaseChainParams::MAIN).DefaultConsistencyChecks()));
         strUsage += HelpMessageOpt("-checkpoints", strprintf("Disable expensive verification for known chain history (default: %u)", DEFAULT_CHECKPOINTS_ENABLED));
 #ifdef ENABLE_WALLET
@@ -545,7 +571,7 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-mocktime=<n>", "Replace actual time with <n> seconds since epoch (default: 0)");
         strUsage += HelpMessageOpt("-limitfreerelay=<n>", strprintf("Continuously rate-limit free transactions to <n>*1000 bytes per minute (default: %u)", DEFAULT_LIMITFREERELAY));
         strUsage += HelpMessageOpt("-relaypriority", strprintf("Require high priority for relaying free or low-fee transactions (default: %u)", DEFAULT_RELAYPRIORITY));
-        strUsage += HelpMessageOpt("-maxsigcachesize=<n>", strprintf("Limit size of signature cache to <n> MiB (default: %u)", DEFAULT_MAX_SIG_CACHE_SIZE));
+        strUsage += HelpMessageOpt("-maxsigcachesize=<n>", strprintf("Limit size of signature cache to <n> MiB, which is allocated at startup (0 to %d, default: %u)", MAX_MAX_SIG_CACHE_SIZE, DEFAULT_MAX_SIG_CACHE_SIZE));
     }
     strUsage += HelpMessageOpt("-minrelaytxfee=<amt>", strprintf(_("Fees (in %s/kB) smaller than this are considered zero fee for relaying, mining and transaction creation (default: %s)"),
         CURRENCY_UNIT, FormatMoney(DEFAULT_MIN_RELAY_TX_FEE)));
@@ -607,6 +633,8 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-rpcport=<port>", strprintf(_("Listen for JSON-RPC connections on <port> (default: %u or testnet: %u)"), BaseParams(CBaseChainParams::MAIN).RPCPort(), BaseParams(CBaseChainParams::TESTNET).RPCPort()));
     strUsage += HelpMessageOpt("-rpcallowip=<ip>", _("Allow JSON-RPC connections from specified source. Valid for <ip> are a single IP (e.g. 1.2.3.4), a network/netmask (e.g. 1.2.3.4/255.255.255.0) or a network/CIDR (e.g. 1.2.3.4/24). This option can be specified multiple times"));
     strUsage += HelpMessageOpt("-rpcthreads=<n>", strprintf(_("Set the number of threads to service RPC calls (default: %d)"), DEFAULT_HTTP_THREADS));
+    strUsage += HelpMessageOpt("-rpcbatchmaxsize=<n>", strprintf(_("Reject JSON-RPC batches of more than <n> requests, 0 = no limit (default: %u)"), DEFAULT_RPC_BATCH_MAX_SIZE));
+    strUsage += HelpMessageOpt("-rpcbatchtimeout=<n>", strprintf(_("Fail the remaining requests of a JSON-RPC batch after <n> seconds, 0 = no limit (default: %d)"), DEFAULT_RPC_BATCH_TIMEOUT));
     if (showDebug) {
         strUsage += HelpMessageOpt("-rpcworkqueue=<n>", strprintf("Set the depth of the work queue to service RPC calls (default: %d)", DEFAULT_HTTP_WORKQUEUE));
         strUsage += HelpMessageOpt("-rpcservertimeout=<n>", strprintf("Timeout during HTTP requests (default: %d)", DEFAULT_HTTP_SERVER_TIMEOUT));
@@ -905,6 +933,38 @@ void InitLogging()
     LogPrintf("DigitSlate version %s (%s)\n", FormatFullVersion(), CLIENT_DATE);
 }
 
+/** Number of files the <strDB> database may keep open, clamped like LevelDB does */
+static int GetDBMaxOpenFiles(const std::string& strDB, int nDefault = DEFAULT_DB_MAX_OPEN_FILES)
+{
+    int64_t nMaxOpenFiles = GetArg("-" + strDB + "dbmaxopenfiles", nDefault);
+    return (int)std::min(std::max(nMaxOpenFiles, (int64_t)MIN_DB_MAX_OPEN_FILES), (int64_t)MAX_DB_MAX_OPEN_FILES);
+}
+
+/** Apply the -<strDB>db* LevelDB settings to dbOptions, which holds the defaults for that database */
+static void GetDBOptionArgs(const std::string& strDB, CDBOptions& dbOptions)
+{
+    const std::string strPrefix = "-" + strDB + "db";
+    dbOptions.fCompression = GetBoolArg(strPrefix + "compression", dbOptions.fCompression);
+    // LevelDB clamps the write buffer by itself, but not the block size
+    dbOptions.nBlockSize = std::min(std::max(GetArg(strPrefix + "blocksize", dbOptions.nBlockSize), (int64_t)1 << 10), (int64_t)4 << 20);
+    dbOptions.nMaxOpenFiles = GetDBMaxOpenFiles(strDB, dbOptions.nMaxOpenFiles);
+    dbOptions.nBloomBits = std::max((int)GetArg(strPrefix + "bloombits", dbOptions.nBloomBits), 0);
+    if (mapArgs.count(strPrefix + "writebuffer"))
+        dbOptions.nWriteBufferSize = std::max(GetArg(strPrefix + "writebuffer", 0), (int64_t)0) << 20;
+}
+
+/** File descriptors the databases opened by AppInit2 may use on top of MIN_CORE_FILEDESCRIPTORS */
+static int GetDBFileDescriptors()
+{
+    int nFiles = 0;
+#ifndef WIN32
+    const char* const pszDBs[] = {"blocktree", "chainstate", "index"};
+    for (unsigned int i = 0; i < ARRAYLEN(pszDBs); i++)
+        nFiles += GetDBMaxOpenFiles(pszDBs[i]);
+#endif
+    return nFiles;
+}
+
 /** Initialize DigitSlate.
  *  @pre Parameters should be parsed and config file should be read.
  */
@@ -982,17 +1042,33 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 #endif
     }
 
+#ifdef HAVE_SYS_EPOLL_H
+    std::string strSocketEventsMode = GetArg("-socketevents", "epoll");
+#else
+    std::string strSocketEventsMode = GetArg("-socketevents", "select");
+#endif
+    if (strSocketEventsMode == "select")
+        nSocketEventsMode = SOCKETEVENTS_SELECT;
+#ifdef HAVE_SYS_EPOLL_H
+    else if (strSocketEventsMode == "epoll")
+        nSocketEventsMode = SOCKETEVENTS_EPOLL;
+#endif
+    else
+        return InitError(strprintf(_("Invalid -socketevents ('%s') specified."), strSocketEventsMode));
+
     // Make sure enough file descriptors are available
     int nBind = std::max((int)mapArgs.count("-bind") + (int)mapArgs.count("-whitebind"), 1);
     int nUserMaxConnections = GetArg("-maxconnections", DEFAULT_MAX_PEER_CONNECTIONS);
     nMaxConnections = std::max(nUserMaxConnections, 0);
+    int nCoreFD = MIN_CORE_FILEDESCRIPTORS + GetDBFileDescriptors();
 
     // Trim requested connection counts, to fit into system limitations
-    nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS)), 0);
-    int nFD = RaiseFileDescriptorLimit(nMaxConnections + MIN_CORE_FILEDESCRIPTORS);
-    if (nFD < MIN_CORE_FILEDESCRIPTORS)
+    if (nSocketEventsMode == SOCKETEVENTS_SELECT)
+        nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - nCoreFD)), 0);
+    int nFD = RaiseFileDescriptorLimit(nMaxConnections + nCoreFD);
+    if (nFD < nCoreFD)
         return InitError(_("Not enough file descriptors available."));
-    nMaxConnections = std::min(nFD - MIN_CORE_FILEDESCRIPTORS, nMaxConnections);
+    nMaxConnections = std::min(nFD - nCoreFD, nMaxConnections);
 
     if (nMaxConnections < nUserMaxConnections)
         InitWarning(strprintf(_("Reducing -maxconnections from %d to %d, because of system limitations."), nUserMaxConnections, nMaxConnections));
@@ -1027,6 +1103,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         mempool.setSanityCheck(1.0 / ratio);
     }
     fCheckBlockIndex = GetBoolArg("-checkblockindex", chainparams.DefaultConsistencyChecks());
+    fCheckBlockReads = GetBoolArg("-checkblockreads", DEFAULT_CHECKBLOCKREADS);
     fCheckpointsEnabled = GetBoolArg("-checkpoints", DEFAULT_CHECKPOINTS_ENABLED);
 
     // mempool limits
@@ -1215,10 +1292,14 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     LogPrintf("Using at most %i connections (%i file descriptors available)\n", nMaxConnections, nFD);
     std::ostringstream strErrors;
 
+    InitSignatureCache();
+
     LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads);
     if (nScriptCheckThreads) {
-        for (int i=0; i<nScriptCheckThreads-1; i++)
+        for (int i=0; i<nScriptCheckThreads-1; i++) {
             threadGroup.create_thread(&ThreadScriptCheck);
+            threadGroup.create_thread(&ThreadHeaderHash);
+        }
     }
 
     if (mapArgs.count("-sporkkey")) // spork priv key
@@ -1452,17 +1533,31 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     nTotalCache = std::max(nTotalCache, nMinDbCache << 20); // total cache cannot be less than nMinDbCache
     nTotalCache = std::min(nTotalCache, nMaxDbCache << 20); // total cache cannot be greated than nMaxDbcache
     int64_t nBlockTreeDBCache = nTotalCache / 8;
-    if (nBlockTreeDBCache > (1 << 21) && !GetBoolArg("-txindex", DEFAULT_TXINDEX))
-        nBlockTreeDBCache = (1 << 21); // block tree db cache shouldn't be larger than 2 MiB
+    if (nBlockTreeDBCache > (1 << 21))
+        nBlockTreeDBCache = (1 << 21); // block tree db cache shouldn't be larger than 2 MiB, the indexes have their own
     nTotalCache -= nBlockTreeDBCache;
     int64_t nCoinDBCache = std::min(nTotalCache / 2, (nTotalCache / 4) + (1 << 23)); // use 25%-50% of the remainder for disk cache
     nTotalCache -= nCoinDBCache;
     nCoinCacheUsage = nTotalCache; // the rest goes to in-memory cache
+    CDBOptions blockTreeDBOptions(nBlockTreeDBCache);
+    GetDBOptionArgs("blocktree", blockTreeDBOptions);
+    CDBOptions coinDBOptions(nCoinDBCache);
+    GetDBOptionArgs("chainstate", coinDBOptions);
     LogPrintf("Cache configuration:\n");
     LogPrintf("* Using %.1fMiB for block index database\n", nBlockTreeDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for chain state database\n", nCoinDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for in-memory UTXO set\n", nCoinCacheUsage * (1.0 / 1024 / 1024));
 
+    int64_t nIndexDBCache = (GetArg("-indexdbcache", nDefaultIndexDbCache) << 20);
+    nIndexDBCache = std::max(nIndexDBCache, nMinDbCache << 20);
+    nIndexDBCache = std::min(nIndexDBCache, nMaxDbCache << 20);
+    CDBOptions indexDBOptions(nIndexDBCache);
+    // Index keys are mostly appended, so bigger write buffers mean fewer level-0 files to compact
+    indexDBOptions.nWriteBufferSize = std::max(nIndexDBCache / 4, (int64_t)8 << 20);
+    indexDBOptions.fCompression = DEFAULT_INDEXDB_COMPRESSION;
+    GetDBOptionArgs("index", indexDBOptions);
+    LogPrintf("* Using %.1fMiB for index database\n", nIndexDBCache * (1.0 / 1024 / 1024));
+
     bool fLoaded = false;
     while (!fLoaded) {
         bool fReset = fReindex;
@@ -1478,9 +1573,11 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                 delete pcoinsdbview;
                 delete pcoinscatcher;
                 delete pblocktree;
+                delete pindexdb;
 
-                pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReindex);
-                pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReindex);
+                pblocktree = new CBlockTreeDB(blockTreeDBOptions, false, fReindex);
+                pindexdb = new CIndexDB(indexDBOptions, false, fReindex);
+                pcoinsdbview = new CCoinsViewDB(coinDBOptions, false, fReindex);
                 pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbview);
                 pcoinsTip = new CCoinsViewCache(pcoinscatcher);
 
@@ -1491,6 +1588,25 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                         CleanupBlockRevFiles();
                 }
 
+                // Older versions kept the indexes in the block tree database
+                if (!fReindex && !pindexdb->MoveFromBlockTree(*pblocktree)) {
+                    strLoadError = _("Error moving the indexes to their own database");
+                    break;
+                }
+
+                // Older versions stored one record per transaction in the coin database
+                if (pcoinsdbview->GetFormatVersion() > COINS_DB_VERSION)
+                    return InitError(_("The chainstate database requires a newer version of DigitSlate"));
+                if (!pcoinsdbview->Upgrade()) {
+                    strLoadError = _("Error upgrading chainstate database");
+                    break;
+                }
+                // The upgrade can take long and stops between its batches on a shutdown request
+                if (ShutdownRequested()) {
+                    LogPrintf("Shutdown requested. Exiting.\n");
+                    return false;
+                }
+
                 if (!LoadBlockIndex()) {
                     strLoadError = _("Error loading block database");
                     break;
@@ -1513,6 +1629,10 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                     break;
                 }
 
+                // Indexes requested for an existing database are built in the background
+                if (!InitIndexBuilder(strLoadError))
+                    break;
+
                 // Check for changed -prune state.  What we are concerned about is a user who has pruned blocks
                 // in the past, but is now trying to run unpruned.
                 if (fHavePruned && !fPruneMode) {
@@ -1580,6 +1700,9 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     }
     LogPrintf(" block index %15dms\n", GetTimeMillis() - nStart);
 
+    if (GetBoolArg("-dbbackgroundflush", DEFAULT_DB_BACKGROUND_FLUSH))
+        pcoinsdbview->StartWriter();
+
     boost::filesystem::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
     CAutoFile est_filein(fopen(est_path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
     // Allowed to fail as this file IS missing on first startup.
@@ -1788,6 +1911,8 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
             MilliSleep(10);
     }
 
+    StartIndexBuilder(threadGroup);
+
     // ********************************************************* Step 11a: setup PrivateSend
     fMasterNode = GetBoolArg("-masternode", false);
 
@@ -81,6 +81,10 @@ class Cache {
   // its cache keys.
   virtual uint64_t NewId() = 0;
 
+  // Return an estimate of the combined charges of all elements stored in the
+  // cache.
+  virtual size_t TotalCharge() const = 0;
+
  private:
   void LRU_Remove(Handle* e);
   void LRU_Append(Handle* e);
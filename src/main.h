@@ -33,6 +33,9 @@
 
 class CBlockIndex;
 class CBlockTreeDB;
+class CBlockUndo;
+class CCoinsViewDB;
+class CIndexDB;
 class CBloomFilter;
 class CChainParams;
 class CInv;
@@ -85,6 +88,8 @@ static const unsigned int BLOCK_STALLING_TIMEOUT = 2;
 /** Number of headers sent in one getheaders result. We rely on the assumption that if a peer sends
  *  less than this number, we reached its tip. Changing this value is a protocol upgrade. */
 static const unsigned int MAX_HEADERS_RESULTS = 2000;
+/** Number of headers of a headers message that are hashed before they are checked for sequence and work */
+static const unsigned int MAX_HEADER_HASH_CHUNK = 64;
 /** Size of the "block download window": how far ahead of our current height do we fetch?
  *  Larger windows tolerate larger download speed differences between peer, but increase the potential
  *  degree of disordering of blocks on disk (which make reindexing and in the future perhaps pruning
@@ -115,6 +120,8 @@ static const bool DEFAULT_RELAYPRIORITY = true;
 static const bool DEFAULT_PERMIT_BAREMULTISIG = true;
 static const unsigned int DEFAULT_BYTES_PER_SIGOP = 20;
 static const bool DEFAULT_CHECKPOINTS_ENABLED = true;
+/** Default for -checkblockreads */
+static const bool DEFAULT_CHECKBLOCKREADS = false;
 static const bool DEFAULT_TXINDEX = true;
 static const bool DEFAULT_ADDRESSINDEX = false;
 static const bool DEFAULT_TIMESTAMPINDEX = false;
@@ -147,10 +154,14 @@ extern bool fImporting;
 extern bool fReindex;
 extern int nScriptCheckThreads;
 extern bool fTxIndex;
+extern bool fAddressIndex;
+extern bool fTimestampIndex;
+extern bool fSpentIndex;
 extern bool fIsBareMultisigStd;
 extern bool fRequireStandard;
 extern unsigned int nBytesPerSigOp;
 extern bool fCheckBlockIndex;
+extern bool fCheckBlockReads;
 extern bool fCheckpointsEnabled;
 extern size_t nCoinCacheUsage;
 extern CFeeRate minRelayTxFee;
@@ -232,6 +243,8 @@ bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the header hashing thread */
+void ThreadHeaderHash();
 
 /** Try to detect Partition (network isolation) attacks against us */
 void PartitionCheck(bool (*initialDownloadCheck)(), CCriticalSection& cs, const CBlockIndex *const &bestHeader, int64_t nPowTargetSpacing);
@@ -544,6 +557,35 @@ struct CAddressIndexIteratorKey {
     }
 };
 
+struct CAddressBalanceValue {
+    CAmount received;
+    CAmount balance;
+    unsigned int txCount;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(received);
+        READWRITE(balance);
+        READWRITE(txCount);
+    }
+
+    CAddressBalanceValue() {
+        SetNull();
+    }
+
+    void SetNull() {
+        received = 0;
+        balance = 0;
+        txCount = 0;
+    }
+
+    bool IsNull() const {
+        return (txCount == 0);
+    }
+};
+
 struct CAddressIndexIteratorHeightKey {
     unsigned int type;
     uint160 hashBytes;
@@ -712,18 +754,61 @@ public:
     ScriptError GetScriptError() const { return error; }
 };
 
+/**
+ * Closure representing one block header to be hashed by HashHeaders.
+ * Note that this stores pointers to the header and to the result slot.
+ */
+class CHeaderHashCheck
+{
+private:
+    const CBlockHeader *pheader;
+    uint256 *phash;
+
+public:
+    CHeaderHashCheck(): pheader(NULL), phash(NULL) {}
+    CHeaderHashCheck(const CBlockHeader& headerIn, uint256& hashOut) : pheader(&headerIn), phash(&hashOut) {}
+
+    bool operator()();
+
+    void swap(CHeaderHashCheck &check) {
+        std::swap(pheader, check.pheader);
+        std::swap(phash, check.phash);
+    }
+};
+
+/**
+ * Compute the hashes of a batch of block headers, e.g. one headers message.
+ * The NeoScrypt runs are spread over the ThreadHeaderHash workers, one per
+ * script verification thread; without those they run on the caller's thread.
+ * hashes[i] receives the hash of headers[i]. Headers are hashed in chunks of
+ * MAX_HEADER_HASH_CHUNK, and hashes ends with the first header that does not
+ * follow the one before it or does not meet its nBits.
+ */
+void HashHeaders(const std::vector<CBlockHeader>& headers, std::vector<uint256>& hashes, const Consensus::Params& consensusParams);
+
 bool GetTimestampIndex(const unsigned int &high, const unsigned int &low, std::vector<uint256> &hashes);
 bool GetSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value);
 bool GetAddressIndex(uint160 addressHash, int type,
                      std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
-                     int start = 0, int end = 0);
+                     int start = 0, int end = 0,
+                     const CAddressIndexKey *pAfter = NULL, size_t nLimit = 0, bool fDescending = false);
+/** Entries of all the given addresses, ordered by block height and position within the block */
+bool GetAddressIndexes(const std::vector<std::pair<uint160, int> > &addresses,
+                       std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
+                       int start = 0, int end = 0,
+                       const CAddressIndexKey *pAfter = NULL, size_t nLimit = 0, bool fDescending = false);
 bool GetAddressUnspent(uint160 addressHash, int type,
-                       std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs);
+                       std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs,
+                       const CAddressUnspentKey *pAfter = NULL, size_t nLimit = 0);
+bool GetAddressBalance(uint160 addressHash, int type, CAddressBalanceValue &balance);
 
 /** Functions for disk access for blocks */
 bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
+/** Read the serialized block behind pindex into block without deserializing it, its size is taken from the block file */
+bool ReadRawBlockFromDisk(CDataStream& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& messageStart);
+bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock);
 
 /** Functions for validating blocks and updating the block tree */
 
@@ -742,6 +827,8 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
 /** Context-independent validity checks */
 bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW = true);
+/** Same as above, with the hash of block already known */
+bool CheckBlockHeader(const CBlockHeader& block, const uint256& hash, CValidationState& state, bool fCheckPOW = true);
 bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW = true, bool fCheckMerkleRoot = true);
 
 /** Context-dependent validity checks */
@@ -829,9 +916,21 @@ extern CChain chainActive;
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern CCoinsViewCache *pcoinsTip;
 
+/** Global variable that points to the coin database below pcoinsTip (protected by cs_main) */
+extern CCoinsViewDB *pcoinsdbview;
+
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern CBlockTreeDB *pblocktree;
 
+/**
+ * Global variable that points to the transaction, address, spent and timestamp indexes.
+ * It is only replaced during startup, before the RPC server leaves warmup, so
+ * readers like GetTransaction use it without cs_main and may see the entries of
+ * a block that is still being connected. Entries are written under cs_main, or
+ * by the index builder for indexes that ConnectBlock does not write yet.
+ */
+extern CIndexDB *pindexdb;
+
 /**
  * Return the spend height, which is one more than the inputs.GetBestBlock().
  * While checking, GetBestBlock() refers to the parent block. (protected by cs_main)
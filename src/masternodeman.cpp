@@ -99,6 +99,8 @@ void CMasternodeIndex::RebuildIndex()
 CMasternodeMan::CMasternodeMan()
 : cs(),
   vMasternodes(),
+  mapMasternodePosByOutPoint(),
+  mapMasternodePosByPubKey(),
   mAskedUsForMasternodeList(),
   mWeAskedForMasternodeList(),
   mWeAskedForMasternodeListEntry(),
@@ -114,6 +116,7 @@ CMasternodeMan::CMasternodeMan()
   fMasternodesRemoved(false),
   vecDirtyGovernanceObjectHashes(),
   nLastWatchdogVoteTime(0),
+  mapMasternodeScores(),
   mapSeenMasternodeBroadcast(),
   mapSeenMasternodePing(),
   nDsqCount(0)
@@ -127,6 +130,10 @@ bool CMasternodeMan::Add(CMasternode &mn)
     if (pmn == NULL) {
         LogPrint("masternode", "CMasternodeMan::Add -- Adding new Masternode: addr=%s, %i now\n", mn.addr.ToString(), size() + 1);
         vMasternodes.push_back(mn);
+        mapMasternodePosByOutPoint[mn.vin.prevout] = vMasternodes.size() - 1;
+        // the new masternode is the last with its key, the lookup keeps an earlier one
+        mapMasternodePosByPubKey.insert(std::make_pair(mn.pubKeyMasternode, vMasternodes.size() - 1));
+        mapMasternodeScores.clear();
         indexMasternodes.AddMasternodeVIN(mn.vin);
         fMasternodesAdded = true;
         return true;
@@ -193,6 +200,8 @@ void CMasternodeMan::CheckAndRemove()
         std::vector<std::pair<int, CMasternode> > vecMasternodeRanks;
         // ask for up to MNB_RECOVERY_MAX_ASK_ENTRIES masternode entries at a time
         int nAskForMnbRecovery = MNB_RECOVERY_MAX_ASK_ENTRIES;
+        // positions shift with every erase, the lookup maps are rebuilt once after the loop
+        bool fRebuildLookupMaps = false;
         while(it != vMasternodes.end()) {
             CMasternodeBroadcast mnb = CMasternodeBroadcast(*it);
             uint256 hash = mnb.GetHash();
@@ -207,6 +216,8 @@ void CMasternodeMan::CheckAndRemove()
                 // and finally remove it from the list
                 it->FlagGovernanceItemsAsDirty();
                 it = vMasternodes.erase(it);
+                fRebuildLookupMaps = true;
+                mapMasternodeScores.clear();
                 fMasternodesRemoved = true;
             } else {
                 bool fAsk = pCurrentBlockIndex &&
@@ -243,6 +254,8 @@ void CMasternodeMan::CheckAndRemove()
                 ++it;
             }
         }
+        if(fRebuildLookupMaps)
+            RebuildLookupMaps();
 
         // proces replies for MASTERNODE_NEW_START_REQUIRED masternodes
         LogPrint("masternode", "CMasternodeMan::CheckAndRemove -- mMnbRecoveryGoodReplies size=%d\n", (int)mMnbRecoveryGoodReplies.size());
@@ -367,6 +380,9 @@ void CMasternodeMan::Clear()
 {
     LOCK(cs);
     vMasternodes.clear();
+    mapMasternodePosByOutPoint.clear();
+    mapMasternodePosByPubKey.clear();
+    mapMasternodeScores.clear();
     mAskedUsForMasternodeList.clear();
     mWeAskedForMasternodeList.clear();
     mWeAskedForMasternodeListEntry.clear();
@@ -460,24 +476,65 @@ CMasternode* CMasternodeMan::Find(const CTxIn &vin)
 {
     LOCK(cs);
 
-    BOOST_FOREACH(CMasternode& mn, vMasternodes)
-    {
-        if(mn.vin.prevout == vin.prevout)
-            return &mn;
-    }
-    return NULL;
+    outpoint_pos_m_t::const_iterator it = mapMasternodePosByOutPoint.find(vin.prevout);
+    if(it == mapMasternodePosByOutPoint.end())
+        return NULL;
+    return &vMasternodes[it->second];
 }
 
 CMasternode* CMasternodeMan::Find(const CPubKey &pubKeyMasternode)
 {
     LOCK(cs);
 
-    BOOST_FOREACH(CMasternode& mn, vMasternodes)
-    {
-        if(mn.pubKeyMasternode == pubKeyMasternode)
-            return &mn;
+    pubkey_pos_m_t::const_iterator it = mapMasternodePosByPubKey.find(pubKeyMasternode);
+    if(it == mapMasternodePosByPubKey.end())
+        return NULL;
+    return &vMasternodes[it->second];
+}
+
+void CMasternodeMan::RebuildLookupMaps()
+{
+    AssertLockHeld(cs);
+
+    mapMasternodePosByOutPoint.clear();
+    mapMasternodePosByPubKey.clear();
+    for(int i = 0; i < (int)vMasternodes.size(); i++) {
+        mapMasternodePosByOutPoint[vMasternodes[i].vin.prevout] = i;
+        // keep the first match for duplicate keys
+        mapMasternodePosByPubKey.insert(std::make_pair(vMasternodes[i].pubKeyMasternode, i));
     }
-    return NULL;
+}
+
+void CMasternodeMan::UpdatePubKeyLookup(const CPubKey& pubKeyOld, const CMasternode* pmn)
+{
+    AssertLockHeld(cs);
+
+    outpoint_pos_m_t::const_iterator it = mapMasternodePosByOutPoint.find(pmn->vin.prevout);
+    if(it == mapMasternodePosByOutPoint.end() || pubKeyOld == pmn->pubKeyMasternode) return;
+
+    // another masternode may still have the old key
+    pubkey_pos_m_t::const_iterator itOld = mapMasternodePosByPubKey.find(pubKeyOld);
+    if(itOld != mapMasternodePosByPubKey.end() && itOld->second == it->second)
+        RescanPubKeyLookup(pubKeyOld);
+
+    pubkey_pos_m_t::iterator itNew = mapMasternodePosByPubKey.find(pmn->pubKeyMasternode);
+    if(itNew == mapMasternodePosByPubKey.end())
+        mapMasternodePosByPubKey.insert(std::make_pair(pmn->pubKeyMasternode, it->second));
+    else if(it->second < itNew->second)
+        itNew->second = it->second;
+}
+
+void CMasternodeMan::RescanPubKeyLookup(const CPubKey& pubKey)
+{
+    AssertLockHeld(cs);
+
+    for(int i = 0; i < (int)vMasternodes.size(); i++) {
+        if(vMasternodes[i].pubKeyMasternode == pubKey) {
+            mapMasternodePosByPubKey[pubKey] = i;
+            return;
+        }
+    }
+    mapMasternodePosByPubKey.erase(pubKey);
 }
 
 bool CMasternodeMan::Get(const CPubKey& pubKeyMasternode, CMasternode& masternode)
@@ -658,18 +715,47 @@ CMasternode* CMasternodeMan::FindRandomNotInVec(const std::vector<CTxIn> &vecToE
     return NULL;
 }
 
-int CMasternodeMan::GetMasternodeRank(const CTxIn& vin, int nBlockHeight, int nMinProtocol, bool fOnlyActive)
+const CMasternodeMan::score_vector_t& CMasternodeMan::GetMasternodeScores(const uint256& blockHash)
 {
-    std::vector<std::pair<int64_t, CMasternode*> > vecMasternodeScores;
+    AssertLockHeld(cs);
+
+    std::map<uint256, score_vector_t>::iterator it = mapMasternodeScores.find(blockHash);
+    if(it != mapMasternodeScores.end()) return it->second;
+
+    if((int)mapMasternodeScores.size() >= MAX_SCORE_CACHE_BLOCKS) {
+        mapMasternodeScores.clear();
+    }
+
+    score_vector_t& vecMasternodeScores = mapMasternodeScores[blockHash];
+    vecMasternodeScores.reserve(vMasternodes.size());
+
+    // Scores only depend on the block hash and the collateral outpoint, so they are
+    // calculated for every masternode once and callers filter by state afterwards.
+    // CompareScoreMN is a total order, so filtering the sorted vector gives the same
+    // ranks as sorting the filtered one.
+    BOOST_FOREACH(CMasternode& mn, vMasternodes) {
+        int64_t nScore = mn.CalculateScore(blockHash).GetCompact(false);
+        vecMasternodeScores.push_back(std::make_pair(nScore, &mn));
+    }
+
+    sort(vecMasternodeScores.rbegin(), vecMasternodeScores.rend(), CompareScoreMN());
 
+    return vecMasternodeScores;
+}
+
+int CMasternodeMan::GetMasternodeRank(const CTxIn& vin, int nBlockHeight, int nMinProtocol, bool fOnlyActive)
+{
     //make sure we know about this block
     uint256 blockHash = uint256();
     if(!GetBlockHash(blockHash, nBlockHeight)) return -1;
 
     LOCK(cs);
 
-    // scan for winner
-    BOOST_FOREACH(CMasternode& mn, vMasternodes) {
+    const score_vector_t& vecMasternodeScores = GetMasternodeScores(blockHash);
+
+    int nRank = 0;
+    BOOST_FOREACH (const PAIRTYPE(int64_t, CMasternode*)& scorePair, vecMasternodeScores) {
+        CMasternode& mn = *scorePair.second;
         if(mn.nProtocolVersion < nMinProtocol) continue;
         if(fOnlyActive) {
             if(!mn.IsEnabled()) continue;
@@ -677,17 +763,8 @@ int CMasternodeMan::GetMasternodeRank(const CTxIn& vin, int nBlockHeight, int nM
         else {
             if(!mn.IsValidForPayment()) continue;
         }
-        int64_t nScore = mn.CalculateScore(blockHash).GetCompact(false);
-
-        vecMasternodeScores.push_back(std::make_pair(nScore, &mn));
-    }
-
-    sort(vecMasternodeScores.rbegin(), vecMasternodeScores.rend(), CompareScoreMN());
-
-    int nRank = 0;
-    BOOST_FOREACH (PAIRTYPE(int64_t, CMasternode*)& scorePair, vecMasternodeScores) {
         nRank++;
-        if(scorePair.second->vin.prevout == vin.prevout) return nRank;
+        if(mn.vin.prevout == vin.prevout) return nRank;
     }
 
     return -1;
@@ -695,7 +772,6 @@ int CMasternodeMan::GetMasternodeRank(const CTxIn& vin, int nBlockHeight, int nM
 
 std::vector<std::pair<int, CMasternode> > CMasternodeMan::GetMasternodeRanks(int nBlockHeight, int nMinProtocol)
 {
-    std::vector<std::pair<int64_t, CMasternode*> > vecMasternodeScores;
     std::vector<std::pair<int, CMasternode> > vecMasternodeRanks;
 
     //make sure we know about this block
@@ -704,20 +780,11 @@ std::vector<std::pair<int, CMasternode> > CMasternodeMan::GetMasternodeRanks(int
 
     LOCK(cs);
 
-    // scan for winner
-    BOOST_FOREACH(CMasternode& mn, vMasternodes) {
-
-        if(mn.nProtocolVersion < nMinProtocol || !mn.IsEnabled()) continue;
-
-        int64_t nScore = mn.CalculateScore(blockHash).GetCompact(false);
-
-        vecMasternodeScores.push_back(std::make_pair(nScore, &mn));
-    }
-
-    sort(vecMasternodeScores.rbegin(), vecMasternodeScores.rend(), CompareScoreMN());
+    const score_vector_t& vecMasternodeScores = GetMasternodeScores(blockHash);
 
     int nRank = 0;
-    BOOST_FOREACH (PAIRTYPE(int64_t, CMasternode*)& s, vecMasternodeScores) {
+    BOOST_FOREACH (const PAIRTYPE(int64_t, CMasternode*)& s, vecMasternodeScores) {
+        if(s.second->nProtocolVersion < nMinProtocol || !s.second->IsEnabled()) continue;
         nRank++;
         vecMasternodeRanks.push_back(std::make_pair(nRank, *s.second));
     }
@@ -727,8 +794,6 @@ std::vector<std::pair<int, CMasternode> > CMasternodeMan::GetMasternodeRanks(int
 
 CMasternode* CMasternodeMan::GetMasternodeByRank(int nRank, int nBlockHeight, int nMinProtocol, bool fOnlyActive)
 {
-    std::vector<std::pair<int64_t, CMasternode*> > vecMasternodeScores;
-
     LOCK(cs);
 
     uint256 blockHash;
@@ -737,21 +802,12 @@ CMasternode* CMasternodeMan::GetMasternodeByRank(int nRank, int nBlockHeight, in
         return NULL;
     }
 
-    // Fill scores
-    BOOST_FOREACH(CMasternode& mn, vMasternodes) {
-
-        if(mn.nProtocolVersion < nMinProtocol) continue;
-        if(fOnlyActive && !mn.IsEnabled()) continue;
-
-        int64_t nScore = mn.CalculateScore(blockHash).GetCompact(false);
-
-        vecMasternodeScores.push_back(std::make_pair(nScore, &mn));
-    }
-
-    sort(vecMasternodeScores.rbegin(), vecMasternodeScores.rend(), CompareScoreMN());
+    const score_vector_t& vecMasternodeScores = GetMasternodeScores(blockHash);
 
     int rank = 0;
-    BOOST_FOREACH (PAIRTYPE(int64_t, CMasternode*)& s, vecMasternodeScores){
+    BOOST_FOREACH (const PAIRTYPE(int64_t, CMasternode*)& s, vecMasternodeScores){
+        if(s.second->nProtocolVersion < nMinProtocol) continue;
+        if(fOnlyActive && !s.second->IsEnabled()) continue;
         rank++;
         if(rank == nRank) {
             return s.second;
@@ -1396,7 +1452,9 @@ void CMasternodeMan::UpdateMasternodeList(CMasternodeBroadcast mnb)
         }
     } else {
         CMasternodeBroadcast mnbOld = mapSeenMasternodeBroadcast[CMasternodeBroadcast(*pmn).GetHash()].second;
+        CPubKey pubKeyOld = pmn->pubKeyMasternode;
         if(pmn->UpdateFromNewBroadcast(mnb)) {
+            UpdatePubKeyLookup(pubKeyOld, pmn);
             masternodeSync.AddedMasternodeList();
             mapSeenMasternodeBroadcast.erase(mnbOld.GetHash());
         }
@@ -1456,7 +1514,11 @@ bool CMasternodeMan::CheckMnbAndUpdateMasternodeList(CNode* pfrom, CMasternodeBr
     CMasternode* pmn = Find(mnb.vin);
     if(pmn) {
         CMasternodeBroadcast mnbOld = mapSeenMasternodeBroadcast[CMasternodeBroadcast(*pmn).GetHash()].second;
-        if(!mnb.Update(pmn, nDos)) {
+        CPubKey pubKeyOld = pmn->pubKeyMasternode;
+        bool fUpdated = mnb.Update(pmn, nDos);
+        // Update() can replace pubKeyMasternode
+        UpdatePubKeyLookup(pubKeyOld, pmn);
+        if(!fUpdated) {
             LogPrint("masternode", "CMasternodeMan::CheckMnbAndUpdateMasternodeList -- Update() failed, masternode=%s\n", mnb.vin.prevout.ToStringShort());
             return false;
         }
@@ -1650,6 +1712,12 @@ void CMasternodeMan::UpdatedBlockTip(const CBlockIndex *pindex)
     pCurrentBlockIndex = pindex;
     LogPrint("masternode", "CMasternodeMan::UpdatedBlockTip -- pCurrentBlockIndex->nHeight=%d\n", pCurrentBlockIndex->nHeight);
 
+    {
+        LOCK(cs);
+        // scores for old blocks are rarely asked for again, don't keep them around
+        mapMasternodeScores.clear();
+    }
+
     CheckSameAddr();
 
     if(fMasterNode) {
@@ -6,14 +6,41 @@
 #define MASTERNODEMAN_H
 
 #include "masternode.h"
+#include "random.h"
 #include "sync.h"
 
+#include <boost/unordered_map.hpp>
+
 using namespace std;
 
 class CMasternodeMan;
 
 extern CMasternodeMan mnodeman;
 
+struct CMasternodeOutPointHasher
+{
+    size_t operator()(const COutPoint& outpoint) const { return outpoint.hash.GetCheapHash() + outpoint.n; }
+};
+
+/** Salted, as the masternode keys are chosen by peers */
+class CMasternodePubKeyHasher
+{
+private:
+    uint256 salt;
+
+public:
+    CMasternodePubKeyHasher() : salt(GetRandHash()) {}
+
+    size_t operator()(const CPubKey& pubKey) const
+    {
+        // the X coordinate follows the prefix byte in both encodings
+        uint256 key;
+        if (pubKey.size() > 1)
+            memcpy(key.begin(), pubKey.begin() + 1, std::min(pubKey.size() - 1, (unsigned int)key.size()));
+        return key.GetHash(salt);
+    }
+};
+
 /**
  * Provides a forward and reverse index between MN vin's and integers.
  *
@@ -110,6 +137,8 @@ private:
     static const int MNB_RECOVERY_WAIT_SECONDS      = 60;
     static const int MNB_RECOVERY_RETRY_SECONDS     = 3 * 60 * 60;
 
+    static const int MAX_SCORE_CACHE_BLOCKS         = 32;
+
 
     // critical section to protect the inner data structures
     mutable CCriticalSection cs;
@@ -119,6 +148,13 @@ private:
 
     // map to hold all MNs
     std::vector<CMasternode> vMasternodes;
+    // positions in vMasternodes by collateral outpoint and by masternode key,
+    // must be kept in sync with the vector, see RebuildLookupMaps(); masternodes
+    // sharing a key are found at the first of their positions
+    typedef boost::unordered_map<COutPoint, int, CMasternodeOutPointHasher> outpoint_pos_m_t;
+    typedef boost::unordered_map<CPubKey, int, CMasternodePubKeyHasher> pubkey_pos_m_t;
+    outpoint_pos_m_t mapMasternodePosByOutPoint;
+    pubkey_pos_m_t mapMasternodePosByPubKey;
     // who's asked for the Masternode list and the last time
     std::map<CNetAddr, int64_t> mAskedUsForMasternodeList;
     // who we asked for the Masternode list and the last time
@@ -152,8 +188,23 @@ private:
 
     int64_t nLastWatchdogVoteTime;
 
+    // scores of all masternodes for a block hash, sorted from best to worst;
+    // pointers are into vMasternodes, so this must be cleared whenever the vector changes
+    typedef std::vector<std::pair<int64_t, CMasternode*> > score_vector_t;
+    std::map<uint256, score_vector_t> mapMasternodeScores;
+
     friend class CMasternodeSync;
 
+    /// Return cached scores for blockHash, calculating them if needed (requires cs)
+    const score_vector_t& GetMasternodeScores(const uint256& blockHash);
+
+    /// Recreate the outpoint and pubkey lookup maps from vMasternodes (requires cs)
+    void RebuildLookupMaps();
+    /// Make Find(pubKeyMasternode) return pmn after its key was (possibly) changed from pubKeyOld (requires cs)
+    void UpdatePubKeyLookup(const CPubKey& pubKeyOld, const CMasternode* pmn);
+    /// Point the lookup of pubKey at the first masternode in the vector that has it, if any
+    void RescanPubKeyLookup(const CPubKey& pubKey);
+
 public:
     // Keep track of all broadcasts I've seen
     std::map<uint256, std::pair<int64_t, CMasternodeBroadcast> > mapSeenMasternodeBroadcast;
@@ -172,6 +223,7 @@ public:
         LOCK(cs);
         std::string strVersion;
         if(ser_action.ForRead()) {
+            mapMasternodeScores.clear();
             READWRITE(strVersion);
         }
         else {
@@ -180,6 +232,9 @@ public:
         }
 
         READWRITE(vMasternodes);
+        if(ser_action.ForRead()) {
+            RebuildLookupMaps();
+        }
         READWRITE(mAskedUsForMasternodeList);
         READWRITE(mWeAskedForMasternodeList);
         READWRITE(mWeAskedForMasternodeListEntry);
@@ -292,7 +347,7 @@ public:
     /// Find a random entry
     CMasternode* FindRandomNotInVec(const std::vector<CTxIn> &vecToExclude, int nProtocolVersion = -1);
 
-    std::vector<CMasternode> GetFullMasternodeVector() { return vMasternodes; }
+    std::vector<CMasternode> GetFullMasternodeVector() { LOCK(cs); return vMasternodes; }
 
     std::vector<std::pair<int, CMasternode> > GetMasternodeRanks(int nBlockHeight = -1, int nMinProtocol=0);
     int GetMasternodeRank(const CTxIn &vin, int nBlockHeight, int nMinProtocol=0, bool fOnlyActive=true);
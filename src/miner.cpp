@@ -13,6 +13,7 @@
 #include "consensus/consensus.h"
 #include "consensus/merkle.h"
 #include "consensus/validation.h"
+#include "crypto/neoscrypt.h"
 #include "hash.h"
 #include "main.h"
 #include "net.h"
@@ -28,9 +29,10 @@
 #include "masternode-sync.h"
 #include "validationinterface.h"
 
+#include <algorithm>
+
 #include <boost/thread.hpp>
 #include <boost/tuple/tuple.hpp>
-#include <queue>
 
 using namespace std;
 
@@ -48,17 +50,6 @@ using namespace std;
 uint64_t nLastBlockTx = 0;
 uint64_t nLastBlockSize = 0;
 
-class ScoreCompare
-{
-public:
-    ScoreCompare() {}
-
-    bool operator()(const CTxMemPool::txiter a, const CTxMemPool::txiter b)
-    {
-        return CompareTxMemPoolEntryByScore()(*b,*a); // Convert to less than
-    }
-};
-
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev)
 {
     int64_t nOldTime = pblock->nTime;
@@ -74,207 +65,614 @@ int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParam
     return nNewTime - nOldTime;
 }
 
-CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const CScript& scriptPubKeyIn)
+CBlockTemplateLimits::CBlockTemplateLimits()
 {
-    // Create new block
-    auto_ptr<CBlockTemplate> pblocktemplate(new CBlockTemplate());
-    if(!pblocktemplate.get())
-        return NULL;
-    CBlock *pblock = &pblocktemplate->block; // pointer for convenience
-
-    // Create coinbase tx
-    CMutableTransaction txNew;
-    txNew.vin.resize(1);
-    txNew.vin[0].prevout.SetNull();
-    txNew.vout.resize(1);
-    txNew.vout[0].scriptPubKey = scriptPubKeyIn;
-
     // Largest block you're willing to create:
-    unsigned int nBlockMaxSize = GetArg("-blockmaxsize", DEFAULT_BLOCK_MAX_SIZE);
+    nBlockMaxSize = GetArg("-blockmaxsize", DEFAULT_BLOCK_MAX_SIZE);
     // Limit to between 1K and MAX_BLOCK_SIZE-1K for sanity:
     nBlockMaxSize = std::max((unsigned int)1000, std::min((unsigned int)(MAX_BLOCK_SIZE-1000), nBlockMaxSize));
 
     // How much of the block should be dedicated to high-priority transactions,
     // included regardless of the fees they pay
-    unsigned int nBlockPrioritySize = GetArg("-blockprioritysize", DEFAULT_BLOCK_PRIORITY_SIZE);
+    nBlockPrioritySize = GetArg("-blockprioritysize", DEFAULT_BLOCK_PRIORITY_SIZE);
     nBlockPrioritySize = std::min(nBlockMaxSize, nBlockPrioritySize);
 
     // Minimum block size you want to create; block will be filled with free transactions
     // until there are no more or the block reaches this size:
-    unsigned int nBlockMinSize = GetArg("-blockminsize", DEFAULT_BLOCK_MIN_SIZE);
+    nBlockMinSize = GetArg("-blockminsize", DEFAULT_BLOCK_MIN_SIZE);
     nBlockMinSize = std::min(nBlockMaxSize, nBlockMinSize);
+}
 
-    // Collect memory pool transactions into the block
-    CTxMemPool::setEntries inBlock;
-    CTxMemPool::setEntries waitSet;
+CBlockTemplateBuilder::CBlockTemplateBuilder(CTxMemPool& poolIn) : pool(poolIn)
+{
+    Clear();
+}
+
+void CBlockTemplateBuilder::Clear()
+{
+    hashPrevBlock.SetNull();
+    nHeight = 0;
+    nLockTimeCutoff = 0;
+    nPrioritisationsUpdated = 0;
+    nTransactionsRemoved = 0;
+    nSelectTime = 0;
+    fValid = false;
+    vSelected.clear();
+    vSelectedIters.clear();
+    nPriorityTxs = 0;
+    dPriorityCutoff = -1;
+    hashPriorityEnd.SetNull();
+    fPriorityFinished = false;
+    nKept = 0;
+}
 
+namespace {
+struct CompareFirst
+{
+    bool operator()(const std::pair<unsigned int, CTxMemPool::txiter>& a, const std::pair<unsigned int, CTxMemPool::txiter>& b) const
+    {
+        return a.first < b.first;
+    }
+};
+}
+
+unsigned int CBlockTemplateBuilder::FindKept(std::vector<CTxMemPool::txiter>& vKeptIters)
+{
+    unsigned int nKeep = vSelected.size();
+    uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+    std::string dummy;
+
+    // Transactions that entered the mempool since the last selection. Those
+    // of the same second may have been selected already, which is checked below.
+    std::vector<CTxMemPool::txiter> vNew;
+    std::vector<CTxMemPool::setEntries> vNewAncestors;
+    std::map<uint256, unsigned int> mapSelectedPos;
+    CTxMemPool::indexed_transaction_set::nth_index<2>::type::iterator it = pool.mapTx.get<2>().end();
+    while (it != pool.mapTx.get<2>().begin()) {
+        --it;
+        if (it->GetTime() < nSelectTime)
+            break;
+
+        if (limits.nBlockPrioritySize > 0) {
+            double dPriority = it->GetPriority(nHeight);
+            CAmount dummyDelta;
+            pool.ApplyDeltas(it->GetTx().GetHash(), dPriority, dummyDelta);
+            if (dPriority > dPriorityCutoff)
+                return 0;
+        }
+
+        vNew.push_back(pool.mapTx.project<0>(it));
+        vNewAncestors.push_back(CTxMemPool::setEntries());
+        pool.CalculateMemPoolAncestors(*it, vNewAncestors.back(), nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
+        mapSelectedPos.insert(std::make_pair(it->GetTx().GetHash(), nKeep));
+        BOOST_FOREACH(CTxMemPool::txiter ancestorIt, vNewAncestors.back())
+            mapSelectedPos.insert(std::make_pair(ancestorIt->GetTx().GetHash(), nKeep));
+    }
+    if (!mapSelectedPos.empty()) {
+        for (unsigned int i = 0; i < vSelected.size(); i++) {
+            std::map<uint256, unsigned int>::iterator posIt = mapSelectedPos.find(vSelected[i].hash);
+            if (posIt != mapSelectedPos.end())
+                posIt->second = i;
+        }
+    }
+
+    // A new transaction cuts the selection before the first package that had
+    // a lower feerate than the new transaction's package would have had at
+    // that point
+    for (unsigned int n = 0; n < vNew.size(); n++) {
+        if (mapSelectedPos[vNew[n]->GetTx().GetHash()] < vSelected.size())
+            continue;
+
+        std::vector<std::pair<unsigned int, CTxMemPool::txiter> > vAncestorPos;
+        BOOST_FOREACH(CTxMemPool::txiter ancestorIt, vNewAncestors[n]) {
+            unsigned int nPos = mapSelectedPos[ancestorIt->GetTx().GetHash()];
+            if (nPos < nKeep)
+                vAncestorPos.push_back(std::make_pair(nPos, ancestorIt));
+        }
+        std::sort(vAncestorPos.begin(), vAncestorPos.end(), CompareFirst());
+
+        CAmount nPackageFees = vNew[n]->GetModFeesWithAncestors();
+        uint64_t nPackageSize = vNew[n]->GetSizeWithAncestors();
+        unsigned int nNextAncestor = 0;
+        for (unsigned int i = nPriorityTxs; i < nKeep; i++) {
+            // Ancestors selected before this step were already in the block
+            for (; nNextAncestor < vAncestorPos.size() && vAncestorPos[nNextAncestor].first < i; nNextAncestor++) {
+                nPackageFees -= vAncestorPos[nNextAncestor].second->GetModifiedFee();
+                nPackageSize -= vAncestorPos[nNextAncestor].second->GetTxSize();
+            }
+            const CSelectedTx& step = vSelected[i];
+            if (step.nPackageStart != i)
+                continue;
+            if ((double)nPackageFees * step.nPackageSize > (double)step.nPackageFees * nPackageSize) {
+                nKeep = i;
+                break;
+            }
+        }
+    }
+
+    if (pool.GetTransactionsRemoved() == nTransactionsRemoved) {
+        // Without removals, the mempool entries of the selection are still valid
+        vKeptIters.assign(vSelectedIters.begin(), vSelectedIters.begin() + nKeep);
+    } else {
+        // Transactions that left the mempool cut the selection before their package.
+        // Other transactions leave along with their descendants (only a new tip
+        // leaves descendants behind), so their removal changes no package.
+        vKeptIters.clear();
+        for (unsigned int i = 0; i < nKeep; i++) {
+            CTxMemPool::txiter mi = pool.mapTx.find(vSelected[i].hash);
+            if (mi == pool.mapTx.end()) {
+                nKeep = vSelected[i].nPackageStart;
+                break;
+            }
+            vKeptIters.push_back(mi);
+        }
+        vKeptIters.resize(nKeep);
+    }
+
+    if (nKeep < nPriorityTxs)
+        return 0;
+    if (!hashPriorityEnd.IsNull() && !pool.mapTx.count(hashPriorityEnd))
+        return 0;
+    return nKeep;
+}
+
+void CBlockTemplateBuilder::AddToBlock(CTxMemPool::txiter iter, bool fPriority, unsigned int nPackageStart, CAmount nPackageFees, uint64_t nPackageSize)
+{
+    CSelectedTx selected;
+    selected.hash = iter->GetTx().GetHash();
+    selected.nPackageStart = nPackageStart;
+    selected.fPriority = fPriority;
+    selected.nPackageFees = nPackageFees;
+    selected.nPackageSize = nPackageSize;
+    vSelected.push_back(selected);
+    vSelectedIters.push_back(iter);
+    if (fPriority)
+        nPriorityTxs++;
+
+    nBlockSize += iter->GetTxSize();
+    nBlockSigOps += iter->GetSigOpCount();
+    nFees += iter->GetFee();
+    inBlock.insert(iter);
+
+    if (fPrintPriority) {
+        double dPriority = iter->GetPriority(nHeight);
+        CAmount dummy;
+        pool.ApplyDeltas(iter->GetTx().GetHash(), dPriority, dummy);
+        LogPrintf("priority %.1f fee %s txid %s\n",
+                  dPriority, CFeeRate(iter->GetModifiedFee(), iter->GetTxSize()).ToString(), iter->GetTx().GetHash().ToString());
+    }
+}
+
+bool CBlockTemplateBuilder::TestForBlock(CTxMemPool::txiter iter)
+{
+    unsigned int nTxSize = iter->GetTxSize();
+    if (nBlockSize + nTxSize >= limits.nBlockMaxSize) {
+        if (nBlockSize > limits.nBlockMaxSize - 100 || lastFewTxs > 50) {
+            fBlockFinished = true;
+            return false;
+        }
+        // Once we're within 1000 bytes of a full block, only look at 50 more txs
+        // to try to fill the remaining space.
+        if (nBlockSize > limits.nBlockMaxSize - 1000) {
+            lastFewTxs++;
+        }
+        return false;
+    }
+
+    if (!IsFinalTx(iter->GetTx(), nHeight, nLockTimeCutoff))
+        return false;
+
+    unsigned int nTxSigOps = iter->GetSigOpCount();
+    if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS) {
+        if (nBlockSigOps > MAX_BLOCK_SIGOPS - 2) {
+            fBlockFinished = true;
+        }
+        return false;
+    }
+    return true;
+}
+
+bool CBlockTemplateBuilder::IsStillDependent(CTxMemPool::txiter iter)
+{
+    BOOST_FOREACH(CTxMemPool::txiter parent, pool.GetMemPoolParents(iter))
+    {
+        if (!inBlock.count(parent)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void CBlockTemplateBuilder::AddPriorityTxs()
+{
     // This vector will be sorted into a priority queue:
-    vector<TxCoinAgePriority> vecPriority;
+    std::vector<TxCoinAgePriority> vecPriority;
     TxCoinAgePriorityCompare pricomparer;
     std::map<CTxMemPool::txiter, double, CTxMemPool::CompareIteratorByHash> waitPriMap;
     typedef std::map<CTxMemPool::txiter, double, CTxMemPool::CompareIteratorByHash>::iterator waitPriIter;
     double actualPriority = -1;
 
-    std::priority_queue<CTxMemPool::txiter, std::vector<CTxMemPool::txiter>, ScoreCompare> clearedTxs;
-    bool fPrintPriority = GetBoolArg("-printpriority", DEFAULT_PRINTPRIORITY);
-    uint64_t nBlockSize = 1000;
-    uint64_t nBlockTx = 0;
-    unsigned int nBlockSigOps = 100;
-    int lastFewTxs = 0;
-    CAmount nFees = 0;
-
+    vecPriority.reserve(pool.mapTx.size());
+    for (CTxMemPool::indexed_transaction_set::iterator mi = pool.mapTx.begin();
+         mi != pool.mapTx.end(); ++mi)
     {
-        LOCK2(cs_main, mempool.cs);
-        CBlockIndex* pindexPrev = chainActive.Tip();
-        const int nHeight = pindexPrev->nHeight + 1;
-        pblock->nTime = GetAdjustedTime();
-        const int64_t nMedianTimePast = pindexPrev->GetMedianTimePast();
-
-        // Add our coinbase tx as first transaction
-        pblock->vtx.push_back(txNew);
-        pblocktemplate->vTxFees.push_back(-1); // updated at end
-        pblocktemplate->vTxSigOps.push_back(-1); // updated at end
-        pblock->nVersion = ComputeBlockVersion(pindexPrev, chainparams.GetConsensus());
-        // -regtest only: allow overriding block.nVersion with
-        // -blockversion=N to test forking scenarios
-        if (chainparams.MineBlocksOnDemand())
-            pblock->nVersion = GetArg("-blockversion", pblock->nVersion);
+        double dPriority = mi->GetPriority(nHeight);
+        CAmount dummy;
+        pool.ApplyDeltas(mi->GetTx().GetHash(), dPriority, dummy);
+        vecPriority.push_back(TxCoinAgePriority(dPriority, mi));
+    }
+    std::make_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
+
+    CTxMemPool::txiter iter;
+    while (!vecPriority.empty()) {
+        iter = vecPriority.front().second;
+        actualPriority = vecPriority.front().first;
+        std::pop_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
+        vecPriority.pop_back();
+
+        // Wait until its parents are in the block
+        if (IsStillDependent(iter)) {
+            waitPriMap.insert(std::make_pair(iter, actualPriority));
+            continue;
+        }
 
-        int64_t nLockTimeCutoff = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST)
-                                ? nMedianTimePast
-                                : pblock->GetBlockTime();
+        // The priority part ends at the first transaction that does not fit
+        // or is not allowed for free, but that one is still tried regardless
+        // of its fee
+        bool fLast = nBlockSize + iter->GetTxSize() >= limits.nBlockPrioritySize || !AllowFree(actualPriority);
+        if (fLast) {
+            dPriorityCutoff = actualPriority;
+            hashPriorityEnd = iter->GetTx().GetHash();
+        }
 
+        if (TestForBlock(iter)) {
+            AddToBlock(iter, true, vSelected.size(), iter->GetModifiedFee(), iter->GetTxSize());
 
-        bool fPriorityBlock = nBlockPrioritySize > 0;
-        if (fPriorityBlock) {
-            vecPriority.reserve(mempool.mapTx.size());
-            for (CTxMemPool::indexed_transaction_set::iterator mi = mempool.mapTx.begin();
-                 mi != mempool.mapTx.end(); ++mi)
+            // Add transactions that depend on this one to the priority queue
+            BOOST_FOREACH(CTxMemPool::txiter child, pool.GetMemPoolChildren(iter))
             {
-                double dPriority = mi->GetPriority(nHeight);
-                CAmount dummy;
-                mempool.ApplyDeltas(mi->GetTx().GetHash(), dPriority, dummy);
-                vecPriority.push_back(TxCoinAgePriority(dPriority, mi));
+                waitPriIter wpiter = waitPriMap.find(child);
+                if (wpiter != waitPriMap.end()) {
+                    vecPriority.push_back(TxCoinAgePriority(wpiter->second, child));
+                    std::push_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
+                    waitPriMap.erase(wpiter);
+                }
             }
-            std::make_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
         }
 
-        CTxMemPool::indexed_transaction_set::nth_index<3>::type::iterator mi = mempool.mapTx.get<3>().begin();
-        CTxMemPool::txiter iter;
-
-        while (mi != mempool.mapTx.get<3>().end() || !clearedTxs.empty())
-        {
-            bool priorityTx = false;
-            if (fPriorityBlock && !vecPriority.empty()) { // add a tx from priority queue to fill the blockprioritysize
-                priorityTx = true;
-                iter = vecPriority.front().second;
-                actualPriority = vecPriority.front().first;
-                std::pop_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
-                vecPriority.pop_back();
-            }
-            else if (clearedTxs.empty()) { // add tx with next highest score
-                iter = mempool.mapTx.project<0>(mi);
-                mi++;
-            }
-            else {  // try to add a previously postponed child tx
-                iter = clearedTxs.top();
-                clearedTxs.pop();
+        if (fBlockFinished) {
+            fPriorityFinished = true;
+            return;
+        }
+        if (fLast)
+            return;
+    }
+    // Every transaction was considered
+    dPriorityCutoff = -1;
+}
+
+void CBlockTemplateBuilder::UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded,
+        indexed_modified_transaction_set& mapModifiedTx)
+{
+    BOOST_FOREACH(const CTxMemPool::txiter it, alreadyAdded) {
+        CTxMemPool::setEntries descendants;
+        pool.CalculateDescendants(it, descendants);
+        // Insert all descendants (not yet in block) into the modified set
+        BOOST_FOREACH(CTxMemPool::txiter desc, descendants) {
+            if (alreadyAdded.count(desc))
+                continue;
+            modtxiter mit = mapModifiedTx.find(desc);
+            if (mit == mapModifiedTx.end()) {
+                CTxMemPoolModifiedEntry modEntry(desc);
+                modEntry.nSizeWithAncestors -= it->GetTxSize();
+                modEntry.nModFeesWithAncestors -= it->GetModifiedFee();
+                modEntry.nSigOpCountWithAncestors -= it->GetSigOpCount();
+                mapModifiedTx.insert(modEntry);
+            } else {
+                mapModifiedTx.modify(mit, update_for_parent_inclusion(it));
             }
+        }
+    }
+}
 
-            if (inBlock.count(iter))
-                continue; // could have been added to the priorityBlock
+// Skip entries in mapTx that are already in a block or are present
+// in mapModifiedTx (which implies that the mapTx ancestor state is
+// stale due to ancestor inclusion in the block)
+// Also skip transactions that we've already failed to add. This can happen if
+// we consider a transaction in mapModifiedTx and it fails: we can then
+// potentially consider it again while walking mapTx.  It's currently
+// guaranteed to fail again, but as a belt-and-suspenders check we put it in
+// failedTx and avoid re-evaluation, since the re-evaluation would be using
+// cached size/sigops/fee values that are not actually correct.
+bool CBlockTemplateBuilder::SkipMapTxEntry(CTxMemPool::txiter it, indexed_modified_transaction_set& mapModifiedTx, CTxMemPool::setEntries& failedTx)
+{
+    assert(it != pool.mapTx.end());
+    if (mapModifiedTx.count(it) || inBlock.count(it) || failedTx.count(it))
+        return true;
+    return false;
+}
 
-            const CTransaction& tx = iter->GetTx();
+bool CBlockTemplateBuilder::TestPackage(uint64_t packageSize, unsigned int packageSigOps)
+{
+    if (nBlockSize + packageSize >= limits.nBlockMaxSize)
+        return false;
+    if (nBlockSigOps + packageSigOps >= MAX_BLOCK_SIGOPS)
+        return false;
+    return true;
+}
 
-            bool fOrphan = false;
-            BOOST_FOREACH(CTxMemPool::txiter parent, mempool.GetMemPoolParents(iter))
-            {
-                if (!inBlock.count(parent)) {
-                    fOrphan = true;
-                    break;
-                }
-            }
-            if (fOrphan) {
-                if (priorityTx)
-                    waitPriMap.insert(std::make_pair(iter,actualPriority));
-                else
-                    waitSet.insert(iter);
-                continue;
+bool CBlockTemplateBuilder::TestPackageFinality(const CTxMemPool::setEntries& package)
+{
+    BOOST_FOREACH(const CTxMemPool::txiter it, package) {
+        if (!IsFinalTx(it->GetTx(), nHeight, nLockTimeCutoff))
+            return false;
+    }
+    return true;
+}
+
+void CBlockTemplateBuilder::SortForBlock(const CTxMemPool::setEntries& package, CTxMemPool::txiter entry, std::vector<CTxMemPool::txiter>& sortedEntries)
+{
+    // Sort package by ancestor count
+    // If a transaction A depends on transaction B, then A's ancestor count
+    // must be greater than B's.  So this is sufficient to validly order the
+    // transactions for block inclusion.
+    sortedEntries.clear();
+    sortedEntries.insert(sortedEntries.begin(), package.begin(), package.end());
+    std::sort(sortedEntries.begin(), sortedEntries.end(), CompareTxIterByAncestorCount());
+}
+
+// This transaction selection algorithm orders the mempool based
+// on feerate of a transaction including all unconfirmed ancestors.
+// Since we don't remove transactions from the mempool as we select them
+// for block inclusion, we need an alternate method of updating the feerate
+// of a transaction with its not-yet-selected ancestors as we go.
+// This is accomplished by walking the in-mempool descendants of selected
+// transactions and storing a temporary modified state in mapModifiedTx.
+// Each time through the loop, we compare the best transaction in
+// mapModifiedTx with the next transaction in the mempool to decide what
+// transaction package to work on next.
+void CBlockTemplateBuilder::AddPackageTxs()
+{
+    // mapModifiedTx will store sorted packages after they are modified
+    // because some of their txs are already in the block
+    indexed_modified_transaction_set mapModifiedTx;
+    // Keep track of entries that failed inclusion, to avoid duplicate work
+    CTxMemPool::setEntries failedTx;
+
+    // Start by adding all descendants of previously added txs to mapModifiedTx
+    // and modifying them for their already included ancestors
+    UpdatePackagesForAdded(inBlock, mapModifiedTx);
+
+    CTxMemPool::indexed_transaction_set::nth_index<4>::type::iterator mi = pool.mapTx.get<4>().begin();
+    CTxMemPool::txiter iter;
+
+    // Limit the number of attempts to add transactions to the block when it is
+    // close to full; this is just a simple heuristic to finish quickly if the
+    // mempool has a lot of entries.
+    const int64_t MAX_CONSECUTIVE_FAILURES = 1000;
+    int64_t nConsecutiveFailed = 0;
+
+    while (mi != pool.mapTx.get<4>().end() || !mapModifiedTx.empty())
+    {
+        // First try to find a new transaction in mapTx to evaluate.
+        if (mi != pool.mapTx.get<4>().end() &&
+                SkipMapTxEntry(pool.mapTx.project<0>(mi), mapModifiedTx, failedTx)) {
+            ++mi;
+            continue;
+        }
+
+        // Now that mi is not stale, determine which transaction to evaluate:
+        // the next entry from mapTx, or the best from mapModifiedTx?
+        bool fUsingModified = false;
+
+        modtxscoreiter modit = mapModifiedTx.get<1>().begin();
+        if (mi == pool.mapTx.get<4>().end()) {
+            // We're out of entries in mapTx; use the entry from mapModifiedTx
+            iter = modit->iter;
+            fUsingModified = true;
+        } else {
+            // Try to compare the mapTx entry to the mapModifiedTx entry
+            iter = pool.mapTx.project<0>(mi);
+            if (modit != mapModifiedTx.get<1>().end() &&
+                    CompareModifiedEntry()(*modit, CTxMemPoolModifiedEntry(iter))) {
+                // The best entry in mapModifiedTx has higher score
+                // than the one from mapTx.
+                // Switch which transaction (package) to consider
+                iter = modit->iter;
+                fUsingModified = true;
+            } else {
+                // Either no entry in mapModifiedTx, or it's worse than mapTx.
+                // Increment mi for the next loop iteration.
+                ++mi;
             }
+        }
+
+        // We skip mapTx entries that are inBlock, and mapModifiedTx shouldn't
+        // contain anything that is inBlock.
+        assert(!inBlock.count(iter));
+
+        uint64_t packageSize = iter->GetSizeWithAncestors();
+        CAmount packageFees = iter->GetModFeesWithAncestors();
+        unsigned int packageSigOps = iter->GetSigOpCountWithAncestors();
+        if (fUsingModified) {
+            packageSize = modit->nSizeWithAncestors;
+            packageFees = modit->nModFeesWithAncestors;
+            packageSigOps = modit->nSigOpCountWithAncestors;
+        }
 
-            unsigned int nTxSize = iter->GetTxSize();
-            if (fPriorityBlock &&
-                (nBlockSize + nTxSize >= nBlockPrioritySize || !AllowFree(actualPriority))) {
-                fPriorityBlock = false;
-                waitPriMap.clear();
+        if (packageFees < ::minRelayTxFee.GetFee(packageSize) && nBlockSize >= limits.nBlockMinSize) {
+            // Everything else we might consider has a lower fee rate
+            return;
+        }
+
+        if (!TestPackage(packageSize, packageSigOps)) {
+            if (fUsingModified) {
+                // Since we always look at the best entry in mapModifiedTx,
+                // we must erase failed entries so that we can consider the
+                // next best entry on the next loop iteration
+                mapModifiedTx.get<1>().erase(modit);
+                failedTx.insert(iter);
             }
-            if (!priorityTx &&
-                (iter->GetModifiedFee() < ::minRelayTxFee.GetFee(nTxSize) && nBlockSize >= nBlockMinSize)) {
+
+            ++nConsecutiveFailed;
+
+            if (nConsecutiveFailed > MAX_CONSECUTIVE_FAILURES && nBlockSize > limits.nBlockMaxSize - 1000) {
+                // Give up if we're close to full and haven't succeeded in a while
                 break;
             }
-            if (nBlockSize + nTxSize >= nBlockMaxSize) {
-                if (nBlockSize >  nBlockMaxSize - 100 || lastFewTxs > 50) {
-                    break;
-                }
-                // Once we're within 1000 bytes of a full block, only look at 50 more txs
-                // to try to fill the remaining space.
-                if (nBlockSize > nBlockMaxSize - 1000) {
-                    lastFewTxs++;
-                }
-                continue;
-            }
+            continue;
+        }
 
-            if (!IsFinalTx(tx, nHeight, nLockTimeCutoff))
-                continue;
+        CTxMemPool::setEntries ancestors;
+        uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+        std::string dummy;
+        pool.CalculateMemPoolAncestors(*iter, ancestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
+
+        // Remove the ancestors that are already in the block
+        for (CTxMemPool::setEntries::iterator ait = ancestors.begin(); ait != ancestors.end(); ) {
+            if (inBlock.count(*ait))
+                ancestors.erase(ait++);
+            else
+                ++ait;
+        }
+        ancestors.insert(iter);
 
-            unsigned int nTxSigOps = iter->GetSigOpCount();
-            if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS) {
-                if (nBlockSigOps > MAX_BLOCK_SIGOPS - 2) {
-                    break;
-                }
-                continue;
+        // Test if all tx's are Final
+        if (!TestPackageFinality(ancestors)) {
+            if (fUsingModified) {
+                mapModifiedTx.get<1>().erase(modit);
+                failedTx.insert(iter);
             }
+            continue;
+        }
 
-            CAmount nTxFees = iter->GetFee();
-            // Added
-            pblock->vtx.push_back(tx);
-            pblocktemplate->vTxFees.push_back(nTxFees);
-            pblocktemplate->vTxSigOps.push_back(nTxSigOps);
-            nBlockSize += nTxSize;
-            ++nBlockTx;
-            nBlockSigOps += nTxSigOps;
-            nFees += nTxFees;
-
-            if (fPrintPriority)
-            {
-                double dPriority = iter->GetPriority(nHeight);
-                CAmount dummy;
-                mempool.ApplyDeltas(tx.GetHash(), dPriority, dummy);
-                LogPrintf("priority %.1f fee %s txid %s\n",
-                          dPriority , CFeeRate(iter->GetModifiedFee(), nTxSize).ToString(), tx.GetHash().ToString());
-            }
+        // This transaction will make it in; reset the failed counter.
+        nConsecutiveFailed = 0;
 
-            inBlock.insert(iter);
+        // Package can be added. Sort the entries in a valid order.
+        std::vector<CTxMemPool::txiter> sortedEntries;
+        SortForBlock(ancestors, iter, sortedEntries);
 
-            // Add transactions that depend on this one to the priority queue
-            BOOST_FOREACH(CTxMemPool::txiter child, mempool.GetMemPoolChildren(iter))
-            {
-                if (fPriorityBlock) {
-                    waitPriIter wpiter = waitPriMap.find(child);
-                    if (wpiter != waitPriMap.end()) {
-                        vecPriority.push_back(TxCoinAgePriority(wpiter->second,child));
-                        std::push_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
-                        waitPriMap.erase(wpiter);
-                    }
-                }
-                else {
-                    if (waitSet.count(child)) {
-                        clearedTxs.push(child);
-                        waitSet.erase(child);
-                    }
-                }
-            }
+        unsigned int nPackageStart = vSelected.size();
+        for (size_t i = 0; i < sortedEntries.size(); ++i) {
+            AddToBlock(sortedEntries[i], false, nPackageStart, packageFees, packageSize);
+            // Erase from the modified set, if present
+            mapModifiedTx.erase(sortedEntries[i]);
+        }
+
+        // Update transactions that depend on each of these
+        UpdatePackagesForAdded(ancestors, mapModifiedTx);
+    }
+}
+
+unsigned int CBlockTemplateBuilder::Select(const uint256& hashPrevBlockIn, int nHeightIn, int64_t nLockTimeCutoffIn, const CBlockTemplateLimits& limitsIn)
+{
+    AssertLockHeld(pool.cs);
+    int64_t nNow = GetTime();
+    unsigned int nPrioritisationsUpdatedIn = pool.GetPrioritisationsUpdated();
+
+    unsigned int nKeep = 0;
+    std::vector<CTxMemPool::txiter> vKeptIters;
+    if (fValid && hashPrevBlockIn == hashPrevBlock && nHeightIn == nHeight && nLockTimeCutoffIn == nLockTimeCutoff &&
+        limitsIn == limits && nPrioritisationsUpdatedIn == nPrioritisationsUpdated && nNow >= nSelectTime) {
+        nKeep = FindKept(vKeptIters);
+    }
+
+    hashPrevBlock = hashPrevBlockIn;
+    nHeight = nHeightIn;
+    nLockTimeCutoff = nLockTimeCutoffIn;
+    limits = limitsIn;
+    nPrioritisationsUpdated = nPrioritisationsUpdatedIn;
+    nTransactionsRemoved = pool.GetTransactionsRemoved();
+    nSelectTime = nNow;
+    fValid = false;
+    fPrintPriority = GetBoolArg("-printpriority", DEFAULT_PRINTPRIORITY);
+
+    inBlock.clear();
+    nBlockSize = 1000;
+    nBlockSigOps = 100;
+    nFees = 0;
+    lastFewTxs = 0;
+    fBlockFinished = false;
+
+    // Replay the part of the last selection that stays the same
+    std::vector<CSelectedTx> vKept(vSelected.begin(), vSelected.begin() + nKeep);
+    vSelected.clear();
+    vSelectedIters.clear();
+    unsigned int nPriorityKept = nKeep > 0 ? nPriorityTxs : 0;
+    if (nKeep == 0) {
+        dPriorityCutoff = -1;
+        hashPriorityEnd.SetNull();
+        fPriorityFinished = false;
+    }
+    nPriorityTxs = 0;
+    for (unsigned int i = 0; i < vKept.size(); i++) {
+        const CSelectedTx& kept = vKept[i];
+        AddToBlock(vKeptIters[i], kept.fPriority, kept.nPackageStart, kept.nPackageFees, kept.nPackageSize);
+    }
+    assert(nPriorityTxs == nPriorityKept);
+    nKept = nKeep;
+
+    if (nKeep == 0 && limits.nBlockPrioritySize > 0)
+        AddPriorityTxs();
+    if (!fPriorityFinished)
+        AddPackageTxs();
+
+    return nKept;
+}
+
+CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const CScript& scriptPubKeyIn)
+{
+    // Create new block
+    auto_ptr<CBlockTemplate> pblocktemplate(new CBlockTemplate());
+    if(!pblocktemplate.get())
+        return NULL;
+    CBlock *pblock = &pblocktemplate->block; // pointer for convenience
+
+    // Create coinbase tx
+    CMutableTransaction txNew;
+    txNew.vin.resize(1);
+    txNew.vin[0].prevout.SetNull();
+    txNew.vout.resize(1);
+    txNew.vout[0].scriptPubKey = scriptPubKeyIn;
+
+    CBlockTemplateLimits limits;
+
+    {
+        LOCK2(cs_main, mempool.cs);
+        // The transactions selected for the last template, guarded by cs_main
+        static CBlockTemplateBuilder builder(mempool);
+
+        CBlockIndex* pindexPrev = chainActive.Tip();
+        const int nHeight = pindexPrev->nHeight + 1;
+        pblock->nTime = GetAdjustedTime();
+        const int64_t nMedianTimePast = pindexPrev->GetMedianTimePast();
+
+        // Add our coinbase tx as first transaction
+        pblock->vtx.push_back(txNew);
+        pblocktemplate->vTxFees.push_back(-1); // updated at end
+        pblocktemplate->vTxSigOps.push_back(-1); // updated at end
+        pblock->nVersion = ComputeBlockVersion(pindexPrev, chainparams.GetConsensus());
+        // -regtest only: allow overriding block.nVersion with
+        // -blockversion=N to test forking scenarios
+        if (chainparams.MineBlocksOnDemand())
+            pblock->nVersion = GetArg("-blockversion", pblock->nVersion);
+
+        int64_t nLockTimeCutoff = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST)
+                                ? nMedianTimePast
+                                : pblock->GetBlockTime();
+
+        int64_t nTimeStart = GetTimeMicros();
+        unsigned int nKept = builder.Select(pindexPrev->GetBlockHash(), nHeight, nLockTimeCutoff, limits);
+        int64_t nTimeSelect = GetTimeMicros();
+
+        const std::vector<CTxMemPool::txiter>& vSelected = builder.GetSelected();
+        BOOST_FOREACH(CTxMemPool::txiter iter, vSelected) {
+            pblock->vtx.push_back(iter->GetTx());
+            pblocktemplate->vTxFees.push_back(iter->GetFee());
+            pblocktemplate->vTxSigOps.push_back(iter->GetSigOpCount());
         }
+        CAmount nFees = builder.GetFees();
 
         // NOTE: unlike in bitcoin, we need to pass PREVIOUS block height here
         CAmount blockReward = nFees + GetBlockSubsidy(pindexPrev->nBits, pindexPrev->nHeight, Params().GetConsensus());
@@ -289,9 +687,9 @@ CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const CScript& s
         // LogPrintf("CreateNewBlock -- nBlockHeight %d blockReward %lld txoutMasternode %s txNew %s",
         //             nHeight, blockReward, pblock->txoutMasternode.ToString(), txNew.ToString());
 
-        nLastBlockTx = nBlockTx;
-        nLastBlockSize = nBlockSize;
-        LogPrintf("CreateNewBlock(): total size %u txs: %u fees: %ld sigops %d\n", nBlockSize, nBlockTx, nFees, nBlockSigOps);
+        nLastBlockTx = vSelected.size();
+        nLastBlockSize = builder.GetBlockSize();
+        LogPrintf("CreateNewBlock(): total size %u txs: %u fees: %ld sigops %d\n", builder.GetBlockSize(), vSelected.size(), nFees, builder.GetBlockSigOps());
 
         // Update block coinbase
         pblock->vtx[0] = txNew;
@@ -306,8 +704,14 @@ CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const CScript& s
 
         CValidationState state;
         if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false)) {
+            builder.Clear();
             throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", __func__, FormatStateMessage(state)));
         }
+        builder.SetValid();
+        int64_t nTimeValidity = GetTimeMicros();
+
+        LogPrint("bench", "CreateNewBlock(): kept %u of %u txs, selection %.2fms, validity %.2fms\n",
+                 nKept, vSelected.size(), 0.001 * (nTimeSelect - nTimeStart), 0.001 * (nTimeValidity - nTimeSelect));
     }
 
     return pblocktemplate.release();
@@ -337,39 +741,41 @@ void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned
 // Internal miner
 //
 
-// ***TODO*** ScanHash is not yet used in DigitSlate
-//
-// ScanHash scans nonces looking for a hash with at least some zero bits.
-// The nonce is usually preserved between calls, but periodically or if the
-// nonce is 0xffff0000 or above, the block is rebuilt and nNonce starts over at
-// zero.
-//
-//bool static ScanHash(const CBlockHeader *pblock, uint32_t& nNonce, uint256 *phash)
-//{
-//    // Write the first 76 bytes of the block header to a double-SHA256 state.
-//    CHash256 hasher;
-//    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-//    ss << *pblock;
-//    assert(ss.size() == 80);
-//    hasher.Write((unsigned char*)&ss[0], 76);
-
-//    while (true) {
-//        nNonce++;
-
-//        // Write the last 4 bytes of the block header (the nonce) to a copy of
-//        // the double-SHA256 state, and compute the result.
-//        CHash256(hasher).Write((unsigned char*)&nNonce, 4).Finalize((unsigned char*)phash);
-
-//        // Return the nonce if the hash has at least some zero bits,
-//        // caller will check if it has enough to reach the target
-//        if (((uint16_t*)phash)[15] == 0)
-//            return true;
-
-//        // If nothing found after trying for a while, return -1
-//        if ((nNonce & 0xfff) == 0)
-//            return false;
-//    }
-//}
+CMinerScratchpad::CMinerScratchpad() : vch(NEOSCRYPT_4WAY_SCRATCHPAD_SIZE + 63)
+{
+}
+
+unsigned char* CMinerScratchpad::Get()
+{
+    return (unsigned char*)(((size_t)&vch[0] + 63) & ~(size_t)63);
+}
+
+bool ScanHash(CBlockHeader* pblock, uint64_t& nNonce, uint64_t nNonceEnd, const arith_uint256& hashTarget, CMinerScratchpad& scratchpad, uint256& hash, uint64_t& nHashesDone)
+{
+    // CBlockHeader::GetHash() hashes the 80 bytes starting at nVersion; copy them
+    // once and let the 4-way kernel vary the nonce in the last four bytes.
+    unsigned char header[80];
+    unsigned char hashes[4 * 32];
+    memcpy(header, &pblock->nVersion, 80);
+
+    // Return after 64 rounds of four nonces so the caller can check whether the work is stale
+    for (unsigned int nRound = 0; nRound < 64 && nNonce < nNonceEnd; nRound++) {
+        uint32_t nNonce32 = (uint32_t)nNonce;
+        memcpy(header + 76, &nNonce32, 4);
+        neoscrypt_4way_nonces(header, hashes, scratchpad.Get());
+        for (unsigned int k = 0; k < 4 && nNonce + k < nNonceEnd; k++) {
+            nHashesDone++;
+            memcpy(hash.begin(), hashes + 32 * k, 32);
+            if (UintToArith256(hash) <= hashTarget) {
+                pblock->nNonce = (uint32_t)(nNonce + k);
+                nNonce += k + 1;
+                return true;
+            }
+        }
+        nNonce += 4;
+    }
+    return false;
+}
 
 static bool ProcessBlockFound(const CBlock* pblock, const CChainParams& chainparams)
 {
@@ -394,25 +800,125 @@ static bool ProcessBlockFound(const CBlock* pblock, const CChainParams& chainpar
     return true;
 }
 
-// ***TODO*** that part changed in bitcoin, we are using a mix with old one here for now
-void static BitcoinMiner(const CChainParams& chainparams)
+// Block template shared by the internal miner threads. Every thread scans its
+// own slice of the nonce space over a copy of it, so no header is hashed twice.
+// Whichever thread notices that the template went stale rebuilds it.
+static CCriticalSection cs_minerwork;
+static boost::shared_ptr<CBlockTemplate> pminerTemplate;
+static boost::shared_ptr<CReserveScript> pminerCoinbaseScript;
+static const CBlockIndex* pminerIndexPrev = NULL;
+static unsigned int nMinerTransactionsUpdated = 0;
+static int64_t nMinerTemplateTime = 0;
+static uint64_t nMinerTemplateId = 0;
+static unsigned int nMinerExtraNonce = 0;
+
+// Hash rate meter of the internal miner
+static CCriticalSection cs_minerhps;
+static int64_t nHPSTimerStart = 0;
+static uint64_t nHPSHashCounter = 0;
+static double dHashesPerSec = 0;
+
+static void UpdateHashMeter(uint64_t nHashesDone)
 {
-    LogPrintf("DigitSlateMiner -- started\n");
-    SetThreadPriority(THREAD_PRIORITY_LOWEST);
-    RenameThread("digitslate-miner");
+    LOCK(cs_minerhps);
+    int64_t nNow = GetTimeMillis();
+    if (nHPSTimerStart == 0) {
+        nHPSTimerStart = nNow;
+        nHPSHashCounter = 0;
+    }
+    nHPSHashCounter += nHashesDone;
+    if (nNow - nHPSTimerStart > 4000) {
+        dHashesPerSec = 1000.0 * nHPSHashCounter / (nNow - nHPSTimerStart);
+        nHPSTimerStart = nNow;
+        nHPSHashCounter = 0;
+    }
+}
 
-    unsigned int nExtraNonce = 0;
+double GetMinerHashesPerSec()
+{
+    LOCK(cs_minerhps);
+    return dHashesPerSec;
+}
 
-    boost::shared_ptr<CReserveScript> coinbaseScript;
-    GetMainSignals().ScriptForMining(coinbaseScript);
+/**
+ * Copy the current template into block, rebuilding it first if the tip moved,
+ * the mempool changed more than a minute ago, or fRenew is set by a thread that
+ * exhausted its nonce slice of template nId.
+ */
+static bool GetMinerWork(const CChainParams& chainparams, bool fRenew, CBlock& block, const CBlockIndex*& pindexPrev, uint64_t& nId)
+{
+    LOCK(cs_minerwork);
 
-    try {
+    if (!pminerCoinbaseScript) {
+        GetMainSignals().ScriptForMining(pminerCoinbaseScript);
         // Throw an error if no script was provided.  This can happen
         // due to some internal error but also if the keypool is empty.
         // In the latter case, already the pointer is NULL.
-        if (!coinbaseScript || coinbaseScript->reserveScript.empty())
+        if (!pminerCoinbaseScript || pminerCoinbaseScript->reserveScript.empty()) {
+            pminerCoinbaseScript.reset();
             throw std::runtime_error("No coinbase script available (mining requires a wallet)");
+        }
+    }
+
+    CBlockIndex* pindexTip = chainActive.Tip();
+    if (!pindexTip)
+        return false;
+
+    if (!pminerTemplate || pminerIndexPrev != pindexTip || (fRenew && nId == nMinerTemplateId) ||
+        (mempool.GetTransactionsUpdated() != nMinerTransactionsUpdated && GetTime() - nMinerTemplateTime > 60)) {
+        nMinerTransactionsUpdated = mempool.GetTransactionsUpdated();
+        pminerTemplate.reset(CreateNewBlock(chainparams, pminerCoinbaseScript->reserveScript));
+        if (!pminerTemplate)
+            return false;
+        IncrementExtraNonce(&pminerTemplate->block, pindexTip, nMinerExtraNonce);
+        pminerIndexPrev = pindexTip;
+        nMinerTemplateTime = GetTime();
+        nMinerTemplateId++;
+
+        LogPrintf("DigitSlateMiner -- Running miner with %u transactions in block (%u bytes)\n", pminerTemplate->block.vtx.size(),
+            ::GetSerializeSize(pminerTemplate->block, SER_NETWORK, PROTOCOL_VERSION));
+    }
+
+    block = pminerTemplate->block;
+    pindexPrev = pminerIndexPrev;
+    nId = nMinerTemplateId;
+    return true;
+}
+
+static bool IsMinerWorkCurrent(uint64_t nId)
+{
+    LOCK(cs_minerwork);
+    if (nId != nMinerTemplateId)
+        return false;
+    return mempool.GetTransactionsUpdated() == nMinerTransactionsUpdated || GetTime() - nMinerTemplateTime <= 60;
+}
+
+/** The coinbase script paid out in a found block; switch to a fresh one for the next template */
+static void KeepMinerScript()
+{
+    LOCK(cs_minerwork);
+    if (pminerCoinbaseScript) {
+        pminerCoinbaseScript->KeepScript();
+        pminerCoinbaseScript.reset();
+    }
+}
+
+void static BitcoinMiner(const CChainParams& chainparams, int nThread, int nThreads)
+{
+    LogPrintf("DigitSlateMiner -- started thread %d of %d (NeoScrypt kernel: %s)\n", nThread + 1, nThreads, neoscrypt_4way_impl());
+    SetThreadPriority(THREAD_PRIORITY_LOWEST);
+    RenameThread("digitslate-miner");
 
+    // This thread's slice of the nonce space, aligned to the 4-way kernel
+    const uint64_t nRangeSize = ((UINT64_C(1) << 32) / nThreads) & ~UINT64_C(3);
+    const uint64_t nRangeBegin = nRangeSize * nThread;
+    const uint64_t nRangeEnd = (nThread == nThreads - 1) ? (UINT64_C(1) << 32) : nRangeBegin + nRangeSize;
+
+    CMinerScratchpad scratchpad;
+    bool fRenew = false;
+    uint64_t nId = 0;
+
+    try {
         while (true) {
             if (false && chainparams.MiningRequiresPeers()) {
                 // Busy-wait for the network to come online so we don't waste time mining
@@ -431,57 +937,43 @@ void static BitcoinMiner(const CChainParams& chainparams)
 
 
             //
-            // Create new block
+            // Get work
             //
-            unsigned int nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
-            CBlockIndex* pindexPrev = chainActive.Tip();
-            if(!pindexPrev) break;
-
-            auto_ptr<CBlockTemplate> pblocktemplate(CreateNewBlock(chainparams, coinbaseScript->reserveScript));
-            if (!pblocktemplate.get())
+            CBlock block;
+            const CBlockIndex* pindexPrev = NULL;
+            if (!GetMinerWork(chainparams, fRenew, block, pindexPrev, nId))
             {
                 LogPrintf("DigitSlateMiner -- Keypool ran out, please call keypoolrefill before restarting the mining thread\n");
                 return;
             }
-            CBlock *pblock = &pblocktemplate->block;
-            IncrementExtraNonce(pblock, pindexPrev, nExtraNonce);
-
-            LogPrintf("DigitSlateMiner -- Running miner with %u transactions in block (%u bytes)\n", pblock->vtx.size(),
-                ::GetSerializeSize(*pblock, SER_NETWORK, PROTOCOL_VERSION));
+            fRenew = false;
+            uint64_t nNonce = nRangeBegin;
 
             //
             // Search
             //
-            int64_t nStart = GetTime();
-            arith_uint256 hashTarget = arith_uint256().SetCompact(pblock->nBits);
+            arith_uint256 hashTarget = arith_uint256().SetCompact(block.nBits);
             while (true)
             {
-                unsigned int nHashesDone = 0;
-
+                uint64_t nHashesDone = 0;
                 uint256 hash;
-                while (true)
+                bool fFound = ScanHash(&block, nNonce, nRangeEnd, hashTarget, scratchpad, hash, nHashesDone);
+                UpdateHashMeter(nHashesDone);
+                if (fFound)
                 {
-                    hash = pblock->GetHash();
-                    if (UintToArith256(hash) <= hashTarget)
-                    {
-                        // Found a solution
-                        SetThreadPriority(THREAD_PRIORITY_NORMAL);
-                        LogPrintf("DigitSlateMiner:\n  proof-of-work found\n  hash: %s\n  target: %s\n", hash.GetHex(), hashTarget.GetHex());
-                        ProcessBlockFound(pblock, chainparams);
-                        SetThreadPriority(THREAD_PRIORITY_LOWEST);
-                        coinbaseScript->KeepScript();
-
-                        // In regression test mode, stop mining after a block is found. This
-                        // allows developers to controllably generate a block on demand.
-                        if (chainparams.MineBlocksOnDemand())
-                            throw boost::thread_interrupted();
+                    // Found a solution
+                    SetThreadPriority(THREAD_PRIORITY_NORMAL);
+                    LogPrintf("DigitSlateMiner:\n  proof-of-work found\n  hash: %s\n  target: %s\n", hash.GetHex(), hashTarget.GetHex());
+                    ProcessBlockFound(&block, chainparams);
+                    SetThreadPriority(THREAD_PRIORITY_LOWEST);
+                    KeepMinerScript();
+
+                    // In regression test mode, stop mining after a block is found. This
+                    // allows developers to controllably generate a block on demand.
+                    if (chainparams.MineBlocksOnDemand())
+                        throw boost::thread_interrupted();
 
-                        break;
-                    }
-                    pblock->nNonce += 1;
-                    nHashesDone += 1;
-                    if ((pblock->nNonce & 0xFF) == 0)
-                        break;
+                    break;
                 }
 
                 // Check for stop or if block needs to be rebuilt
@@ -489,21 +981,24 @@ void static BitcoinMiner(const CChainParams& chainparams)
                 // Regtest mode doesn't require peers
                 if (vNodes.empty() && chainparams.MiningRequiresPeers())
                     break;
-                if (pblock->nNonce >= 0xffff0000)
+                if (nNonce >= nRangeEnd) {
+                    // Our slice is exhausted, a new extra nonce is needed
+                    fRenew = true;
                     break;
-                if (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 60)
+                }
+                if (!IsMinerWorkCurrent(nId))
                     break;
                 if (pindexPrev != chainActive.Tip())
                     break;
 
                 // Update nTime every few seconds
-                if (UpdateTime(pblock, chainparams.GetConsensus(), pindexPrev) < 0)
+                if (UpdateTime(&block, chainparams.GetConsensus(), pindexPrev) < 0)
                     break; // Recreate the block if the clock has run backwards,
                            // so that we can use the correct time.
                 if (chainparams.GetConsensus().fPowAllowMinDifficultyBlocks)
                 {
-                    // Changing pblock->nTime can change work required on testnet:
-                    hashTarget.SetCompact(pblock->nBits);
+                    // Changing block.nTime can change work required on testnet:
+                    hashTarget.SetCompact(block.nBits);
                 }
             }
         }
@@ -534,10 +1029,22 @@ void GenerateBitcoins(bool fGenerate, int nThreads, const CChainParams& chainpar
         minerThreads = NULL;
     }
 
+    {
+        LOCK(cs_minerwork);
+        pminerTemplate.reset();
+        pminerCoinbaseScript.reset();
+        pminerIndexPrev = NULL;
+    }
+    {
+        LOCK(cs_minerhps);
+        nHPSTimerStart = 0;
+        dHashesPerSec = 0;
+    }
+
     if (nThreads == 0 || !fGenerate)
         return;
 
     minerThreads = new boost::thread_group();
     for (int i = 0; i < nThreads; i++)
-        minerThreads->create_thread(boost::bind(&BitcoinMiner, boost::cref(chainparams)));
+        minerThreads->create_thread(boost::bind(&BitcoinMiner, boost::cref(chainparams), i, nThreads));
 }
@@ -7,9 +7,15 @@
 #define BITCOIN_MINER_H
 
 #include "primitives/block.h"
+#include "txmempool.h"
 
 #include <stdint.h>
+#include <vector>
 
+#include "boost/multi_index_container.hpp"
+#include "boost/multi_index/ordered_index.hpp"
+
+class arith_uint256;
 class CBlockIndex;
 class CChainParams;
 class CReserveKey;
@@ -29,6 +35,215 @@ struct CBlockTemplate
     std::vector<int64_t> vTxSigOps;
 };
 
+// Container for tracking updates to ancestor feerate as we include (parent)
+// transactions in a block
+struct CTxMemPoolModifiedEntry {
+    CTxMemPoolModifiedEntry(CTxMemPool::txiter entry)
+    {
+        iter = entry;
+        nSizeWithAncestors = entry->GetSizeWithAncestors();
+        nModFeesWithAncestors = entry->GetModFeesWithAncestors();
+        nSigOpCountWithAncestors = entry->GetSigOpCountWithAncestors();
+    }
+
+    CTxMemPool::txiter iter;
+    uint64_t nSizeWithAncestors;
+    CAmount nModFeesWithAncestors;
+    unsigned int nSigOpCountWithAncestors;
+};
+
+/** Comparator for CTxMemPool::txiter objects.
+ *  It simply compares the internal memory address of the CTxMemPoolEntry object
+ *  pointed to. This means it has no meaning, and is only useful for using them
+ *  as key in other indexes.
+ */
+struct CompareCTxMemPoolIter {
+    bool operator()(const CTxMemPool::txiter& a, const CTxMemPool::txiter& b) const
+    {
+        return &(*a) < &(*b);
+    }
+};
+
+struct modifiedentry_iter {
+    typedef CTxMemPool::txiter result_type;
+    result_type operator() (const CTxMemPoolModifiedEntry &entry) const
+    {
+        return entry.iter;
+    }
+};
+
+// This matches the calculation in CompareTxMemPoolEntryByAncestorFee,
+// except operating on CTxMemPoolModifiedEntry.
+struct CompareModifiedEntry {
+    bool operator()(const CTxMemPoolModifiedEntry &a, const CTxMemPoolModifiedEntry &b) const
+    {
+        double f1 = (double)a.nModFeesWithAncestors * b.nSizeWithAncestors;
+        double f2 = (double)b.nModFeesWithAncestors * a.nSizeWithAncestors;
+        if (f1 == f2) {
+            return CTxMemPool::CompareIteratorByHash()(a.iter, b.iter);
+        }
+        return f1 > f2;
+    }
+};
+
+// A comparator that sorts transactions based on number of ancestors.
+// This is sufficient to sort an ancestor package in an order that is valid
+// to appear in a block.
+struct CompareTxIterByAncestorCount {
+    bool operator()(const CTxMemPool::txiter &a, const CTxMemPool::txiter &b) const
+    {
+        if (a->GetCountWithAncestors() != b->GetCountWithAncestors())
+            return a->GetCountWithAncestors() < b->GetCountWithAncestors();
+        return CTxMemPool::CompareIteratorByHash()(a, b);
+    }
+};
+
+typedef boost::multi_index_container<
+    CTxMemPoolModifiedEntry,
+    boost::multi_index::indexed_by<
+        boost::multi_index::ordered_unique<
+            modifiedentry_iter,
+            CompareCTxMemPoolIter
+        >,
+        // sorted by modified ancestor fee rate
+        boost::multi_index::ordered_non_unique<
+            boost::multi_index::identity<CTxMemPoolModifiedEntry>,
+            CompareModifiedEntry
+        >
+    >
+> indexed_modified_transaction_set;
+
+typedef indexed_modified_transaction_set::nth_index<0>::type::iterator modtxiter;
+typedef indexed_modified_transaction_set::nth_index<1>::type::iterator modtxscoreiter;
+
+struct update_for_parent_inclusion
+{
+    update_for_parent_inclusion(CTxMemPool::txiter it) : iter(it) {}
+
+    void operator() (CTxMemPoolModifiedEntry &e)
+    {
+        e.nModFeesWithAncestors -= iter->GetModifiedFee();
+        e.nSizeWithAncestors -= iter->GetTxSize();
+        e.nSigOpCountWithAncestors -= iter->GetSigOpCount();
+    }
+
+    CTxMemPool::txiter iter;
+};
+
+/** Size limits of a block template, from -blockmaxsize, -blockprioritysize and -blockminsize */
+struct CBlockTemplateLimits
+{
+    unsigned int nBlockMaxSize;
+    unsigned int nBlockPrioritySize;
+    unsigned int nBlockMinSize;
+
+    CBlockTemplateLimits();
+
+    bool operator==(const CBlockTemplateLimits& other) const
+    {
+        return nBlockMaxSize == other.nBlockMaxSize && nBlockPrioritySize == other.nBlockPrioritySize &&
+               nBlockMinSize == other.nBlockMinSize;
+    }
+};
+
+/**
+ * Selects the transactions of a block template from the mempool, and keeps
+ * the selection for the next template on the same tip.
+ *
+ * Up to -blockprioritysize bytes are filled by coin age priority first, then
+ * whole ancestor packages are added by their feerate. When the next template
+ * is built on the same tip with the same limits and no fee deltas changed,
+ * only the mempool changes since the last selection are looked at: the
+ * selection is kept up to the first package that was removed from the mempool
+ * or that a new transaction's package would have been chosen before, and only
+ * the rest is selected again. New transactions are recognized by their entry
+ * time. Changes that would alter the priority part lead to a full selection.
+ *
+ * The caller holds the mempool's lock (and cs_main, if it is the global pool)
+ * across Select and the use of its results.
+ */
+class CBlockTemplateBuilder
+{
+private:
+    /** A transaction of the last selection, in block order */
+    struct CSelectedTx
+    {
+        uint256 hash;
+        //! position of the first transaction of the same package
+        unsigned int nPackageStart;
+        //! selected by priority rather than as part of a package
+        bool fPriority;
+        //! fees and size of the package when it was selected
+        CAmount nPackageFees;
+        uint64_t nPackageSize;
+    };
+
+    CTxMemPool& pool;
+
+    // What the last selection was made for
+    uint256 hashPrevBlock;
+    int nHeight;
+    int64_t nLockTimeCutoff;
+    CBlockTemplateLimits limits;
+    unsigned int nPrioritisationsUpdated;
+    unsigned int nTransactionsRemoved;
+    int64_t nSelectTime;
+    //! set by the caller once the last selection passed TestBlockValidity
+    bool fValid;
+
+    std::vector<CSelectedTx> vSelected;
+    //! the mempool entries of vSelected, only valid until the mempool changes
+    std::vector<CTxMemPool::txiter> vSelectedIters;
+    //! number of leading transactions of vSelected selected by priority
+    unsigned int nPriorityTxs;
+    //! priority of the transaction the priority part ended with, -1 if it ran out of transactions
+    double dPriorityCutoff;
+    uint256 hashPriorityEnd;
+    //! the block filled up during the priority part
+    bool fPriorityFinished;
+    unsigned int nKept;
+
+    // State of the selection being made
+    CTxMemPool::setEntries inBlock;
+    uint64_t nBlockSize;
+    unsigned int nBlockSigOps;
+    CAmount nFees;
+    int lastFewTxs;
+    bool fBlockFinished;
+    bool fPrintPriority;
+
+    unsigned int FindKept(std::vector<CTxMemPool::txiter>& vKeptIters);
+    void AddToBlock(CTxMemPool::txiter iter, bool fPriority, unsigned int nPackageStart, CAmount nPackageFees, uint64_t nPackageSize);
+    bool TestForBlock(CTxMemPool::txiter iter);
+    bool IsStillDependent(CTxMemPool::txiter iter);
+    void AddPriorityTxs();
+    void AddPackageTxs();
+    bool TestPackage(uint64_t packageSize, unsigned int packageSigOps);
+    bool TestPackageFinality(const CTxMemPool::setEntries& package);
+    bool SkipMapTxEntry(CTxMemPool::txiter it, indexed_modified_transaction_set& mapModifiedTx, CTxMemPool::setEntries& failedTx);
+    void UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded, indexed_modified_transaction_set& mapModifiedTx);
+    void SortForBlock(const CTxMemPool::setEntries& package, CTxMemPool::txiter entry, std::vector<CTxMemPool::txiter>& sortedEntries);
+
+public:
+    CBlockTemplateBuilder(CTxMemPool& poolIn);
+
+    /**
+     * Select the transactions of a block on top of hashPrevBlockIn at height
+     * nHeightIn. Returns how many transactions of the last selection were kept.
+     */
+    unsigned int Select(const uint256& hashPrevBlockIn, int nHeightIn, int64_t nLockTimeCutoffIn, const CBlockTemplateLimits& limitsIn);
+    /** The last selection passed TestBlockValidity, so its kept part need not be checked again */
+    void SetValid() { fValid = true; }
+    /** Forget the last selection */
+    void Clear();
+
+    const std::vector<CTxMemPool::txiter>& GetSelected() const { return vSelectedIters; }
+    unsigned int GetKept() const { return nKept; }
+    uint64_t GetBlockSize() const { return nBlockSize; }
+    unsigned int GetBlockSigOps() const { return nBlockSigOps; }
+    CAmount GetFees() const { return nFees; }
+};
+
 /** Run the miner threads */
 void GenerateBitcoins(bool fGenerate, int nThreads, const CChainParams& chainparams);
 /** Generate a new block, without valid proof-of-work */
@@ -37,4 +252,25 @@ CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const CScript& s
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev);
 
+/** Aligned NeoScrypt scratch memory, reused by one mining thread across scans */
+class CMinerScratchpad
+{
+private:
+    std::vector<unsigned char> vch;
+
+public:
+    CMinerScratchpad();
+    unsigned char* Get();
+};
+
+/**
+ * Scan nonces from nNonce up to (not including) nNonceEnd, four at a time, for a
+ * header hash at or below hashTarget. Returns true with the winning nonce in
+ * pblock->nNonce and its hash in hash. Otherwise returns false after at most
+ * 256 nonces. In both cases nNonce is advanced past the nonces tried.
+ */
+bool ScanHash(CBlockHeader* pblock, uint64_t& nNonce, uint64_t nNonceEnd, const arith_uint256& hashTarget, CMinerScratchpad& scratchpad, uint256& hash, uint64_t& nHashesDone);
+/** Hash rate of the internal miner threads, averaged over the last few seconds */
+double GetMinerHashesPerSec();
+
 #endif // BITCOIN_MINER_H
@@ -33,6 +33,10 @@
 #include <fcntl.h>
 #endif
 
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
 #ifdef USE_UPNP
 #include <miniupnpc/miniupnpc.h>
 #include <miniupnpc/miniwget.h>
@@ -91,6 +95,7 @@ uint64_t nLocalHostNonce = 0;
 static std::vector<ListenSocket> vhListenSocket;
 CAddrMan addrman;
 int nMaxConnections = DEFAULT_MAX_PEER_CONNECTIONS;
+SocketEventsMode nSocketEventsMode = SOCKETEVENTS_SELECT;
 bool fAddressesInitialized = false;
 std::string strSubVersion;
 
@@ -115,12 +120,22 @@ CCriticalSection cs_nLastNodeId;
 
 static CSemaphore *semOutbound = NULL;
 static CSemaphore *semMasternodeOutbound = NULL;
-boost::condition_variable messageHandlerCondition;
+
+// Nodes waiting for a message handler thread, in the order they became ready
+static std::deque<CNode*> vMessageHandlerQueue;
+static boost::mutex mutexMessageHandlerQueue;
+static boost::condition_variable messageHandlerCondition;
 
 // Signals for message handling
 static CNodeSignals g_signals;
 CNodeSignals& GetNodeSignals() { return g_signals; }
 
+// select() can only watch sockets below FD_SETSIZE, epoll has no such limit
+static bool IsPollableSocket(SOCKET hSocket)
+{
+    return nSocketEventsMode == SOCKETEVENTS_EPOLL || IsSelectableSocket(hSocket);
+}
+
 void AddOneShot(const std::string& strDest)
 {
     LOCK(cs_vOneShots);
@@ -421,7 +436,7 @@ CNode* ConnectNode(CAddress addrConnect, const char *pszDest, bool fConnectToMas
     if (pszDest ? ConnectSocketByName(addrConnect, hSocket, pszDest, Params().GetDefaultPort(), nConnectTimeout, &proxyConnectionFailed) :
                   ConnectSocket(addrConnect, hSocket, nConnectTimeout, &proxyConnectionFailed))
     {
-        if (!IsSelectableSocket(hSocket)) {
+        if (!IsPollableSocket(hSocket)) {
             LogPrintf("Cannot create connection: non-selectable socket created (fd >= FD_SETSIZE ?)\n");
             CloseSocket(hSocket);
             return NULL;
@@ -454,10 +469,13 @@ CNode* ConnectNode(CAddress addrConnect, const char *pszDest, bool fConnectToMas
 void CNode::CloseSocketDisconnect()
 {
     fDisconnect = true;
-    if (hSocket != INVALID_SOCKET)
     {
-        LogPrint("net", "disconnecting peer=%d\n", id);
-        CloseSocket(hSocket);
+        LOCK(cs_socketEvents);
+        if (hSocket != INVALID_SOCKET)
+        {
+            LogPrint("net", "disconnecting peer=%d\n", id);
+            CloseSocket(hSocket);
+        }
     }
 
     // in case this fails, we'll empty the recv buffer when the CNode is deleted
@@ -648,6 +666,7 @@ void CNode::copyStats(CNodeStats &stats)
     X(nSendBytes);
     X(nRecvBytes);
     X(fWhitelisted);
+    X(nProcessTime);
 
     // It is common for nodes with good ping times to suddenly become lagged,
     // due to a new block arriving or other large transfer.
@@ -670,6 +689,28 @@ void CNode::copyStats(CNodeStats &stats)
 }
 #undef X
 
+// requires mutexMessageHandlerQueue
+static void ScheduleMessageHandlerLocked(CNode* pnode)
+{
+    if (pnode->fMessageHandlerQueued) {
+        // a handler thread is on it, make it put the node back when done
+        pnode->fMessageHandlerRequeue = true;
+        return;
+    }
+    pnode->fMessageHandlerQueued = true;
+    pnode->AddRef();
+    vMessageHandlerQueue.push_back(pnode);
+}
+
+static void ScheduleMessageHandler(CNode* pnode)
+{
+    {
+        boost::lock_guard<boost::mutex> lock(mutexMessageHandlerQueue);
+        ScheduleMessageHandlerLocked(pnode);
+    }
+    messageHandlerCondition.notify_one();
+}
+
 // requires LOCK(cs_vRecvMsg)
 bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes)
 {
@@ -702,9 +743,10 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes)
 
         if (msg.complete()) {
             msg.nTime = GetTimeMicros();
-            messageHandlerCondition.notify_one();
+            ScheduleMessageHandler(this);
         }
     }
+    UpdateRecvPaused();
 
     return true;
 }
@@ -806,6 +848,7 @@ void SocketSendData(CNode *pnode)
         assert(pnode->nSendSize == 0);
     }
     pnode->vSendMsg.erase(pnode->vSendMsg.begin(), it);
+    pnode->SetSendPending(!pnode->vSendMsg.empty());
 }
 
 static list<CNode*> vNodesDisconnected;
@@ -960,7 +1003,7 @@ static void AcceptConnection(const ListenSocket& hListenSocket) {
         return;
     }
 
-    if (!IsSelectableSocket(hSocket))
+    if (!IsPollableSocket(hSocket))
     {
         LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
         CloseSocket(hSocket);
@@ -1011,6 +1054,162 @@ static void AcceptConnection(const ListenSocket& hListenSocket) {
     }
 }
 
+// Events ThreadSocketHandler waits for on a socket, errors are always reported
+static const unsigned int SOCKET_EVENT_RECV = 1;
+static const unsigned int SOCKET_EVENT_SEND = 2;
+
+#ifdef HAVE_SYS_EPOLL_H
+/**
+ * Epoll instance of ThreadSocketHandler, -1 in select mode. Sockets are added when
+ * their node is created and the listening ones in StartNode. Nodes change what is
+ * waited for on their socket themselves, on the transitions of their send and receive
+ * buffers, so a wakeup costs O(ready sockets). Closing a socket takes it out of the
+ * set, as sockets are never dup()ed.
+ */
+static int hEpollSocketEvents = -1;
+//! Events returned by one epoll_wait, more ready sockets are returned by the next one
+static const int MAX_EPOLL_EVENTS = 1024;
+
+static bool EpollSocketEventsCtl(int nOp, SOCKET hSocket, unsigned int nEvents)
+{
+    if (hEpollSocketEvents == -1)
+        return true;
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    if (nEvents & SOCKET_EVENT_RECV)
+        event.events |= EPOLLIN;
+    if (nEvents & SOCKET_EVENT_SEND)
+        event.events |= EPOLLOUT;
+    event.data.fd = hSocket;
+    return epoll_ctl(hEpollSocketEvents, nOp, hSocket, &event) == 0;
+}
+
+static bool EpollSocketEventsWait(int64_t nTimeout, std::set<SOCKET>& setRecv, std::set<SOCKET>& setSend, std::set<SOCKET>& setError)
+{
+    struct epoll_event vEvents[MAX_EPOLL_EVENTS];
+    int nReady = epoll_wait(hEpollSocketEvents, vEvents, MAX_EPOLL_EVENTS, nTimeout);
+    if (nReady == -1)
+    {
+        if (errno != EINTR)
+            LogPrintf("socket epoll_wait error %s\n", NetworkErrorString(errno));
+        return false;
+    }
+
+    for (int i = 0; i < nReady; i++) {
+        SOCKET hSocket = vEvents[i].data.fd;
+        if (vEvents[i].events & EPOLLIN)
+            setRecv.insert(hSocket);
+        if (vEvents[i].events & EPOLLOUT)
+            setSend.insert(hSocket);
+        if (vEvents[i].events & (EPOLLERR | EPOLLHUP))
+            setError.insert(hSocket);
+    }
+    return true;
+}
+#endif
+
+// requires LOCK(pnode->cs_socketEvents)
+static void UpdateSocketEvents(CNode* pnode)
+{
+    // Implement the following logic:
+    // * If there is data to send, wait for sending data. As this only
+    //   happens when optimistic write failed, we choose to first drain the
+    //   write buffer in this case before receiving more. This avoids
+    //   needlessly queueing received data, if the remote peer is not themselves
+    //   receiving data. This means properly utilizing TCP flow control signalling.
+    // * Otherwise, if there is no (complete) message in the receive buffer,
+    //   or there is space left in the buffer, wait for receiving data.
+    // * (if neither of the above applies, there is certainly one message
+    //   in the receiver buffer ready to be processed).
+    // Together, that means that at least one of the following is always possible,
+    // so we don't deadlock:
+    // * We send some data.
+    // * We wait for data to be received (and disconnect after timeout).
+    // * We process a message in the buffer (message handler thread).
+    unsigned int nEvents = pnode->fSendPending ? SOCKET_EVENT_SEND : (pnode->fRecvPaused ? 0 : SOCKET_EVENT_RECV);
+    if (nEvents == pnode->nSocketEvents)
+        return;
+    pnode->nSocketEvents = nEvents;
+#ifdef HAVE_SYS_EPOLL_H
+    if (pnode->hSocket != INVALID_SOCKET && !EpollSocketEventsCtl(EPOLL_CTL_MOD, pnode->hSocket, nEvents))
+        LogPrint("net", "epoll_ctl for peer=%d failed: %s\n", pnode->id, NetworkErrorString(errno));
+#endif
+}
+
+void CNode::SetSendPending(bool fPending)
+{
+    LOCK(cs_socketEvents);
+    fSendPending = fPending;
+    UpdateSocketEvents(this);
+}
+
+void CNode::UpdateRecvPaused()
+{
+    bool fPaused = !vRecvMsg.empty() && vRecvMsg.front().complete() && GetTotalRecvSize() > ReceiveFloodSize();
+    LOCK(cs_socketEvents);
+    fRecvPaused = fPaused;
+    UpdateSocketEvents(this);
+}
+
+static bool SelectSocketEvents(int64_t nTimeout, std::set<SOCKET>& setRecv, std::set<SOCKET>& setSend, std::set<SOCKET>& setError)
+{
+    struct timeval timeout = MillisToTimeval(nTimeout);
+
+    fd_set fdsetRecv;
+    fd_set fdsetSend;
+    fd_set fdsetError;
+    FD_ZERO(&fdsetRecv);
+    FD_ZERO(&fdsetSend);
+    FD_ZERO(&fdsetError);
+    SOCKET hSocketMax = 0;
+    std::vector<SOCKET> vSockets;
+
+    BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
+        FD_SET(hListenSocket.socket, &fdsetRecv);
+        hSocketMax = max(hSocketMax, hListenSocket.socket);
+        vSockets.push_back(hListenSocket.socket);
+    }
+
+    {
+        LOCK(cs_vNodes);
+        BOOST_FOREACH(CNode* pnode, vNodes)
+        {
+            if (pnode->hSocket == INVALID_SOCKET)
+                continue;
+            unsigned int nEvents = pnode->GetSocketEvents();
+            if (nEvents & SOCKET_EVENT_RECV)
+                FD_SET(pnode->hSocket, &fdsetRecv);
+            if (nEvents & SOCKET_EVENT_SEND)
+                FD_SET(pnode->hSocket, &fdsetSend);
+            FD_SET(pnode->hSocket, &fdsetError);
+            hSocketMax = max(hSocketMax, pnode->hSocket);
+            vSockets.push_back(pnode->hSocket);
+        }
+    }
+
+    int nSelect = select(vSockets.empty() ? 0 : hSocketMax + 1,
+                         &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+    if (nSelect == SOCKET_ERROR)
+    {
+        if (!vSockets.empty())
+        {
+            int nErr = WSAGetLastError();
+            LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
+        }
+        return false;
+    }
+
+    BOOST_FOREACH(SOCKET hSocket, vSockets) {
+        if (FD_ISSET(hSocket, &fdsetRecv))
+            setRecv.insert(hSocket);
+        if (FD_ISSET(hSocket, &fdsetSend))
+            setSend.insert(hSocket);
+        if (FD_ISSET(hSocket, &fdsetError))
+            setError.insert(hSocket);
+    }
+    return true;
+}
+
 void ThreadSocketHandler()
 {
     unsigned int nPrevNodeCount = 0;
@@ -1086,85 +1285,35 @@ void ThreadSocketHandler()
         }
 
         //
-        // Find which sockets have data to receive
+        // Wait for sockets to become ready, as set up by UpdateSocketEvents()
         //
-        struct timeval timeout;
-        timeout.tv_sec  = 0;
-        timeout.tv_usec = 50000; // frequency to poll pnode->vSend
-
-        fd_set fdsetRecv;
-        fd_set fdsetSend;
-        fd_set fdsetError;
-        FD_ZERO(&fdsetRecv);
-        FD_ZERO(&fdsetSend);
-        FD_ZERO(&fdsetError);
-        SOCKET hSocketMax = 0;
-        bool have_fds = false;
-
-        BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
-            FD_SET(hListenSocket.socket, &fdsetRecv);
-            hSocketMax = max(hSocketMax, hListenSocket.socket);
-            have_fds = true;
-        }
-
-        {
-            LOCK(cs_vNodes);
-            BOOST_FOREACH(CNode* pnode, vNodes)
-            {
-                if (pnode->hSocket == INVALID_SOCKET)
-                    continue;
-                FD_SET(pnode->hSocket, &fdsetError);
-                hSocketMax = max(hSocketMax, pnode->hSocket);
-                have_fds = true;
-
-                // Implement the following logic:
-                // * If there is data to send, select() for sending data. As this only
-                //   happens when optimistic write failed, we choose to first drain the
-                //   write buffer in this case before receiving more. This avoids
-                //   needlessly queueing received data, if the remote peer is not themselves
-                //   receiving data. This means properly utilizing TCP flow control signalling.
-                // * Otherwise, if there is no (complete) message in the receive buffer,
-                //   or there is space left in the buffer, select() for receiving data.
-                // * (if neither of the above applies, there is certainly one message
-                //   in the receiver buffer ready to be processed).
-                // Together, that means that at least one of the following is always possible,
-                // so we don't deadlock:
-                // * We send some data.
-                // * We wait for data to be received (and disconnect after timeout).
-                // * We process a message in the buffer (message handler thread).
-                {
-                    TRY_LOCK(pnode->cs_vSend, lockSend);
-                    if (lockSend && !pnode->vSendMsg.empty()) {
-                        FD_SET(pnode->hSocket, &fdsetSend);
-                        continue;
-                    }
-                }
-                {
-                    TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                    if (lockRecv && (
-                        pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
-                        pnode->GetTotalRecvSize() <= ReceiveFloodSize()))
-                        FD_SET(pnode->hSocket, &fdsetRecv);
-                }
-            }
-        }
-
-        int nSelect = select(have_fds ? hSocketMax + 1 : 0,
-                             &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+        const int64_t nTimeout = 50; // frequency to poll pnode->vSend
+        std::set<SOCKET> setRecv;
+        std::set<SOCKET> setSend;
+        std::set<SOCKET> setError;
+        bool fWaitOk;
+#ifdef HAVE_SYS_EPOLL_H
+        if (nSocketEventsMode == SOCKETEVENTS_EPOLL)
+            fWaitOk = EpollSocketEventsWait(nTimeout, setRecv, setSend, setError);
+        else
+#endif
+            fWaitOk = SelectSocketEvents(nTimeout, setRecv, setSend, setError);
         boost::this_thread::interruption_point();
 
-        if (nSelect == SOCKET_ERROR)
+        if (!fWaitOk)
         {
-            if (have_fds)
+            // try to receive from everything, so broken sockets get noticed and closed
+            BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket)
+                setRecv.insert(hListenSocket.socket);
             {
-                int nErr = WSAGetLastError();
-                LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
-                for (unsigned int i = 0; i <= hSocketMax; i++)
-                    FD_SET(i, &fdsetRecv);
+                LOCK(cs_vNodes);
+                BOOST_FOREACH(CNode* pnode, vNodes)
+                    if (pnode->hSocket != INVALID_SOCKET)
+                        setRecv.insert(pnode->hSocket);
             }
-            FD_ZERO(&fdsetSend);
-            FD_ZERO(&fdsetError);
-            MilliSleep(timeout.tv_usec/1000);
+            setSend.clear();
+            setError.clear();
+            MilliSleep(nTimeout);
         }
 
         //
@@ -1172,7 +1321,7 @@ void ThreadSocketHandler()
         //
         BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket)
         {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
+            if (hListenSocket.socket != INVALID_SOCKET && setRecv.count(hListenSocket.socket))
             {
                 AcceptConnection(hListenSocket);
             }
@@ -1191,7 +1340,7 @@ void ThreadSocketHandler()
             //
             if (pnode->hSocket == INVALID_SOCKET)
                 continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetRecv) || FD_ISSET(pnode->hSocket, &fdsetError))
+            if (setRecv.count(pnode->hSocket) || setError.count(pnode->hSocket))
             {
                 TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
                 if (lockRecv)
@@ -1235,7 +1384,7 @@ void ThreadSocketHandler()
             //
             if (pnode->hSocket == INVALID_SOCKET)
                 continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetSend))
+            if (setSend.count(pnode->hSocket))
             {
                 TRY_LOCK(pnode->cs_vSend, lockSend);
                 if (lockSend)
@@ -1739,21 +1888,51 @@ bool OpenNetworkConnection(const CAddress& addrConnect, CSemaphoreGrant *grantOu
 
 void ThreadMessageHandler()
 {
-    boost::mutex condition_mutex;
-    boost::unique_lock<boost::mutex> lock(condition_mutex);
+    // Nodes only get into the queue when they have a complete message, or when all of
+    // them are swept in every MESSAGE_HANDLER_SWEEP_INTERVAL so SendMessages can do
+    // pings, trickle inventory and time out requests for idle peers too.
+    static int64_t nNextSweep = 0;
+    const int64_t MESSAGE_HANDLER_SWEEP_INTERVAL = 100;
 
     SetThreadPriority(THREAD_PRIORITY_BELOW_NORMAL);
     while (true)
     {
-        vector<CNode*> vNodesCopy = CopyNodeVector();
+        CNode* pnode = NULL;
+        bool fSweep = false;
+        {
+            boost::unique_lock<boost::mutex> lock(mutexMessageHandlerQueue);
+            while (true) {
+                int64_t nNow = GetTimeMillis();
+                if (nNow >= nNextSweep) {
+                    nNextSweep = nNow + MESSAGE_HANDLER_SWEEP_INTERVAL;
+                    fSweep = true;
+                    break;
+                }
+                if (!vMessageHandlerQueue.empty()) {
+                    pnode = vMessageHandlerQueue.front();
+                    vMessageHandlerQueue.pop_front();
+                    break;
+                }
+                messageHandlerCondition.timed_wait(lock, boost::posix_time::microsec_clock::universal_time() + boost::posix_time::milliseconds(nNextSweep - nNow));
+            }
+        }
 
-        bool fSleep = true;
+        if (fSweep) {
+            {
+                LOCK(cs_vNodes);
+                boost::lock_guard<boost::mutex> lock(mutexMessageHandlerQueue);
+                BOOST_FOREACH(CNode* pnode, vNodes)
+                    ScheduleMessageHandlerLocked(pnode);
+            }
+            messageHandlerCondition.notify_all();
+            continue;
+        }
 
-        BOOST_FOREACH(CNode* pnode, vNodesCopy)
-        {
-            if (pnode->fDisconnect)
-                continue;
+        int64_t nTimeStart = GetTimeMicros();
+        bool fMoreWork = false;
 
+        if (!pnode->fDisconnect)
+        {
             // Receive messages
             {
                 TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
@@ -1761,12 +1940,13 @@ void ThreadMessageHandler()
                 {
                     if (!g_signals.ProcessMessages(pnode))
                         pnode->fDisconnect = true;
+                    pnode->UpdateRecvPaused();
 
                     if (pnode->nSendSize < SendBufferSize())
                     {
                         if (!pnode->vRecvGetData.empty() || (!pnode->vRecvMsg.empty() && pnode->vRecvMsg[0].complete()))
                         {
-                            fSleep = false;
+                            fMoreWork = true;
                         }
                     }
                 }
@@ -1782,10 +1962,26 @@ void ThreadMessageHandler()
             boost::this_thread::interruption_point();
         }
 
-        ReleaseNodeVector(vNodesCopy);
+        // only this thread works on pnode right now
+        pnode->nProcessTime += GetTimeMicros() - nTimeStart;
 
-        if (fSleep)
-            messageHandlerCondition.timed_wait(lock, boost::posix_time::microsec_clock::universal_time() + boost::posix_time::milliseconds(100));
+        {
+            boost::lock_guard<boost::mutex> lock(mutexMessageHandlerQueue);
+            if ((fMoreWork || pnode->fMessageHandlerRequeue) && !pnode->fDisconnect) {
+                // ProcessMessages handles one message per call, going to the back of
+                // the queue afterwards gives every ready peer its turn
+                pnode->fMessageHandlerRequeue = false;
+                vMessageHandlerQueue.push_back(pnode);
+                pnode = NULL;
+            } else {
+                pnode->fMessageHandlerQueued = false;
+                pnode->fMessageHandlerRequeue = false;
+            }
+        }
+        if (pnode)
+            pnode->Release();
+        else
+            messageHandlerCondition.notify_one();
     }
 }
 
@@ -1816,7 +2012,7 @@ bool BindListenPort(const CService &addrBind, string& strError, bool fWhiteliste
         LogPrintf("%s\n", strError);
         return false;
     }
-    if (!IsSelectableSocket(hListenSocket))
+    if (!IsPollableSocket(hListenSocket))
     {
         strError = "Error: Couldn't create a listenable socket for incoming connections";
         LogPrintf("%s\n", strError);
@@ -1982,6 +2178,21 @@ void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler)
     if (pnodeLocalHost == NULL)
         pnodeLocalHost = new CNode(INVALID_SOCKET, CAddress(CService("127.0.0.1", 0), nLocalServices));
 
+#ifdef HAVE_SYS_EPOLL_H
+    // before any connection is made, so every node socket gets added to it
+    if (nSocketEventsMode == SOCKETEVENTS_EPOLL && hEpollSocketEvents == -1) {
+        hEpollSocketEvents = epoll_create1(EPOLL_CLOEXEC);
+        if (hEpollSocketEvents == -1) {
+            LogPrintf("StartNode -- epoll_create1 failed (%s), falling back to select\n", NetworkErrorString(errno));
+            nSocketEventsMode = SOCKETEVENTS_SELECT;
+        }
+        BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
+            if (hListenSocket.socket != INVALID_SOCKET && !EpollSocketEventsCtl(EPOLL_CTL_ADD, hListenSocket.socket, SOCKET_EVENT_RECV))
+                LogPrintf("StartNode -- epoll_ctl for listening socket failed: %s\n", NetworkErrorString(errno));
+        }
+    }
+#endif
+
     Discover(threadGroup);
 
     //
@@ -2008,7 +2219,8 @@ void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler)
     // Initiate masternode connections
     threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "mnbcon", &ThreadMnbRequestConnections));
 
-    // Process messages
+    // Process messages. ProcessMessage and the masternode, governance and InstantSend
+    // managers it calls into expect a single caller, so there is one handler thread.
     threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "msghand", &ThreadMessageHandler));
 
     // Dump network addresses
@@ -2060,6 +2272,12 @@ public:
         vNodes.clear();
         vNodesDisconnected.clear();
         vhListenSocket.clear();
+#ifdef HAVE_SYS_EPOLL_H
+        if (hEpollSocketEvents != -1) {
+            close(hEpollSocketEvents);
+            hEpollSocketEvents = -1;
+        }
+#endif
         delete semOutbound;
         semOutbound = NULL;
         delete semMasternodeOutbound;
@@ -2435,6 +2653,12 @@ CNode::CNode(SOCKET hSocketIn, const CAddress& addrIn, const std::string& addrNa
     nPingUsecTime = 0;
     fPingQueued = false;
     fMasternode = false;
+    fMessageHandlerQueued = false;
+    fMessageHandlerRequeue = false;
+    nProcessTime = 0;
+    fSendPending = false;
+    fRecvPaused = false;
+    nSocketEvents = SOCKET_EVENT_RECV;
     nMinPingUsecTime = std::numeric_limits<int64_t>::max();
     vchKeyedNetGroup = CalculateKeyedNetGroup(addr);
 
@@ -2451,6 +2675,11 @@ CNode::CNode(SOCKET hSocketIn, const CAddress& addrIn, const std::string& addrNa
     else
         LogPrint("net", "Added connection peer=%d\n", id);
 
+#ifdef HAVE_SYS_EPOLL_H
+    if (hSocket != INVALID_SOCKET && !EpollSocketEventsCtl(EPOLL_CTL_ADD, hSocket, nSocketEvents))
+        LogPrintf("epoll_ctl for peer=%d failed: %s\n", id, NetworkErrorString(errno));
+#endif
+
     // Be shy and don't send version until we hear
     if (hSocket != INVALID_SOCKET && !fInbound)
         PushVersion();
@@ -2460,7 +2689,10 @@ CNode::CNode(SOCKET hSocketIn, const CAddress& addrIn, const std::string& addrNa
 
 CNode::~CNode()
 {
-    CloseSocket(hSocket);
+    {
+        LOCK(cs_socketEvents);
+        CloseSocket(hSocket);
+    }
 
     if (pfilter)
         delete pfilter;
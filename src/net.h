@@ -163,6 +163,13 @@ extern CAddrMan addrman;
 /** Maximum number of connections to simultaneously allow (aka connection slots) */
 extern int nMaxConnections;
 
+/** How ThreadSocketHandler waits for socket events (-socketevents) */
+enum SocketEventsMode {
+    SOCKETEVENTS_SELECT,
+    SOCKETEVENTS_EPOLL,
+};
+extern SocketEventsMode nSocketEventsMode;
+
 extern std::vector<CNode*> vNodes;
 extern CCriticalSection cs_vNodes;
 extern std::map<CInv, CDataStream> mapRelay;
@@ -209,6 +216,7 @@ public:
     double dPingWait;
     double dPingMin;
     std::string addrLocal;
+    int64_t nProcessTime;
 };
 
 
@@ -369,6 +377,22 @@ public:
     CBloomFilter* pfilter;
     int nRefCount;
     NodeId id;
+    // Set while the node is in the message handler queue or being handled, so it
+    // is queued at most once. Both flags are protected by the message handler queue mutex.
+    bool fMessageHandlerQueued;
+    // Set when the node was scheduled again while being handled
+    bool fMessageHandlerRequeue;
+    // Time (microseconds) the message handler spent on this node
+    int64_t nProcessTime;
+    // Socket events ThreadSocketHandler waits for, kept up to date on the transitions of
+    // vSendMsg and vRecvMsg instead of being worked out on every loop. The epoll
+    // registration of the socket is changed with them. Protected by cs_socketEvents,
+    // which also covers closing hSocket, so a socket number reused by a new connection
+    // is never changed through the old node.
+    CCriticalSection cs_socketEvents;
+    bool fSendPending;
+    bool fRecvPaused;
+    unsigned int nSocketEvents;
 protected:
 
     // Denial-of-service detection/prevention
@@ -471,6 +495,16 @@ public:
     // requires LOCK(cs_vRecvMsg)
     bool ReceiveMsgBytes(const char *pch, unsigned int nBytes);
 
+    // requires LOCK(cs_vSend), call when vSendMsg may have become empty or non-empty
+    void SetSendPending(bool fPending);
+    // requires LOCK(cs_vRecvMsg), call when vRecvMsg changed
+    void UpdateRecvPaused();
+    unsigned int GetSocketEvents()
+    {
+        LOCK(cs_socketEvents);
+        return nSocketEvents;
+    }
+
     // requires LOCK(cs_vRecvMsg)
     void SetRecvVersion(int nVersionIn)
     {
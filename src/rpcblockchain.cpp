@@ -10,12 +10,14 @@
 #include "checkpoints.h"
 #include "coins.h"
 #include "consensus/validation.h"
+#include "indexbuilder.h"
 #include "main.h"
 #include "policy/policy.h"
 #include "primitives/transaction.h"
 #include "rpcserver.h"
 #include "streams.h"
 #include "sync.h"
+#include "txdb.h"
 #include "txmempool.h"
 #include "util.h"
 #include "utilstrencodings.h"
@@ -90,7 +92,7 @@ UniValue blockheaderToJSON(const CBlockIndex* blockindex)
 UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false)
 {
     UniValue result(UniValue::VOBJ);
-    result.push_back(Pair("hash", block.GetHash().GetHex()));
+    result.push_back(Pair("hash", blockindex->GetBlockHash().GetHex()));
     int confirmations = -1;
     // Only report confirmations if the block is on the main chain
     if (chainActive.Contains(blockindex))
@@ -959,6 +961,110 @@ UniValue mempoolInfoToJSON()
     return ret;
 }
 
+UniValue getindexinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getindexinfo\n"
+            "Returns the state of the optional indexes that are enabled or being built.\n"
+            "Indexes turned on for an existing database are built in the background, and the\n"
+            "calls that need them become available once they are synced.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"name\": {              (string) the index, one of addressindex, spentindex and timestampindex\n"
+            "    \"synced\": true|false, (boolean) whether the index includes the tip and is in use\n"
+            "    \"best_block_height\": n (numeric) height of the last block in the index, -1 if none\n"
+            "  },\n"
+            "  ...\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getindexinfo", "")
+            + HelpExampleRpc("getindexinfo", "")
+        );
+
+    std::vector<CIndexBuildStatus> vStatus;
+    GetIndexBuildStatus(vStatus);
+
+    UniValue result(UniValue::VOBJ);
+    for (std::vector<CIndexBuildStatus>::const_iterator it = vStatus.begin(); it != vStatus.end(); ++it) {
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("synced", it->fSynced));
+        obj.push_back(Pair("best_block_height", it->nHeight));
+        result.push_back(Pair(it->name, obj));
+    }
+    return result;
+}
+
+/** LevelDB statistics of one database, for getdbstats */
+static UniValue DBStatsToJSON(const CDBWrapper& db)
+{
+    UniValue obj(UniValue::VOBJ);
+    std::string strValue;
+    if (db.GetProperty("leveldb.approximate-memory-usage", strValue))
+        obj.push_back(Pair("approximate_memory_usage", atoi64(strValue)));
+    UniValue files(UniValue::VARR);
+    for (int nLevel = 0; db.GetProperty(strprintf("leveldb.num-files-at-level%d", nLevel), strValue); nLevel++)
+        files.push_back(atoi(strValue));
+    obj.push_back(Pair("files_per_level", files));
+    if (db.GetProperty("leveldb.stats", strValue))
+        obj.push_back(Pair("stats", strValue));
+    return obj;
+}
+
+UniValue getdbstats(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getdbstats\n"
+            "Returns LevelDB statistics of the block index, chain state and index databases,\n"
+            "to help tune the -<db>db* database options.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"name\": {                        (string) the database, one of blocktree, chainstate and indexes\n"
+            "    \"approximate_memory_usage\": n, (numeric) bytes of memory used by the block cache and write buffers\n"
+            "    \"files_per_level\": [n, ...],   (array) number of table files at each level, starting at level 0\n"
+            "    \"stats\": \"...\"                (string) LevelDB's compaction statistics table\n"
+            "  },\n"
+            "  ...\n"
+            "  \"chainstate_flush\": {            (json object) writes of the -dbbackgroundflush thread\n"
+            "    \"enabled\": true|false,         (boolean) whether the chain state is written in the background\n"
+            "    \"pending\": true|false,         (boolean) whether a flush is being written now\n"
+            "    \"writes\": n,                   (numeric) number of flushes written\n"
+            "    \"transactions\": n,             (numeric) cached transactions of the flush being written, or of the last one\n"
+            "    \"usage\": n,                    (numeric) memory of the flush being written, or of the last one, in bytes\n"
+            "    \"last_write_ms\": n,            (numeric) time the last flush took to write\n"
+            "    \"max_write_ms\": n,             (numeric) longest time a flush took to write\n"
+            "    \"total_write_ms\": n,           (numeric) time spent writing flushes\n"
+            "    \"total_wait_ms\": n             (numeric) time validation waited for the previous flush to be written\n"
+            "  }\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getdbstats", "")
+            + HelpExampleRpc("getdbstats", "")
+        );
+
+    LOCK(cs_main);
+
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("blocktree", DBStatsToJSON(*pblocktree)));
+    result.push_back(Pair("chainstate", DBStatsToJSON(pcoinsdbview->GetDB())));
+    result.push_back(Pair("indexes", DBStatsToJSON(*pindexdb)));
+
+    CCoinsWriterStats writerStats = pcoinsdbview->GetWriterStats();
+    UniValue flush(UniValue::VOBJ);
+    flush.push_back(Pair("enabled", pcoinsdbview->HasWriter()));
+    flush.push_back(Pair("pending", writerStats.fPending));
+    flush.push_back(Pair("writes", (uint64_t)writerStats.nWrites));
+    flush.push_back(Pair("transactions", (uint64_t)writerStats.nTransactions));
+    flush.push_back(Pair("usage", (uint64_t)writerStats.nUsage));
+    flush.push_back(Pair("last_write_ms", writerStats.nLastWriteMicros / 1000));
+    flush.push_back(Pair("max_write_ms", writerStats.nMaxWriteMicros / 1000));
+    flush.push_back(Pair("total_write_ms", writerStats.nTotalWriteMicros / 1000));
+    flush.push_back(Pair("total_wait_ms", writerStats.nTotalWaitMicros / 1000));
+    result.push_back(Pair("chainstate_flush", flush));
+    return result;
+}
+
 UniValue getmempoolinfo(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 0)
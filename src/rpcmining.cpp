@@ -27,6 +27,9 @@
 #include "utilstrencodings.h"
 #include "validationinterface.h"
 
+#include <deque>
+#include <limits>
+#include <set>
 #include <stdint.h>
 
 #include <boost/assign/list_of.hpp>
@@ -161,6 +164,7 @@ UniValue generate(const UniValue& params, bool fHelp)
         nHeightEnd = nHeightStart+nGenerate;
     }
     unsigned int nExtraNonce = 0;
+    CMinerScratchpad scratchpad;
     UniValue blockHashes(UniValue::VARR);
     while (nHeight < nHeightEnd)
     {
@@ -172,16 +176,19 @@ UniValue generate(const UniValue& params, bool fHelp)
             LOCK(cs_main);
             IncrementExtraNonce(pblock, chainActive.Tip(), nExtraNonce);
         }
-        while (!CheckProofOfWork(pblock->GetHash(), pblock->nBits, Params().GetConsensus())) {
+        arith_uint256 hashTarget = arith_uint256().SetCompact(pblock->nBits);
+        uint64_t nNonce = pblock->nNonce;
+        uint64_t nHashesDone = 0;
+        uint256 hash;
+        while (!ScanHash(pblock, nNonce, UINT64_C(1) << 32, hashTarget, scratchpad, hash, nHashesDone)) {
             // Yes, there is a chance every nonce could fail to satisfy the -regtest
             // target -- 1 in 2^(2^32). That ain't gonna happen.
-            ++pblock->nNonce;
         }
         CValidationState state;
         if (!ProcessNewBlock(state, Params(), NULL, pblock, true, NULL))
             throw JSONRPCError(RPC_INTERNAL_ERROR, "ProcessNewBlock, block not accepted");
         ++nHeight;
-        blockHashes.push_back(pblock->GetHash().GetHex());
+        blockHashes.push_back(hash.GetHex());
 
         //mark script as important because it was used at least for one coinbase output
         coinbaseScript->KeepScript();
@@ -248,6 +255,7 @@ UniValue getmininginfo(const UniValue& params, bool fHelp)
             "  \"errors\": \"...\"          (string) Current errors\n"
             "  \"generate\": true|false     (boolean) If the generation is on or off (see getgenerate or setgenerate calls)\n"
             "  \"genproclimit\": n          (numeric) The processor limit for generation. -1 if no generation. (see getgenerate or setgenerate calls)\n"
+            "  \"hashespersec\": n          (numeric) The hashes per second of the internal miner threads\n"
             "  \"pooledtx\": n              (numeric) The size of the mem pool\n"
             "  \"testnet\": true|false      (boolean) If using testnet or not\n"
             "  \"chain\": \"xxxx\",         (string) current network name as defined in BIP70 (main, test, regtest)\n"
@@ -267,6 +275,7 @@ UniValue getmininginfo(const UniValue& params, bool fHelp)
     obj.push_back(Pair("difficulty",       (double)GetDifficulty()));
     obj.push_back(Pair("errors",           GetWarnings("statusbar")));
     obj.push_back(Pair("genproclimit",     (int)GetArg("-genproclimit", DEFAULT_GENERATE_THREADS)));
+    obj.push_back(Pair("hashespersec",     GetMinerHashesPerSec()));
     obj.push_back(Pair("networkhashps",    getnetworkhashps(params, false)));
     obj.push_back(Pair("pooledtx",         (uint64_t)mempool.size()));
     obj.push_back(Pair("testnet",          Params().TestnetToBeDeprecatedFieldRPC()));
@@ -326,6 +335,158 @@ static UniValue BIP22ValidationResult(const CValidationState& state)
     return "valid?";
 }
 
+/**
+ * A template handed out by getblocktemplate. All callers share the newest one
+ * until the tip moves, or the mempool changed and it is more than 5 seconds
+ * old, so its transactions are encoded only once.
+ */
+struct CRPCBlockTemplate
+{
+    std::string strId;
+    CBlockIndex* pindexPrev;
+    unsigned int nTransactionsUpdated;
+    int64_t nStart;
+    boost::shared_ptr<CBlockTemplate> pblocktemplate;
+    UniValue transactions;
+};
+
+//! Number of templates on the current tip that clients can get the changes since
+static const unsigned int RPC_TEMPLATE_HISTORY = 10;
+
+// Templates on the current tip, newest last, protected by cs_main
+static std::deque<boost::shared_ptr<const CRPCBlockTemplate> > dequeRPCTemplates;
+
+/** Encode transaction i of a template, with its dependencies among the transactions in mapTxIndex */
+static UniValue TemplateTxToJSON(const CBlockTemplate& tmpl, unsigned int i, const map<uint256, int64_t>& mapTxIndex)
+{
+    const CTransaction& tx = tmpl.block.vtx[i];
+    UniValue entry(UniValue::VOBJ);
+
+    entry.push_back(Pair("data", EncodeHexTx(tx)));
+
+    entry.push_back(Pair("hash", tx.GetHash().GetHex()));
+
+    UniValue deps(UniValue::VARR);
+    BOOST_FOREACH (const CTxIn &in, tx.vin)
+    {
+        map<uint256, int64_t>::const_iterator it = mapTxIndex.find(in.prevout.hash);
+        if (it != mapTxIndex.end())
+            deps.push_back(it->second);
+    }
+    entry.push_back(Pair("depends", deps));
+
+    entry.push_back(Pair("fee", tmpl.vTxFees[i]));
+    entry.push_back(Pair("sigops", tmpl.vTxSigOps[i]));
+    return entry;
+}
+
+static UniValue PayeeToJSON(const CTxOut& txout)
+{
+    UniValue obj(UniValue::VOBJ);
+    CTxDestination address1;
+    ExtractDestination(txout.scriptPubKey, address1);
+    CBitcoinAddress address2(address1);
+    obj.push_back(Pair("payee", address2.ToString().c_str()));
+    obj.push_back(Pair("script", HexStr(txout.scriptPubKey.begin(), txout.scriptPubKey.end())));
+    obj.push_back(Pair("amount", txout.nValue));
+    return obj;
+}
+
+static UniValue MasternodePayeeToJSON(const CBlock& block)
+{
+    if (block.txoutMasternode == CTxOut())
+        return UniValue(UniValue::VOBJ);
+    return PayeeToJSON(block.txoutMasternode);
+}
+
+static UniValue SuperblockPayeesToJSON(const CBlock& block)
+{
+    UniValue superblockObjArray(UniValue::VARR);
+    BOOST_FOREACH (const CTxOut& txout, block.voutSuperblock)
+        superblockObjArray.push_back(PayeeToJSON(txout));
+    return superblockObjArray;
+}
+
+/** Return the shared template for the current tip, building a new one if it is outdated */
+static boost::shared_ptr<const CRPCBlockTemplate> GetRPCBlockTemplate()
+{
+    AssertLockHeld(cs_main);
+
+    if (!dequeRPCTemplates.empty()) {
+        const CRPCBlockTemplate& last = *dequeRPCTemplates.back();
+        if (last.pindexPrev == chainActive.Tip() &&
+            (mempool.GetTransactionsUpdated() == last.nTransactionsUpdated || GetTime() - last.nStart <= 5))
+            return dequeRPCTemplates.back();
+    }
+
+    boost::shared_ptr<CRPCBlockTemplate> ptemplate(new CRPCBlockTemplate());
+    // Store the chainActive.Tip() used before CreateNewBlock, to avoid races
+    ptemplate->nTransactionsUpdated = mempool.GetTransactionsUpdated();
+    ptemplate->pindexPrev = chainActive.Tip();
+    ptemplate->nStart = GetTime();
+
+    CScript scriptDummy = CScript() << OP_TRUE;
+    ptemplate->pblocktemplate.reset(CreateNewBlock(Params(), scriptDummy));
+    if (!ptemplate->pblocktemplate)
+        throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
+    ptemplate->strId = strprintf("%016x", GetRand(std::numeric_limits<uint64_t>::max()));
+
+    const CBlockTemplate& tmpl = *ptemplate->pblocktemplate;
+    ptemplate->transactions = UniValue(UniValue::VARR);
+    map<uint256, int64_t> mapTxIndex;
+    for (unsigned int i = 0; i < tmpl.block.vtx.size(); i++) {
+        if (!tmpl.block.vtx[i].IsCoinBase())
+            ptemplate->transactions.push_back(TemplateTxToJSON(tmpl, i, mapTxIndex));
+        mapTxIndex[tmpl.block.vtx[i].GetHash()] = i;
+    }
+
+    // Only templates on the same tip can be the base of the changes
+    if (!dequeRPCTemplates.empty() && dequeRPCTemplates.back()->pindexPrev != ptemplate->pindexPrev)
+        dequeRPCTemplates.clear();
+    dequeRPCTemplates.push_back(ptemplate);
+    if (dequeRPCTemplates.size() > RPC_TEMPLATE_HISTORY)
+        dequeRPCTemplates.pop_front();
+    return ptemplate;
+}
+
+/** Fill result with the transactions to remove from base and to append to it to get tmpl */
+static void TemplateDeltaToJSON(const CRPCBlockTemplate& base, const CRPCBlockTemplate& tmpl, UniValue& result)
+{
+    const std::vector<CTransaction>& vtxBase = base.pblocktemplate->block.vtx;
+    const std::vector<CTransaction>& vtx = tmpl.pblocktemplate->block.vtx;
+
+    std::set<uint256> setTx;
+    BOOST_FOREACH (const CTransaction& tx, vtx)
+        setTx.insert(tx.GetHash());
+
+    // The transactions the client keeps stay in their order, so they come
+    // before the ones they depend on in the new template as well
+    UniValue removed(UniValue::VARR);
+    map<uint256, int64_t> mapTxIndex;
+    std::set<uint256> setTxBase;
+    int64_t nIndex = 1;
+    BOOST_FOREACH (const CTransaction& tx, vtxBase) {
+        if (tx.IsCoinBase())
+            continue;
+        setTxBase.insert(tx.GetHash());
+        if (setTx.count(tx.GetHash()))
+            mapTxIndex[tx.GetHash()] = nIndex++;
+        else
+            removed.push_back(tx.GetHash().GetHex());
+    }
+
+    UniValue transactions(UniValue::VARR);
+    for (unsigned int i = 0; i < vtx.size(); i++) {
+        if (vtx[i].IsCoinBase() || setTxBase.count(vtx[i].GetHash()))
+            continue;
+        transactions.push_back(TemplateTxToJSON(*tmpl.pblocktemplate, i, mapTxIndex));
+        mapTxIndex[vtx[i].GetHash()] = nIndex++;
+    }
+
+    result.push_back(Pair("removed", removed));
+    result.push_back(Pair("transactions", transactions));
+}
+
 UniValue getblocktemplate(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() > 1)
@@ -342,7 +503,9 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
             "       \"capabilities\":[       (array, optional) A list of strings\n"
             "           \"support\"           (string) client side supported feature, 'longpoll', 'coinbasetxn', 'coinbasevalue', 'proposal', 'serverlist', 'workid'\n"
             "           ,...\n"
-            "         ]\n"
+            "         ],\n"
+            "       \"longpollid\":\"id\"     (string, optional) wait until the template with this longpollid is outdated\n"
+            "       \"templateid\":\"id\"     (string, optional) templateid of a template the client has, to only receive the changes since\n"
             "     }\n"
             "\n"
 
@@ -397,7 +560,25 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
             "      ,...\n"
             "  ],\n"
             "  \"superblocks_started\" : true|false, (boolean) true, if superblock payments started\n"
-            "  \"superblocks_enabled\" : true|false  (boolean) true, if superblock payments are enabled\n"
+            "  \"superblocks_enabled\" : true|false, (boolean) true, if superblock payments are enabled\n"
+            "  \"templateid\" : \"xxxx\"          (string) id of this template, to pass as templateid in the next request\n"
+            "}\n"
+
+            "\nResult (when templateid names a recent template built on the same previous block):\n"
+            "{\n"
+            "  \"templateid\" : \"xxxx\",         (string) id of the new template\n"
+            "  \"basetemplateid\" : \"xxxx\",     (string) the templateid that was passed\n"
+            "  \"previousblockhash\" : \"xxxx\",  (string) The hash of current highest block\n"
+            "  \"removed\" : [ \"xxxx\", ... ],   (array) hashes of the transactions of the base template that must be dropped\n"
+            "  \"transactions\" : [ ... ],        (array) transactions to append to the remaining ones, as above; 'depends' indexes count\n"
+            "                                    the remaining transactions of the base template first, in their order\n"
+            "  \"coinbasevalue\" : n,             (numeric) as above\n"
+            "  \"longpollid\" : \"xxxx\",         (string) as above\n"
+            "  \"curtime\" : ttt,                 (numeric) as above\n"
+            "  \"bits\" : \"xxx\",                (string) as above\n"
+            "  \"height\" : n,                    (numeric) as above\n"
+            "  \"masternode\" : {...},            (json object) as above, only present if the masternode payee changed\n"
+            "  \"superblock\" : [...]             (array) as above, only present if the superblock payees changed\n"
             "}\n"
 
             "\nExamples:\n"
@@ -409,6 +590,7 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
 
     std::string strMode = "template";
     UniValue lpval = NullUniValue;
+    std::string strBaseId;
     if (params.size() > 0)
     {
         const UniValue& oparam = params[0].get_obj();
@@ -422,6 +604,11 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
         else
             throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid mode");
         lpval = find_value(oparam, "longpollid");
+        const UniValue& baseval = find_value(oparam, "templateid");
+        if (baseval.isStr())
+            strBaseId = baseval.get_str();
+        else if (!baseval.isNull())
+            throw JSONRPCError(RPC_TYPE_ERROR, "templateid must be a string");
 
         if (strMode == "proposal")
         {
@@ -514,74 +701,42 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
         // TODO: Maybe recheck connections/IBD and (if something wrong) send an expires-immediately template to stop miners?
     }
 
-    // Update block
-    static CBlockIndex* pindexPrev;
-    static int64_t nStart;
-    static CBlockTemplate* pblocktemplate;
-    if (pindexPrev != chainActive.Tip() ||
-        (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 5))
-    {
-        // Clear pindexPrev so future calls make a new block, despite any failures from here on
-        pindexPrev = NULL;
-
-        // Store the chainActive.Tip() used before CreateNewBlock, to avoid races
-        nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
-        CBlockIndex* pindexPrevNew = chainActive.Tip();
-        nStart = GetTime();
-
-        // Create new block
-        if(pblocktemplate)
-        {
-            delete pblocktemplate;
-            pblocktemplate = NULL;
-        }
-        CScript scriptDummy = CScript() << OP_TRUE;
-        pblocktemplate = CreateNewBlock(Params(), scriptDummy);
-        if (!pblocktemplate)
-            throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
-
-        // Need to update only after we know CreateNewBlock succeeded
-        pindexPrev = pindexPrevNew;
-    }
-    CBlock* pblock = &pblocktemplate->block; // pointer for convenience
+    boost::shared_ptr<const CRPCBlockTemplate> ptemplate = GetRPCBlockTemplate();
+    nTransactionsUpdatedLast = ptemplate->nTransactionsUpdated;
+    CBlockIndex* pindexPrev = ptemplate->pindexPrev;
+    CBlock* pblock = &ptemplate->pblocktemplate->block; // pointer for convenience
 
     // Update nTime
     UpdateTime(pblock, Params().GetConsensus(), pindexPrev);
     pblock->nNonce = 0;
 
-    UniValue aCaps(UniValue::VARR); aCaps.push_back("proposal");
-
-    UniValue transactions(UniValue::VARR);
-    map<uint256, int64_t> setTxIndex;
-    int i = 0;
-    BOOST_FOREACH (const CTransaction& tx, pblock->vtx) {
-        uint256 txHash = tx.GetHash();
-        setTxIndex[txHash] = i++;
-
-        if (tx.IsCoinBase())
-            continue;
-
-        UniValue entry(UniValue::VOBJ);
-
-        entry.push_back(Pair("data", EncodeHexTx(tx)));
-
-        entry.push_back(Pair("hash", txHash.GetHex()));
-
-        UniValue deps(UniValue::VARR);
-        BOOST_FOREACH (const CTxIn &in, tx.vin)
-        {
-            if (setTxIndex.count(in.prevout.hash))
-                deps.push_back(setTxIndex[in.prevout.hash]);
-        }
-        entry.push_back(Pair("depends", deps));
-
-        int index_in_template = i - 1;
-        entry.push_back(Pair("fee", pblocktemplate->vTxFees[index_in_template]));
-        entry.push_back(Pair("sigops", pblocktemplate->vTxSigOps[index_in_template]));
+    boost::shared_ptr<const CRPCBlockTemplate> pbase;
+    BOOST_FOREACH (const boost::shared_ptr<const CRPCBlockTemplate>& pold, dequeRPCTemplates)
+        if (pold->strId == strBaseId)
+            pbase = pold;
 
-        transactions.push_back(entry);
+    if (pbase)
+    {
+        UniValue result(UniValue::VOBJ);
+        result.push_back(Pair("templateid", ptemplate->strId));
+        result.push_back(Pair("basetemplateid", pbase->strId));
+        result.push_back(Pair("previousblockhash", pblock->hashPrevBlock.GetHex()));
+        TemplateDeltaToJSON(*pbase, *ptemplate, result);
+        result.push_back(Pair("coinbasevalue", (int64_t)pblock->vtx[0].GetValueOut()));
+        result.push_back(Pair("longpollid", chainActive.Tip()->GetBlockHash().GetHex() + i64tostr(nTransactionsUpdatedLast)));
+        result.push_back(Pair("curtime", pblock->GetBlockTime()));
+        result.push_back(Pair("bits", strprintf("%08x", pblock->nBits)));
+        result.push_back(Pair("height", (int64_t)(pindexPrev->nHeight+1)));
+        const CBlock& blockBase = pbase->pblocktemplate->block;
+        if (pblock->txoutMasternode != blockBase.txoutMasternode)
+            result.push_back(Pair("masternode", MasternodePayeeToJSON(*pblock)));
+        if (pblock->voutSuperblock != blockBase.voutSuperblock)
+            result.push_back(Pair("superblock", SuperblockPayeesToJSON(*pblock)));
+        return result;
     }
 
+    UniValue aCaps(UniValue::VARR); aCaps.push_back("proposal");
+
     UniValue aux(UniValue::VOBJ);
     aux.push_back(Pair("flags", HexStr(COINBASE_FLAGS.begin(), COINBASE_FLAGS.end())));
 
@@ -599,7 +754,7 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
     result.push_back(Pair("capabilities", aCaps));
     result.push_back(Pair("version", pblock->nVersion));
     result.push_back(Pair("previousblockhash", pblock->hashPrevBlock.GetHex()));
-    result.push_back(Pair("transactions", transactions));
+    result.push_back(Pair("transactions", ptemplate->transactions));
     result.push_back(Pair("coinbaseaux", aux));
     result.push_back(Pair("coinbasevalue", (int64_t)pblock->vtx[0].GetValueOut()));
     result.push_back(Pair("longpollid", chainActive.Tip()->GetBlockHash().GetHex() + i64tostr(nTransactionsUpdatedLast)));
@@ -613,35 +768,14 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
     result.push_back(Pair("bits", strprintf("%08x", pblock->nBits)));
     result.push_back(Pair("height", (int64_t)(pindexPrev->nHeight+1)));
 
-    UniValue masternodeObj(UniValue::VOBJ);
-    if(pblock->txoutMasternode != CTxOut()) {
-        CTxDestination address1;
-        ExtractDestination(pblock->txoutMasternode.scriptPubKey, address1);
-        CBitcoinAddress address2(address1);
-        masternodeObj.push_back(Pair("payee", address2.ToString().c_str()));
-        masternodeObj.push_back(Pair("script", HexStr(pblock->txoutMasternode.scriptPubKey.begin(), pblock->txoutMasternode.scriptPubKey.end())));
-        masternodeObj.push_back(Pair("amount", pblock->txoutMasternode.nValue));
-    }
-    result.push_back(Pair("masternode", masternodeObj));
+    result.push_back(Pair("masternode", MasternodePayeeToJSON(*pblock)));
     result.push_back(Pair("masternode_payments_started", pindexPrev->nHeight + 1 > Params().GetConsensus().nMasternodePaymentsStartBlock));
     result.push_back(Pair("masternode_payments_enforced", sporkManager.IsSporkActive(SPORK_8_MASTERNODE_PAYMENT_ENFORCEMENT)));
 
-    UniValue superblockObjArray(UniValue::VARR);
-    if(pblock->voutSuperblock.size()) {
-        BOOST_FOREACH (const CTxOut& txout, pblock->voutSuperblock) {
-            UniValue entry(UniValue::VOBJ);
-            CTxDestination address1;
-            ExtractDestination(txout.scriptPubKey, address1);
-            CBitcoinAddress address2(address1);
-            entry.push_back(Pair("payee", address2.ToString().c_str()));
-            entry.push_back(Pair("script", HexStr(txout.scriptPubKey.begin(), txout.scriptPubKey.end())));
-            entry.push_back(Pair("amount", txout.nValue));
-            superblockObjArray.push_back(entry);
-        }
-    }
-    result.push_back(Pair("superblock", superblockObjArray));
+    result.push_back(Pair("superblock", SuperblockPayeesToJSON(*pblock)));
     result.push_back(Pair("superblocks_started", pindexPrev->nHeight + 1 > Params().GetConsensus().nSuperblockStartBlock));
     result.push_back(Pair("superblocks_enabled", sporkManager.IsSporkActive(SPORK_9_SUPERBLOCKS_ENABLED)));
+    result.push_back(Pair("templateid", ptemplate->strId));
 
     return result;
 }
@@ -286,12 +286,6 @@ UniValue validateaddress(const UniValue& params, bool fHelp)
             + HelpExampleRpc("validateaddress", "\"XwnLY9Tf7Zsef8gMGL2fhWA9ZmMjt4KPwg\"")
         );
 
-#ifdef ENABLE_WALLET
-    LOCK2(cs_main, pwalletMain ? &pwalletMain->cs_wallet : NULL);
-#else
-    LOCK(cs_main);
-#endif
-
     CBitcoinAddress address(params[0].get_str());
     bool isValid = address.IsValid();
 
@@ -307,6 +301,9 @@ UniValue validateaddress(const UniValue& params, bool fHelp)
         ret.push_back(Pair("scriptPubKey", HexStr(scriptPubKey.begin(), scriptPubKey.end())));
 
 #ifdef ENABLE_WALLET
+        // Only the wallet part needs the locks, so that batches of
+        // validateaddress calls can run concurrently
+        LOCK2(cs_main, pwalletMain ? &pwalletMain->cs_wallet : NULL);
         isminetype mine = pwalletMain ? IsMine(*pwalletMain, dest) : ISMINE_NO;
         ret.push_back(Pair("ismine", (mine & ISMINE_SPENDABLE) ? true : false));
         ret.push_back(Pair("iswatchonly", (mine & ISMINE_WATCH_ONLY) ? true: false));
@@ -569,6 +566,102 @@ bool timestampSort(std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta> a,
     return a.second.time < b.second.time;
 }
 
+/** Largest page the address history calls return at once */
+static const int MAX_ADDRESS_PAGE_SIZE = 100000;
+
+/**
+ * Read the paging options of the address history calls.
+ * Returns true when the caller asked for a page ("limit" or "cursor" given).
+ */
+bool getAddressPageFromParams(const UniValue& params, size_t &nLimit, std::string &strCursor, bool &fDescending)
+{
+    nLimit = 0;
+    strCursor.clear();
+    fDescending = false;
+
+    if (!params[0].isObject())
+        return false;
+
+    UniValue limitValue = find_value(params[0].get_obj(), "limit");
+    UniValue cursorValue = find_value(params[0].get_obj(), "cursor");
+    UniValue orderValue = find_value(params[0].get_obj(), "order");
+
+    if (!orderValue.isNull()) {
+        if (!orderValue.isStr() || (orderValue.get_str() != "asc" && orderValue.get_str() != "desc")) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Order is expected to be \"asc\" or \"desc\"");
+        }
+        fDescending = orderValue.get_str() == "desc";
+    }
+
+    if (limitValue.isNull() && cursorValue.isNull())
+        return false;
+
+    nLimit = MAX_ADDRESS_PAGE_SIZE;
+    if (!limitValue.isNull()) {
+        int nValue = limitValue.get_int();
+        if (nValue <= 0 || nValue > MAX_ADDRESS_PAGE_SIZE) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Limit is expected to be between 1 and %d", MAX_ADDRESS_PAGE_SIZE));
+        }
+        nLimit = nValue;
+    }
+    if (!cursorValue.isNull()) {
+        strCursor = cursorValue.get_str();
+    }
+
+    return true;
+}
+
+/** Encode the last key of a page as the opaque cursor of the next one */
+template<typename K>
+std::string encodeAddressCursor(const K& key)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << key;
+    return HexStr(ss.begin(), ss.end());
+}
+
+/**
+ * Decode a cursor and return the position of its address in addresses,
+ * so the page continues with that address.
+ */
+template<typename K>
+size_t decodeAddressCursor(const std::string& strCursor, const std::vector<std::pair<uint160, int> > &addresses, K& key)
+{
+    if (!IsHex(strCursor))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid cursor");
+
+    std::vector<unsigned char> data(ParseHex(strCursor));
+    CDataStream ss(data, SER_DISK, CLIENT_VERSION);
+    try {
+        ss >> key;
+    } catch (const std::exception&) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid cursor");
+    }
+    if (!ss.empty())
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid cursor");
+
+    for (size_t i = 0; i < addresses.size(); i++) {
+        if (addresses[i].first == key.hashBytes && addresses[i].second == (int)key.type)
+            return i;
+    }
+    throw JSONRPCError(RPC_INVALID_PARAMETER, "Cursor does not belong to the given addresses");
+}
+
+/** Read one page of the merged address index entries, continuing after the cursor (if any) */
+void getAddressIndexPage(const std::vector<std::pair<uint160, int> > &addresses, int start, int end,
+                         const std::string &strCursor, size_t nLimit, bool fDescending,
+                         std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex)
+{
+    CAddressIndexKey cursorKey;
+    if (!strCursor.empty())
+        decodeAddressCursor(strCursor, addresses, cursorKey);
+
+    if (!GetAddressIndexes(addresses, addressIndex, start, end,
+                           strCursor.empty() ? NULL : &cursorKey, nLimit, fDescending)) {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+    }
+}
+
 UniValue getaddressmempool(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
@@ -653,6 +746,8 @@ UniValue getaddressutxos(const UniValue& params, bool fHelp)
             "      \"address\"  (string) The base58check encoded address\n"
             "      ,...\n"
             "    ]\n"
+            "  \"limit\" (number, optional) Return one page of at most this many outputs\n"
+            "  \"cursor\" (string, optional) The \"next\" value of the previous page\n"
             "}\n"
             "\nResult\n"
             "[\n"
@@ -665,8 +760,14 @@ UniValue getaddressutxos(const UniValue& params, bool fHelp)
             "    \"satoshis\"  (number) The number of satoshis of the output\n"
             "  }\n"
             "]\n"
+            "\nResult (when \"limit\" or \"cursor\" is given)\n"
+            "{\n"
+            "  \"utxos\"  (array) The outputs as above, per address in index order instead of by height\n"
+            "  \"next\"  (string) The cursor of the next page, only present when the page is full\n"
+            "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getaddressutxos", "'{\"addresses\": [\"XwnLY9Tf7Zsef8gMGL2fhWA9ZmMjt4KPwg\"]}'")
+            + HelpExampleCli("getaddressutxos", "'{\"addresses\": [\"XwnLY9Tf7Zsef8gMGL2fhWA9ZmMjt4KPwg\"], \"limit\": 1000}'")
             + HelpExampleRpc("getaddressutxos", "{\"addresses\": [\"XwnLY9Tf7Zsef8gMGL2fhWA9ZmMjt4KPwg\"]}")
         );
 
@@ -676,15 +777,40 @@ UniValue getaddressutxos(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
     }
 
+    size_t nLimit;
+    std::string strCursor;
+    bool fDescending;
+    bool fPaged = getAddressPageFromParams(params, nLimit, strCursor, fDescending);
+
+    // outputs page in the key order of the index, which has no height to walk back along
+    if (params[0].isObject() && !find_value(params[0].get_obj(), "order").isNull()) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Order is not supported for unspent outputs");
+    }
+
     std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > unspentOutputs;
 
-    for (std::vector<std::pair<uint160, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
-        if (!GetAddressUnspent((*it).first, (*it).second, unspentOutputs)) {
-            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+    if (fPaged) {
+        // A page follows the key order of the index, sorting by height would need every output
+        CAddressUnspentKey cursorKey;
+        size_t nFirst = 0;
+        if (!strCursor.empty())
+            nFirst = decodeAddressCursor(strCursor, addresses, cursorKey);
+
+        for (size_t i = nFirst; i < addresses.size() && unspentOutputs.size() < nLimit; i++) {
+            const CAddressUnspentKey *pAfter = (!strCursor.empty() && i == nFirst) ? &cursorKey : NULL;
+            if (!GetAddressUnspent(addresses[i].first, addresses[i].second, unspentOutputs, pAfter, nLimit - unspentOutputs.size())) {
+                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+            }
+        }
+    } else {
+        for (std::vector<std::pair<uint160, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
+            if (!GetAddressUnspent((*it).first, (*it).second, unspentOutputs)) {
+                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+            }
         }
-    }
 
-    std::sort(unspentOutputs.begin(), unspentOutputs.end(), heightSort);
+        std::sort(unspentOutputs.begin(), unspentOutputs.end(), heightSort);
+    }
 
     UniValue result(UniValue::VARR);
 
@@ -704,6 +830,14 @@ UniValue getaddressutxos(const UniValue& params, bool fHelp)
         result.push_back(output);
     }
 
+    if (fPaged) {
+        UniValue page(UniValue::VOBJ);
+        page.push_back(Pair("utxos", result));
+        if (unspentOutputs.size() == nLimit)
+            page.push_back(Pair("next", encodeAddressCursor(unspentOutputs.back().first)));
+        return page;
+    }
+
     return result;
 }
 
@@ -712,7 +846,7 @@ UniValue getaddressdeltas(const UniValue& params, bool fHelp)
     if (fHelp || params.size() != 1 || !params[0].isObject())
         throw runtime_error(
             "getaddressdeltas\n"
-            "\nReturns all changes for an address (requires addressindex to be enabled).\n"
+            "\nReturns all changes for an address(es) ordered by block height (requires addressindex to be enabled).\n"
             "\nArguments:\n"
             "{\n"
             "  \"addresses\"\n"
@@ -722,6 +856,9 @@ UniValue getaddressdeltas(const UniValue& params, bool fHelp)
             "    ]\n"
             "  \"start\" (number) The start block height\n"
             "  \"end\" (number) The end block height\n"
+            "  \"limit\" (number, optional) Return one page of at most this many deltas\n"
+            "  \"cursor\" (string, optional) The \"next\" value of the previous page\n"
+            "  \"order\" (string, optional, default=asc) \"asc\" or \"desc\" by block height\n"
             "}\n"
             "\nResult:\n"
             "[\n"
@@ -733,8 +870,14 @@ UniValue getaddressdeltas(const UniValue& params, bool fHelp)
             "    \"address\"  (string) The base58check encoded address\n"
             "  }\n"
             "]\n"
+            "\nResult (when \"limit\" or \"cursor\" is given):\n"
+            "{\n"
+            "  \"deltas\"  (array) The deltas as above\n"
+            "  \"next\"  (string) The cursor of the next page, only present when the page is full\n"
+            "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getaddressdeltas", "'{\"addresses\": [\"XwnLY9Tf7Zsef8gMGL2fhWA9ZmMjt4KPwg\"]}'")
+            + HelpExampleCli("getaddressdeltas", "'{\"addresses\": [\"XwnLY9Tf7Zsef8gMGL2fhWA9ZmMjt4KPwg\"], \"limit\": 1000, \"order\": \"desc\"}'")
             + HelpExampleRpc("getaddressdeltas", "{\"addresses\": [\"XwnLY9Tf7Zsef8gMGL2fhWA9ZmMjt4KPwg\"]}")
         );
 
@@ -759,18 +902,22 @@ UniValue getaddressdeltas(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
     }
 
+    if (start <= 0 || end <= 0) {
+        start = 0;
+        end = 0;
+    }
+
+    size_t nLimit;
+    std::string strCursor;
+    bool fDescending;
+    bool fPaged = getAddressPageFromParams(params, nLimit, strCursor, fDescending);
+
     std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
 
-    for (std::vector<std::pair<uint160, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
-        if (start > 0 && end > 0) {
-            if (!GetAddressIndex((*it).first, (*it).second, addressIndex, start, end)) {
-                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
-            }
-        } else {
-            if (!GetAddressIndex((*it).first, (*it).second, addressIndex)) {
-                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
-            }
-        }
+    if (fPaged) {
+        getAddressIndexPage(addresses, start, end, strCursor, nLimit, fDescending, addressIndex);
+    } else if (!GetAddressIndexes(addresses, addressIndex, start, end, NULL, 0, fDescending)) {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
     }
 
     UniValue result(UniValue::VARR);
@@ -791,6 +938,14 @@ UniValue getaddressdeltas(const UniValue& params, bool fHelp)
         result.push_back(delta);
     }
 
+    if (fPaged) {
+        UniValue page(UniValue::VOBJ);
+        page.push_back(Pair("deltas", result));
+        if (addressIndex.size() == nLimit)
+            page.push_back(Pair("next", encodeAddressCursor(addressIndex.back().first)));
+        return page;
+    }
+
     return result;
 }
 
@@ -812,6 +967,7 @@ UniValue getaddressbalance(const UniValue& params, bool fHelp)
             "{\n"
             "  \"balance\"  (string) The current balance in satoshis\n"
             "  \"received\"  (string) The total number of satoshis received (including change)\n"
+            "  \"txcount\"  (number) The number of transactions involving each address, summed over the addresses\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getaddressbalance", "'{\"addresses\": [\"XwnLY9Tf7Zsef8gMGL2fhWA9ZmMjt4KPwg\"]}'")
@@ -824,27 +980,24 @@ UniValue getaddressbalance(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
     }
 
-    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
-
-    for (std::vector<std::pair<uint160, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
-        if (!GetAddressIndex((*it).first, (*it).second, addressIndex)) {
-            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
-        }
-    }
-
     CAmount balance = 0;
     CAmount received = 0;
+    int64_t txcount = 0;
 
-    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=addressIndex.begin(); it!=addressIndex.end(); it++) {
-        if (it->second > 0) {
-            received += it->second;
+    for (std::vector<std::pair<uint160, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
+        CAddressBalanceValue addressBalance;
+        if (!GetAddressBalance((*it).first, (*it).second, addressBalance)) {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
         }
-        balance += it->second;
+        balance += addressBalance.balance;
+        received += addressBalance.received;
+        txcount += addressBalance.txCount;
     }
 
     UniValue result(UniValue::VOBJ);
     result.push_back(Pair("balance", balance));
     result.push_back(Pair("received", received));
+    result.push_back(Pair("txcount", txcount));
 
     return result;
 
@@ -855,7 +1008,7 @@ UniValue getaddresstxids(const UniValue& params, bool fHelp)
     if (fHelp || params.size() != 1)
         throw runtime_error(
             "getaddresstxids\n"
-            "\nReturns the txids for an address(es) (requires addressindex to be enabled).\n"
+            "\nReturns the txids for an address(es) ordered by block height (requires addressindex to be enabled).\n"
             "\nArguments:\n"
             "{\n"
             "  \"addresses\"\n"
@@ -865,14 +1018,23 @@ UniValue getaddresstxids(const UniValue& params, bool fHelp)
             "    ]\n"
             "  \"start\" (number) The start block height\n"
             "  \"end\" (number) The end block height\n"
+            "  \"limit\" (number, optional) Return one page, reading at most this many index entries\n"
+            "  \"cursor\" (string, optional) The \"next\" value of the previous page\n"
+            "  \"order\" (string, optional, default=asc) \"asc\" or \"desc\" by block height\n"
             "}\n"
             "\nResult:\n"
             "[\n"
             "  \"transactionid\"  (string) The transaction id\n"
             "  ,...\n"
             "]\n"
+            "\nResult (when \"limit\" or \"cursor\" is given):\n"
+            "{\n"
+            "  \"txids\"  (array) The txids as above\n"
+            "  \"next\"  (string) The cursor of the next page, only present when the page is full\n"
+            "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getaddresstxids", "'{\"addresses\": [\"XwnLY9Tf7Zsef8gMGL2fhWA9ZmMjt4KPwg\"]}'")
+            + HelpExampleCli("getaddresstxids", "'{\"addresses\": [\"XwnLY9Tf7Zsef8gMGL2fhWA9ZmMjt4KPwg\"], \"limit\": 1000}'")
             + HelpExampleRpc("getaddresstxids", "{\"addresses\": [\"XwnLY9Tf7Zsef8gMGL2fhWA9ZmMjt4KPwg\"]}")
         );
 
@@ -893,40 +1055,49 @@ UniValue getaddresstxids(const UniValue& params, bool fHelp)
         }
     }
 
+    if (start <= 0 || end <= 0) {
+        start = 0;
+        end = 0;
+    }
+
+    size_t nLimit;
+    std::string strCursor;
+    bool fDescending;
+    bool fPaged = getAddressPageFromParams(params, nLimit, strCursor, fDescending);
+
     std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
 
-    for (std::vector<std::pair<uint160, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
-        if (start > 0 && end > 0) {
-            if (!GetAddressIndex((*it).first, (*it).second, addressIndex, start, end)) {
-                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
-            }
-        } else {
-            if (!GetAddressIndex((*it).first, (*it).second, addressIndex)) {
-                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
-            }
-        }
+    if (fPaged) {
+        getAddressIndexPage(addresses, start, end, strCursor, nLimit, fDescending, addressIndex);
+    } else if (!GetAddressIndexes(addresses, addressIndex, start, end, NULL, 0, fDescending)) {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+    }
+
+    // The merged entries of a transaction are adjacent, so comparing with the
+    // previous one is enough to drop duplicates. That includes the transaction
+    // the previous page ended with.
+    uint256 lastTxid;
+    if (!strCursor.empty()) {
+        CAddressIndexKey cursorKey;
+        decodeAddressCursor(strCursor, addresses, cursorKey);
+        lastTxid = cursorKey.txhash;
     }
 
-    std::set<std::pair<int, std::string> > txids;
     UniValue result(UniValue::VARR);
 
     for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=addressIndex.begin(); it!=addressIndex.end(); it++) {
-        int height = it->first.blockHeight;
-        std::string txid = it->first.txhash.GetHex();
-
-        if (addresses.size() > 1) {
-            txids.insert(std::make_pair(height, txid));
-        } else {
-            if (txids.insert(std::make_pair(height, txid)).second) {
-                result.push_back(txid);
-            }
-        }
+        if (it->first.txhash == lastTxid)
+            continue;
+        lastTxid = it->first.txhash;
+        result.push_back(lastTxid.GetHex());
     }
 
-    if (addresses.size() > 1) {
-        for (std::set<std::pair<int, std::string> >::const_iterator it=txids.begin(); it!=txids.end(); it++) {
-            result.push_back(it->second);
-        }
+    if (fPaged) {
+        UniValue page(UniValue::VOBJ);
+        page.push_back(Pair("txids", result));
+        if (addressIndex.size() == nLimit)
+            page.push_back(Pair("next", encodeAddressCursor(addressIndex.back().first)));
+        return page;
     }
 
     return result;
@@ -285,7 +285,9 @@ static const CRPCCommand vRPCCommands[] =
     { "blockchain",         "getblockheader",         &getblockheader,         true  },
     { "blockchain",         "getblockheaders",        &getblockheaders,        true  },
     { "blockchain",         "getchaintips",           &getchaintips,           true  },
+    { "blockchain",         "getdbstats",             &getdbstats,             true  },
     { "blockchain",         "getdifficulty",          &getdifficulty,          true  },
+    { "blockchain",         "getindexinfo",           &getindexinfo,           true  },
     { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         true  },
     { "blockchain",         "getrawmempool",          &getrawmempool,          true  },
     { "blockchain",         "gettxout",               &gettxout,               true  },
@@ -502,13 +504,15 @@ void JSONRequest::parse(const UniValue& valRequest)
         throw JSONRPCError(RPC_INVALID_REQUEST, "Params must be an array");
 }
 
-static UniValue JSONRPCExecOne(const UniValue& req)
+static UniValue JSONRPCExecOne(const UniValue& req, int64_t nDeadline)
 {
     UniValue rpc_result(UniValue::VOBJ);
 
     JSONRequest jreq;
     try {
         jreq.parse(req);
+        if (nDeadline && GetTimeMillis() > nDeadline)
+            throw JSONRPCError(RPC_MISC_ERROR, "Batch time limit exceeded (see -rpcbatchtimeout)");
 
         UniValue result = tableRPC.execute(jreq.strMethod, jreq.params);
         rpc_result = JSONRPCReplyObj(result, NullUniValue, jreq.id);
@@ -526,13 +530,140 @@ static UniValue JSONRPCExecOne(const UniValue& req)
     return rpc_result;
 }
 
-std::string JSONRPCExecBatch(const UniValue& vReq)
+/**
+ * Commands that only read state and hold locks for short moments at most, so
+ * batch elements calling them may run concurrently and in any order.
+ * validateaddress only qualifies without a wallet, see IsBatchConcurrent().
+ */
+static const char* const vBatchConcurrentCommands[] = {
+    "decoderawtransaction",
+    "decodescript",
+    "getrawtransaction",
+    "gettxout",
+    "validateaddress",
+};
+
+static bool IsBatchConcurrent(const UniValue& req)
 {
-    UniValue ret(UniValue::VARR);
-    for (unsigned int reqIdx = 0; reqIdx < vReq.size(); reqIdx++)
-        ret.push_back(JSONRPCExecOne(vReq[reqIdx]));
+    if (!req.isObject())
+        return false;
+    const UniValue& valMethod = find_value(req.get_obj(), "method");
+    if (!valMethod.isStr())
+        return false;
+    // validateaddress takes cs_wallet, which wallet commands may hold for long
+    if (pwalletMain && valMethod.get_str() == "validateaddress")
+        return false;
+    for (unsigned int i = 0; i < ARRAYLEN(vBatchConcurrentCommands); i++)
+        if (valMethod.get_str() == vBatchConcurrentCommands[i])
+            return true;
+    return false;
+}
+
+/**
+ * A run of batch elements that are executed concurrently. Any thread may take
+ * the next element; the thread that received the batch takes part too, so the
+ * run completes even if no other thread helps.
+ */
+class CRPCBatchRun
+{
+private:
+    boost::mutex cs;
+    boost::condition_variable cond;
+    //! Only accessed for elements that are taken, while the batch is waited for
+    const UniValue& vReq;
+    const unsigned int nBegin;
+    const unsigned int nEnd;
+    const int64_t nDeadline;
+    unsigned int nNext;
+    std::vector<UniValue> vResults;
+    std::vector<bool> vDone;
+
+public:
+    CRPCBatchRun(const UniValue& vReqIn, unsigned int nBeginIn, unsigned int nEndIn, int64_t nDeadlineIn) :
+        vReq(vReqIn), nBegin(nBeginIn), nEnd(nEndIn), nDeadline(nDeadlineIn), nNext(nBeginIn),
+        vResults(nEndIn - nBeginIn), vDone(nEndIn - nBeginIn, false) {}
+
+    /** Execute the next element, returns whether there are more to take */
+    bool RunNext()
+    {
+        unsigned int reqIdx;
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            if (nNext == nEnd)
+                return false;
+            reqIdx = nNext++;
+        }
+        UniValue result = JSONRPCExecOne(vReq[reqIdx], nDeadline);
+
+        boost::unique_lock<boost::mutex> lock(cs);
+        vResults[reqIdx - nBegin] = result;
+        vDone[reqIdx - nBegin] = true;
+        cond.notify_all();
+        return nNext < nEnd;
+    }
+
+    /** Move the result of an element out, if it is done or fWait is set */
+    bool TakeResult(unsigned int reqIdx, UniValue& result, bool fWait)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        while (fWait && !vDone[reqIdx - nBegin])
+            cond.wait(lock);
+        if (!vDone[reqIdx - nBegin])
+            return false;
+        result = vResults[reqIdx - nBegin];
+        vResults[reqIdx - nBegin] = NullUniValue;
+        return true;
+    }
+};
+
+static void AppendBatchResult(std::string& strReply, const UniValue& result)
+{
+    if (strReply.size() > 1)
+        strReply += ",";
+    strReply += result.write();
+}
+
+std::string JSONRPCExecBatch(const UniValue& vReq, const RPCBatchDispatcher& dispatcher)
+{
+    unsigned int nMaxSize = GetArg("-rpcbatchmaxsize", DEFAULT_RPC_BATCH_MAX_SIZE);
+    if (nMaxSize > 0 && vReq.size() > nMaxSize)
+        throw JSONRPCError(RPC_INVALID_REQUEST, strprintf("Batch of %u requests exceeds the limit of %u (see -rpcbatchmaxsize)", vReq.size(), nMaxSize));
+    int64_t nTimeout = GetArg("-rpcbatchtimeout", DEFAULT_RPC_BATCH_TIMEOUT);
+    int64_t nDeadline = nTimeout > 0 ? GetTimeMillis() + nTimeout * 1000 : 0;
+
+    // Results are written out in order as soon as they are done, rather
+    // than collected in an array of the whole batch first
+    std::string strReply = "[";
+    unsigned int reqIdx = 0;
+    while (reqIdx < vReq.size()) {
+        unsigned int nEnd = reqIdx;
+        if (!dispatcher.empty())
+            while (nEnd < vReq.size() && IsBatchConcurrent(vReq[nEnd]))
+                nEnd++;
+        if (nEnd - reqIdx < 2) {
+            // Anything else runs in order, after all elements before it are done
+            AppendBatchResult(strReply, JSONRPCExecOne(vReq[reqIdx], nDeadline));
+            reqIdx++;
+            continue;
+        }
+
+        boost::shared_ptr<CRPCBatchRun> run(new CRPCBatchRun(vReq, reqIdx, nEnd, nDeadline));
+        for (unsigned int i = reqIdx + 1; i < nEnd; i++)
+            if (!dispatcher(boost::bind(&CRPCBatchRun::RunNext, run)))
+                break;
+        bool fMore = true;
+        while (reqIdx < nEnd) {
+            if (fMore)
+                fMore = run->RunNext();
+            UniValue result;
+            if (run->TakeResult(reqIdx, result, !fMore)) {
+                AppendBatchResult(strReply, result);
+                reqIdx++;
+            }
+        }
+    }
 
-    return ret.write() + "\n";
+    return strReply + "]\n";
 }
 
 UniValue CRPCTable::execute(const std::string &strMethod, const UniValue &params) const
@@ -21,6 +21,11 @@
 
 class CRPCCommand;
 
+//! Maximum number of requests in a batch, 0 for no limit
+static const unsigned int DEFAULT_RPC_BATCH_MAX_SIZE = 1000;
+//! Seconds after which the rest of a batch fails, 0 for no limit
+static const int64_t DEFAULT_RPC_BATCH_TIMEOUT = 30;
+
 namespace RPCServer
 {
     void OnStarted(boost::function<void ()> slot);
@@ -292,6 +297,8 @@ extern UniValue gettxoutsetinfo(const UniValue& params, bool fHelp);
 extern UniValue gettxout(const UniValue& params, bool fHelp);
 extern UniValue verifychain(const UniValue& params, bool fHelp);
 extern UniValue getchaintips(const UniValue& params, bool fHelp);
+extern UniValue getindexinfo(const UniValue& params, bool fHelp);
+extern UniValue getdbstats(const UniValue& params, bool fHelp);
 extern UniValue invalidateblock(const UniValue& params, bool fHelp);
 extern UniValue reconsiderblock(const UniValue& params, bool fHelp);
 extern UniValue getspentinfo(const UniValue& params, bool fHelp);
@@ -299,6 +306,15 @@ extern UniValue getspentinfo(const UniValue& params, bool fHelp);
 bool StartRPC();
 void InterruptRPC();
 void StopRPC();
-std::string JSONRPCExecBatch(const UniValue& vReq);
+
+/**
+ * Runs a function on another thread of the RPC server, again as long as it
+ * returns true, for the parts of a batch that may execute concurrently.
+ * Returns false if no thread is free to do so.
+ */
+typedef boost::function<bool (const boost::function<bool ()>&)> RPCBatchDispatcher;
+
+/** Execute a batch of requests, with the concurrent parts spread by dispatcher if given */
+std::string JSONRPCExecBatch(const UniValue& vReq, const RPCBatchDispatcher& dispatcher = RPCBatchDispatcher());
 
 #endif // BITCOIN_RPCSERVER_H
@@ -8,14 +8,33 @@
 
 #include "script/interpreter.h"
 
+#include <string.h>
 #include <vector>
 
-// DoS prevention: limit cache size to less than 40MB (over 500000
-// entries on 64-bit systems).
+// DoS prevention: limit cache size to 40MB (over 1250000 entries, as the
+// cache takes 32 bytes per entry and allocates all of them up front).
 static const unsigned int DEFAULT_MAX_SIG_CACHE_SIZE = 40;
+// Keep the number of entries of -maxsigcachesize in 32 bits
+static const int64_t MAX_MAX_SIG_CACHE_SIZE = 16384;
 
 class CPubKey;
 
+/**
+ * We're hashing a nonce into the entries themselves, so we don't need extra
+ * blinding in the set hash computation. The 8 hashes the cuckoo cache needs
+ * are just the 8 32-bit words of the entry.
+ */
+class CSignatureCacheHasher
+{
+public:
+    uint32_t operator()(const uint256& key, int n) const
+    {
+        uint32_t u;
+        memcpy(&u, key.begin() + 4 * n, 4);
+        return u;
+    }
+};
+
 class CachingTransactionSignatureChecker : public TransactionSignatureChecker
 {
 private:
@@ -27,4 +46,7 @@ public:
     bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
 };
 
+/** Allocate the signature cache, sized by -maxsigcachesize */
+void InitSignatureCache();
+
 #endif // BITCOIN_SCRIPT_SIGCACHE_H
@@ -0,0 +1,137 @@
+// Copyright (c) 2017 The DigitSlate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "checkqueue.h"
+#include "random.h"
+#include "utilstrencodings.h"
+
+#include "test/test_digitslate.h"
+
+#include <atomic>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(checkqueue_tests, BasicTestingSetup)
+
+static const int CHECKQUEUE_TEST_THREADS = 4;
+
+/** Counts how often it ran, fails if told to */
+struct CCountCheck
+{
+    std::atomic<int>* pnRuns;
+    bool fResult;
+
+    CCountCheck() : pnRuns(NULL), fResult(true) {}
+    CCountCheck(std::atomic<int>& nRuns, bool fResultIn) : pnRuns(&nRuns), fResult(fResultIn) {}
+
+    bool operator()()
+    {
+        (*pnRuns)++;
+        return fResult;
+    }
+
+    void swap(CCountCheck& check)
+    {
+        std::swap(pnRuns, check.pnRuns);
+        std::swap(fResult, check.fResult);
+    }
+};
+
+static void ThreadCountCheck(CCheckQueue<CCountCheck>* pqueue)
+{
+    pqueue->Thread();
+}
+
+static void AddChecks(CCheckQueueControl<CCountCheck>& control, std::atomic<int>& nRuns, int nChecks, int nFailAt)
+{
+    std::vector<CCountCheck> vChecks;
+    for (int i = 0; i < nChecks; i++) {
+        vChecks.push_back(CCountCheck(nRuns, i != nFailAt));
+        // mix batches of a single check, as from one input, with big ones
+        if (vChecks.size() > insecure_rand() % 64) {
+            control.Add(vChecks);
+            vChecks.clear();
+        }
+    }
+    control.Add(vChecks);
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_all_run)
+{
+    seed_insecure_rand(true);
+    CCheckQueue<CCountCheck> queue(16);
+    boost::thread_group threadGroup;
+    for (int i = 0; i < CHECKQUEUE_TEST_THREADS - 1; i++)
+        threadGroup.create_thread(boost::bind(&ThreadCountCheck, &queue));
+
+    const int counts[] = {0, 1, 2, 3, 100, 1000, 10007};
+    for (unsigned int i = 0; i < ARRAYLEN(counts); i++) {
+        std::atomic<int> nRuns(0);
+        CCheckQueueControl<CCountCheck> control(&queue);
+        AddChecks(control, nRuns, counts[i], -1);
+        BOOST_CHECK(control.Wait());
+        BOOST_CHECK_EQUAL(nRuns.load(), counts[i]);
+
+        CCheckQueueStats stats = control.GetStats();
+        BOOST_CHECK_EQUAL(stats.nChecks, (unsigned int)counts[i]);
+        BOOST_CHECK(stats.nTimeMicros >= 0);
+        BOOST_CHECK(stats.nIdleMicros >= 0);
+        BOOST_CHECK(queue.IsIdle());
+    }
+
+    // The control waits when it goes out of scope
+    std::atomic<int> nRuns(0);
+    {
+        CCheckQueueControl<CCountCheck> control(&queue);
+        AddChecks(control, nRuns, 1000, -1);
+    }
+    BOOST_CHECK_EQUAL(nRuns.load(), 1000);
+    BOOST_CHECK(queue.GetStats().nWorkers <= (unsigned int)CHECKQUEUE_TEST_THREADS);
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_failure)
+{
+    // A failing check fails the round, but not the next one
+    seed_insecure_rand(true);
+    CCheckQueue<CCountCheck> queue(16);
+    boost::thread_group threadGroup;
+    for (int i = 0; i < CHECKQUEUE_TEST_THREADS - 1; i++)
+        threadGroup.create_thread(boost::bind(&ThreadCountCheck, &queue));
+
+    for (int i = 0; i < 20; i++) {
+        std::atomic<int> nRuns(0);
+        CCheckQueueControl<CCountCheck> control(&queue);
+        bool fFail = i % 2 == 0;
+        AddChecks(control, nRuns, 1000, fFail ? insecure_rand() % 1000 : -1);
+        BOOST_CHECK_EQUAL(control.Wait(), !fFail);
+        BOOST_CHECK(nRuns <= 1000);
+        if (!fFail)
+            BOOST_CHECK_EQUAL(nRuns.load(), 1000);
+        BOOST_CHECK(queue.IsIdle());
+    }
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_no_workers)
+{
+    // The master does all the work itself if there are no worker threads
+    CCheckQueue<CCountCheck> queue(16);
+    std::atomic<int> nRuns(0);
+    CCheckQueueControl<CCountCheck> control(&queue);
+    AddChecks(control, nRuns, 500, -1);
+    BOOST_CHECK(control.Wait());
+    BOOST_CHECK_EQUAL(nRuns.load(), 500);
+    BOOST_CHECK_EQUAL(control.GetStats().nWorkers, 1U);
+    BOOST_CHECK_EQUAL(control.GetStats().nSteals, 0U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
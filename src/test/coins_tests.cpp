@@ -7,6 +7,7 @@
 #include "uint256.h"
 #include "test/test_digitslate.h"
 #include "main.h"
+#include "txdb.h"
 #include "consensus/validation.h"
 
 #include <vector>
@@ -75,7 +76,7 @@ public:
         // Manually recompute the dynamic usage of the whole data, and compare it.
         size_t ret = memusage::DynamicUsage(cacheCoins);
         for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end(); it++) {
-            ret += it->second.coins.DynamicMemoryUsage();
+            ret += it->second.DynamicMemoryUsage();
         }
         BOOST_CHECK_EQUAL(DynamicMemoryUsage(), ret);
     }
@@ -347,4 +348,190 @@ BOOST_AUTO_TEST_CASE(updatecoins_simulation_test)
     BOOST_CHECK(spent_a_duplicate_coinbase);
 }
 
+static CTransaction CoinsDBTx(unsigned int nOutputs)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    tx.vout.resize(nOutputs);
+    for (unsigned int i = 0; i < nOutputs; i++) {
+        tx.vout[i].nValue = 1000 * (i + 1);
+        tx.vout[i].scriptPubKey = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, i) << OP_EQUALVERIFY << OP_CHECKSIG;
+    }
+    return tx;
+}
+
+static size_t CountOutputRecords(const CCoinsViewDB& view)
+{
+    boost::scoped_ptr<CDBIterator> pcursor(const_cast<CDBWrapper&>(view.GetDB()).NewIterator());
+    size_t nRecords = 0;
+    for (pcursor->Seek('C'); pcursor->Valid(); pcursor->Next()) {
+        std::pair<char, COutPoint> key;
+        if (!pcursor->GetKey(key) || key.first != 'C')
+            break;
+        nRecords++;
+    }
+    return nRecords;
+}
+
+// Spending an output through a stack of caches only erases its own record in
+// the coin database.
+BOOST_AUTO_TEST_CASE(coins_db_per_output)
+{
+    CCoinsViewDB base(1 << 20, true);
+    CTransaction tx = CoinsDBTx(300);
+    {
+        CCoinsViewCache cache(&base);
+        cache.ModifyNewCoins(tx.GetHash())->FromTx(tx, 10);
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK_EQUAL(CountOutputRecords(base), 300);
+    BOOST_CHECK(base.HaveCoins(tx.GetHash()));
+    BOOST_CHECK(!base.HaveCoins(GetRandHash()));
+
+    {
+        CCoinsViewCache cache(&base);
+        CCoinsViewCache tip(&cache);
+        tip.ModifyCoins(tx.GetHash())->Spend(1);
+        tip.ModifyCoins(tx.GetHash())->Spend(256);
+        BOOST_CHECK(tip.Flush());
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK_EQUAL(CountOutputRecords(base), 298);
+
+    CCoins coins;
+    BOOST_CHECK(base.GetCoins(tx.GetHash(), coins));
+    BOOST_CHECK_EQUAL(coins.nHeight, 10);
+    BOOST_CHECK_EQUAL(coins.vout.size(), 300);
+    for (unsigned int i = 0; i < 300; i++) {
+        BOOST_CHECK_EQUAL(coins.IsAvailable(i), i != 1 && i != 256);
+        if (coins.IsAvailable(i))
+            BOOST_CHECK(coins.vout[i] == tx.vout[i]);
+    }
+
+    // Spending the last outputs removes the transaction
+    {
+        CCoinsViewCache cache(&base);
+        {
+            CCoinsModifier modifier = cache.ModifyCoins(tx.GetHash());
+            for (unsigned int i = 0; i < 300; i++)
+                modifier->Spend(i);
+        }
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK_EQUAL(CountOutputRecords(base), 0);
+    BOOST_CHECK(!base.GetCoins(tx.GetHash(), coins));
+    BOOST_CHECK(!base.HaveCoins(tx.GetHash()));
+}
+
+// Databases with one record per transaction are converted without changing
+// the UTXO set hash.
+BOOST_AUTO_TEST_CASE(coins_db_upgrade)
+{
+    CCoinsViewDB base(1 << 20, true);
+    CDBWrapper& db = const_cast<CDBWrapper&>(base.GetDB());
+    std::vector<CTransaction> vTx;
+    for (int i = 0; i < 20; i++) {
+        vTx.push_back(CoinsDBTx(1 + i % 4));
+        CCoins coins(vTx.back(), i);
+        if (i % 4 == 3)
+            coins.Spend(1);
+        BOOST_CHECK(db.Write(std::make_pair('c', vTx.back().GetHash()), coins));
+    }
+    uint256 hashBlock = GetRandHash();
+    BOOST_CHECK(db.Write('B', hashBlock));
+
+    BOOST_CHECK_EQUAL(base.GetFormatVersion(), 0);
+    BOOST_CHECK(base.Upgrade());
+    BOOST_CHECK_EQUAL(base.GetFormatVersion(), COINS_DB_VERSION);
+    BOOST_CHECK_EQUAL(CountOutputRecords(base), 5 * (1 + 2 + 3 + 3));
+    BOOST_CHECK(base.Upgrade());
+
+    CCoinsStats stats;
+    BOOST_CHECK(base.GetStats(stats));
+    BOOST_CHECK(stats.hashBlock == hashBlock);
+    BOOST_CHECK_EQUAL(stats.nTransactions, 20);
+    BOOST_CHECK_EQUAL(stats.nTransactionOutputs, 5 * (1 + 2 + 3 + 3));
+
+    // The same set written through a cache hashes the same
+    CCoinsViewDB fresh(1 << 20, true);
+    {
+        CCoinsViewCache cache(&fresh);
+        for (int i = 0; i < 20; i++) {
+            CCoinsModifier coins = cache.ModifyNewCoins(vTx[i].GetHash());
+            coins->FromTx(vTx[i], i);
+            if (i % 4 == 3)
+                coins->Spend(1);
+        }
+        cache.SetBestBlock(hashBlock);
+        BOOST_CHECK(cache.Flush());
+    }
+    CCoinsStats statsFresh;
+    BOOST_CHECK(fresh.GetStats(statsFresh));
+    BOOST_CHECK(statsFresh.hashSerialized == stats.hashSerialized);
+    BOOST_CHECK_EQUAL(statsFresh.nTotalAmount, stats.nTotalAmount);
+
+    for (int i = 0; i < 20; i++) {
+        CCoins coins;
+        BOOST_CHECK(base.GetCoins(vTx[i].GetHash(), coins));
+        BOOST_CHECK_EQUAL(coins.nHeight, i);
+        BOOST_CHECK_EQUAL(coins.IsAvailable(1), vTx[i].vout.size() > 1 && i % 4 != 3);
+    }
+
+    // A database written by a newer format is left alone
+    BOOST_CHECK(db.Write('V', COINS_DB_VERSION + 1));
+    BOOST_CHECK(!base.Upgrade());
+    BOOST_CHECK_EQUAL(base.GetFormatVersion(), COINS_DB_VERSION + 1);
+}
+
+// With the writer thread, flushed coins can be read back before and after
+// they are written, and the next flush waits for the previous one.
+BOOST_AUTO_TEST_CASE(coins_db_writer)
+{
+    CCoinsViewDB base(1 << 20, true);
+    base.StartWriter();
+    BOOST_CHECK(base.HasWriter());
+
+    std::vector<CTransaction> vTx;
+    uint256 hashBlock;
+    for (int nFlush = 0; nFlush < 10; nFlush++) {
+        CCoinsViewCache cache(&base);
+        for (int i = 0; i < 50; i++) {
+            vTx.push_back(CoinsDBTx(1 + i % 3));
+            cache.ModifyNewCoins(vTx.back().GetHash())->FromTx(vTx.back(), nFlush);
+        }
+        // Spend an output of a transaction of the previous flush, which may still be being written
+        if (nFlush > 0)
+            cache.ModifyCoins(vTx[(nFlush - 1) * 50].GetHash())->Spend(0);
+        hashBlock = GetRandHash();
+        cache.SetBestBlock(hashBlock);
+        BOOST_CHECK(cache.Flush());
+        BOOST_CHECK(cache.GetCacheSize() == 0);
+        BOOST_CHECK(base.GetBestBlock() == hashBlock);
+        BOOST_CHECK(base.HaveCoins(vTx.back().GetHash()));
+        if (nFlush > 0)
+            BOOST_CHECK(!base.HaveCoins(vTx[(nFlush - 1) * 50].GetHash()));
+    }
+    BOOST_CHECK(base.WaitForWrites());
+    BOOST_CHECK(!base.WriteFailed());
+
+    CCoinsWriterStats stats = base.GetWriterStats();
+    BOOST_CHECK_EQUAL(stats.nWrites, 10);
+    BOOST_CHECK(!stats.fPending);
+
+    BOOST_CHECK(base.GetBestBlock() == hashBlock);
+    for (unsigned int i = 0; i < vTx.size(); i++) {
+        CCoins coins;
+        bool fSpent = i % 50 == 0 && i < 9 * 50;
+        BOOST_CHECK_EQUAL(base.GetCoins(vTx[i].GetHash(), coins), !fSpent);
+        if (!fSpent) {
+            BOOST_CHECK_EQUAL(coins.nHeight, i / 50);
+            BOOST_CHECK(coins.vout == vTx[i].vout);
+        }
+    }
+    CCoinsStats coinsStats;
+    BOOST_CHECK(base.GetStats(coinsStats));
+    BOOST_CHECK_EQUAL(coinsStats.nTransactions, vTx.size() - 9);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -8,6 +8,7 @@
 #include "crypto/sha512.h"
 #include "crypto/hmac_sha256.h"
 #include "crypto/hmac_sha512.h"
+#include "crypto/neoscrypt.h"
 #include "random.h"
 #include "utilstrencodings.h"
 #include "test/test_digitslate.h"
@@ -248,4 +249,28 @@ BOOST_AUTO_TEST_CASE(hmac_sha512_testvectors) {
                    "b6022cac3c4982b10d5eeb55c3e4de15134676fb6de0446065c97440fa8c6a58");
 }
 
+BOOST_AUTO_TEST_CASE(neoscrypt_4way_nonces_matches_single) {
+    unsigned char header[80];
+    for (int i = 0; i < 80; i++)
+        header[i] = (unsigned char)(i * 7 + 3);
+
+    unsigned char hash[32];
+    neoscrypt(header, hash, 0);
+    BOOST_CHECK_EQUAL(HexStr(hash, hash + 32), "4967121d009c05807811a33690da50a93722dedb440f58c1d600933ede9133c6");
+
+    std::vector<unsigned char> scratchpad(NEOSCRYPT_4WAY_SCRATCHPAD_SIZE + 63);
+    unsigned char* aligned = (unsigned char*)(((size_t)&scratchpad[0] + 63) & ~(size_t)63);
+    unsigned char hashes[4 * 32];
+    neoscrypt_4way_nonces(header, hashes, aligned);
+
+    uint32_t nonce;
+    memcpy(&nonce, header + 76, 4);
+    for (int k = 0; k < 4; k++) {
+        uint32_t n = nonce + k;
+        memcpy(header + 76, &n, 4);
+        neoscrypt(header, hash, 0);
+        BOOST_CHECK(memcmp(hash, hashes + 32 * k, 32) == 0);
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
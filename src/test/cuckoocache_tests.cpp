@@ -0,0 +1,133 @@
+// Copyright (c) 2017 The DigitSlate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "cuckoocache.h"
+#include "random.h"
+#include "script/sigcache.h"
+#include "uint256.h"
+
+#include "test/test_digitslate.h"
+
+#include <boost/test/unit_test.hpp>
+#include <vector>
+
+typedef CuckooCache::cache<uint256, CSignatureCacheHasher> sigcache_type;
+
+static uint256 InsecureHash()
+{
+    uint256 hash;
+    for (int i = 0; i < 8; i++) {
+        uint32_t n = insecure_rand();
+        memcpy(hash.begin() + 4 * i, &n, 4);
+    }
+    return hash;
+}
+
+static std::vector<uint256> InsecureHashes(size_t n)
+{
+    std::vector<uint256> hashes;
+    hashes.reserve(n);
+    for (size_t i = 0; i < n; i++)
+        hashes.push_back(InsecureHash());
+    return hashes;
+}
+
+static double HitRate(const sigcache_type& cache, const std::vector<uint256>& hashes, size_t nBegin, size_t nEnd)
+{
+    size_t nHits = 0;
+    for (size_t i = nBegin; i < nEnd; i++)
+        nHits += cache.contains(hashes[i], false);
+    return (double)nHits / (nEnd - nBegin);
+}
+
+BOOST_FIXTURE_TEST_SUITE(cuckoocache_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(cuckoocache_empty)
+{
+    // Before setup nothing is stored
+    sigcache_type cache;
+    uint256 hash = InsecureHash();
+    cache.insert(hash);
+    BOOST_CHECK(!cache.contains(hash, false));
+
+    BOOST_CHECK_EQUAL(cache.setup(0), 2u);
+    BOOST_CHECK_EQUAL(cache.setup_bytes(1 << 20), (1 << 20) / sizeof(uint256));
+}
+
+BOOST_AUTO_TEST_CASE(cuckoocache_no_fakes)
+{
+    seed_insecure_rand(true);
+    sigcache_type cache;
+    cache.setup_bytes(1 << 20);
+    const size_t nSize = (1 << 20) / sizeof(uint256);
+    std::vector<uint256> hashes = InsecureHashes(2 * nSize);
+    for (size_t i = 0; i < nSize; i++)
+        cache.insert(hashes[i]);
+    for (size_t i = nSize; i < 2 * nSize; i++)
+        BOOST_CHECK(!cache.contains(hashes[i], false));
+}
+
+BOOST_AUTO_TEST_CASE(cuckoocache_hit_rate)
+{
+    // Up to the point where the oldest generation becomes collectible nothing
+    // but the rare entry dropped after depth_limit moves may be missing
+    seed_insecure_rand(true);
+    sigcache_type cache;
+    const size_t nSize = cache.setup(1 << 16);
+    const size_t nInserts = nSize * 9 / 10;
+    std::vector<uint256> hashes = InsecureHashes(nInserts);
+    for (size_t i = 0; i < nInserts; i++)
+        cache.insert(hashes[i]);
+    BOOST_CHECK(HitRate(cache, hashes, 0, nInserts) > 0.99);
+
+    // Inserting the same entries again just refreshes them
+    for (size_t i = 0; i < nInserts; i++)
+        cache.insert(hashes[i]);
+    BOOST_CHECK(HitRate(cache, hashes, 0, nInserts) > 0.99);
+}
+
+BOOST_AUTO_TEST_CASE(cuckoocache_generations)
+{
+    // After many times its size, the entries of the last two generations must
+    // still be there, while old entries have made room for them
+    seed_insecure_rand(true);
+    sigcache_type cache;
+    const size_t nSize = cache.setup(1 << 16);
+    const size_t nInserts = 4 * nSize;
+    std::vector<uint256> hashes = InsecureHashes(nInserts);
+    for (size_t i = 0; i < nInserts; i++)
+        cache.insert(hashes[i]);
+    BOOST_CHECK(HitRate(cache, hashes, nInserts - nSize * 4 / 10, nInserts) > 0.95);
+    BOOST_CHECK(HitRate(cache, hashes, 0, nSize) < 0.05);
+}
+
+BOOST_AUTO_TEST_CASE(cuckoocache_erase)
+{
+    // Erased entries stay visible until their slots are reused. Both rounds
+    // stay below the point where a new generation begins, so without erasing
+    // every entry of the first round would survive the second one.
+    seed_insecure_rand(true);
+    const size_t nSize = 1 << 16;
+    const size_t nRound = nSize * 4 / 10;
+    std::vector<uint256> hashes = InsecureHashes(2 * nRound);
+    for (int fErase = 0; fErase < 2; fErase++) {
+        sigcache_type cache;
+        cache.setup(nSize);
+        for (size_t i = 0; i < nRound; i++)
+            cache.insert(hashes[i]);
+        for (size_t i = 0; i < nRound; i++)
+            BOOST_CHECK(cache.contains(hashes[i], fErase));
+        BOOST_CHECK(HitRate(cache, hashes, 0, nRound) == 1.0);
+
+        for (size_t i = nRound; i < 2 * nRound; i++)
+            cache.insert(hashes[i]);
+        BOOST_CHECK(HitRate(cache, hashes, nRound, 2 * nRound) > 0.99);
+        if (fErase)
+            BOOST_CHECK(HitRate(cache, hashes, 0, nRound) < 0.9);
+        else
+            BOOST_CHECK(HitRate(cache, hashes, 0, nRound) > 0.99);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
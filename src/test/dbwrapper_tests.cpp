@@ -126,6 +126,35 @@ BOOST_AUTO_TEST_CASE(dbwrapper_iterator)
     }
 }
 
+// Test non-default LevelDB settings and the properties used by getdbstats
+BOOST_AUTO_TEST_CASE(dbwrapper_options)
+{
+    path ph = temp_directory_path() / unique_path();
+    CDBOptions dbOptions(1 << 20);
+    dbOptions.nBlockSize = 1 << 10;
+    dbOptions.fCompression = true;
+    CDBWrapper dbw(ph, dbOptions, true);
+
+    for (int i = 0; i < 1000; i++)
+        BOOST_CHECK(dbw.Write(std::make_pair('o', i), uint256S(strprintf("%x", i))));
+    for (int i = 0; i < 1000; i++) {
+        uint256 res;
+        BOOST_CHECK(dbw.Read(std::make_pair('o', i), res));
+        BOOST_CHECK_EQUAL(res.ToString(), uint256S(strprintf("%x", i)).ToString());
+    }
+    BOOST_CHECK(!dbw.Exists(std::make_pair('o', 1000)));
+
+    std::string strValue;
+    BOOST_CHECK(dbw.GetProperty("leveldb.approximate-memory-usage", strValue));
+    BOOST_CHECK(atoi64(strValue) > 0);
+    BOOST_CHECK(dbw.GetProperty("leveldb.num-files-at-level0", strValue));
+    BOOST_CHECK_EQUAL(strValue, "0");
+    BOOST_CHECK(dbw.GetProperty("leveldb.num-files-at-level6", strValue));
+    BOOST_CHECK(!dbw.GetProperty("leveldb.num-files-at-level7", strValue));
+    BOOST_CHECK(dbw.GetProperty("leveldb.stats", strValue));
+    BOOST_CHECK(!dbw.GetProperty("leveldb.nonexistent", strValue));
+}
+
 // Test that we do not obfuscation if there is existing data.
 BOOST_AUTO_TEST_CASE(existing_data_no_obfuscate)
 {
@@ -0,0 +1,143 @@
+// Copyright (c) 2017 The DigitSlate developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "flatmap.h"
+#include "random.h"
+
+#include "test/test_digitslate.h"
+
+#include <boost/test/unit_test.hpp>
+#include <map>
+#include <string>
+
+BOOST_FIXTURE_TEST_SUITE(flatmap_tests, BasicTestingSetup)
+
+/** Hashes keys into few distinct values, so that probe sequences get long and overlap */
+struct WeakHasher
+{
+    size_t operator()(uint32_t n) const { return (size_t)(n % 7) * 0x9e3779b97f4a7c15ULL; }
+};
+
+struct MixHasher
+{
+    size_t operator()(uint32_t n) const { return (size_t)n * 0x9e3779b97f4a7c15ULL; }
+};
+
+template <typename Hasher>
+static void CheckEqual(const flatmap<uint32_t, std::string, Hasher>& map, const std::map<uint32_t, std::string>& real)
+{
+    BOOST_CHECK_EQUAL(map.size(), real.size());
+    BOOST_CHECK_EQUAL(map.empty(), real.empty());
+    size_t nIterated = 0;
+    for (typename flatmap<uint32_t, std::string, Hasher>::const_iterator it = map.begin(); it != map.end(); ++it) {
+        std::map<uint32_t, std::string>::const_iterator itReal = real.find(it->first);
+        BOOST_CHECK(itReal != real.end() && itReal->second == it->second);
+        nIterated++;
+    }
+    BOOST_CHECK_EQUAL(nIterated, real.size());
+    for (std::map<uint32_t, std::string>::const_iterator it = real.begin(); it != real.end(); ++it) {
+        BOOST_CHECK(map.find(it->first) != map.end());
+        BOOST_CHECK_EQUAL(map.count(it->first), 1);
+    }
+}
+
+template <typename Hasher>
+static void RandomOperations(uint32_t nKeys)
+{
+    flatmap<uint32_t, std::string, Hasher> map;
+    std::map<uint32_t, std::string> real;
+    for (int round = 0; round < 20000; round++) {
+        uint32_t key = insecure_rand() % nKeys;
+        switch (insecure_rand() % 6) {
+        case 0:
+        case 1: {
+            std::string value = std::to_string(insecure_rand());
+            bool fInserted = map.insert(std::make_pair(key, value)).second;
+            BOOST_CHECK_EQUAL(fInserted, real.insert(std::make_pair(key, value)).second);
+            break;
+        }
+        case 2:
+            map[key] += "x";
+            real[key] += "x";
+            break;
+        case 3:
+            BOOST_CHECK_EQUAL(map.erase(key), real.erase(key));
+            break;
+        case 4: {
+            typename flatmap<uint32_t, std::string, Hasher>::iterator it = map.find(key);
+            BOOST_CHECK_EQUAL(it != map.end(), real.count(key) == 1);
+            if (it != map.end()) {
+                BOOST_CHECK_EQUAL(it->first, key);
+                BOOST_CHECK(it->second == real[key]);
+            }
+            break;
+        }
+        case 5:
+            if (insecure_rand() % 100 == 0) {
+                // Erase every other entry while iterating, as CCoinsViewCache does when flushing
+                bool fErase = false;
+                for (typename flatmap<uint32_t, std::string, Hasher>::iterator it = map.begin(); it != map.end(); ) {
+                    if (fErase) {
+                        real.erase(it->first);
+                        map.erase(it++);
+                    } else {
+                        ++it;
+                    }
+                    fErase = !fErase;
+                }
+            }
+            break;
+        }
+    }
+    CheckEqual(map, real);
+    map.clear();
+    BOOST_CHECK(map.empty());
+    BOOST_CHECK_EQUAL(map.bucket_count(), 0);
+    BOOST_CHECK(map.begin() == map.end());
+}
+
+BOOST_AUTO_TEST_CASE(flatmap_random)
+{
+    RandomOperations<MixHasher>(100);
+    RandomOperations<MixHasher>(5000);
+    RandomOperations<WeakHasher>(300);
+}
+
+BOOST_AUTO_TEST_CASE(flatmap_stable_entries)
+{
+    flatmap<uint32_t, std::string, MixHasher> map;
+    std::vector<std::string*> vEntries;
+    for (uint32_t i = 0; i < 10000; i++)
+        vEntries.push_back(&map[i]);
+    // Erasing and growing moves slots, but not the entries themselves
+    for (uint32_t i = 0; i < 10000; i += 2)
+        map.erase(i);
+    for (uint32_t i = 10000; i < 30000; i++)
+        map[i] = "new";
+    for (uint32_t i = 1; i < 10000; i += 2)
+        BOOST_CHECK(&map.find(i)->second == vEntries[i]);
+    BOOST_CHECK_EQUAL(map.size(), 25000);
+}
+
+BOOST_AUTO_TEST_CASE(flatmap_memory)
+{
+    flatmap<uint32_t, uint32_t, MixHasher> map;
+    BOOST_CHECK_EQUAL(map.allocated_usage([](size_t n) { return n; }), 0);
+    for (uint32_t i = 0; i < 1000; i++)
+        map[i] = i;
+    size_t nUsage = map.allocated_usage([](size_t n) { return n; });
+    BOOST_CHECK(nUsage >= 1000 * (sizeof(std::pair<const uint32_t, uint32_t>) + sizeof(void*) + 1));
+    BOOST_CHECK(map.bucket_count() >= 1000 * 4 / 3);
+    // Erased entries are reused, so churn does not grow the map
+    for (uint32_t i = 0; i < 100000; i++) {
+        map.erase(i);
+        map[i + 1000] = i;
+    }
+    BOOST_CHECK_EQUAL(map.size(), 1000);
+    BOOST_CHECK_EQUAL(map.allocated_usage([](size_t n) { return n; }), nUsage);
+    map.clear();
+    BOOST_CHECK_EQUAL(map.allocated_usage([](size_t n) { return n; }), 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
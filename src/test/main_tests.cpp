@@ -3,8 +3,10 @@
 // Copyright (c) 2014-2017 The DigitSlate developers
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "arith_uint256.h"
 #include "chainparams.h"
 #include "main.h"
+#include "txdb.h"
 
 #include "test/test_digitslate.h"
 
@@ -78,4 +80,294 @@ BOOST_AUTO_TEST_CASE(test_combiner_all)
     Test.disconnect(&ReturnTrue);
     BOOST_CHECK(Test());
 }
+
+BOOST_AUTO_TEST_CASE(read_raw_block_from_disk)
+{
+    const CChainParams& chainparams = Params();
+    CBlockIndex* pindexGenesis = chainActive.Genesis();
+    BOOST_REQUIRE(pindexGenesis != NULL);
+
+    CDataStream ssRaw(SER_NETWORK, PROTOCOL_VERSION);
+    BOOST_CHECK(ReadRawBlockFromDisk(ssRaw, pindexGenesis, chainparams.MessageStart()));
+
+    CDataStream ssExpected(SER_NETWORK, PROTOCOL_VERSION);
+    ssExpected << chainparams.GenesisBlock();
+    BOOST_CHECK(ssRaw.str() == ssExpected.str());
+
+    CBlock block;
+    ssRaw >> block;
+    BOOST_CHECK(block.GetHash() == chainparams.GenesisBlock().GetHash());
+
+    // a wrong message start must be rejected
+    CMessageHeader::MessageStartChars wrongStart = {0, 0, 0, 0};
+    BOOST_CHECK(!ReadRawBlockFromDisk(ssRaw, pindexGenesis, wrongStart));
+}
+BOOST_AUTO_TEST_CASE(address_balance_index)
+{
+    CIndexDB db(CDBOptions(1 << 20), true);
+    uint160 addr1(std::vector<unsigned char>(20, 0x01));
+    uint160 addr2(std::vector<unsigned char>(20, 0x02));
+    uint256 txid1 = uint256S("01");
+    uint256 txid2 = uint256S("02");
+    uint256 hash1 = uint256S("b1");
+    uint256 hash2 = uint256S("b2");
+
+    // block 1: two outputs of txid1 to addr1, one to addr2
+    std::vector<std::pair<CAddressIndexKey, CAmount> > block1;
+    block1.push_back(std::make_pair(CAddressIndexKey(1, addr1, 1, 0, txid1, 0, false), 50));
+    block1.push_back(std::make_pair(CAddressIndexKey(1, addr1, 1, 0, txid1, 1, false), 25));
+    block1.push_back(std::make_pair(CAddressIndexKey(1, addr2, 1, 0, txid1, 2, false), 10));
+    BOOST_CHECK(db.WriteAddressIndex(block1, hash1));
+
+    // block 2: txid2 spends one addr1 output and pays 30 back to it
+    std::vector<std::pair<CAddressIndexKey, CAmount> > block2;
+    block2.push_back(std::make_pair(CAddressIndexKey(1, addr1, 2, 1, txid2, 0, true), -50));
+    block2.push_back(std::make_pair(CAddressIndexKey(1, addr1, 2, 1, txid2, 0, false), 30));
+    BOOST_CHECK(db.WriteAddressIndex(block2, hash2));
+    // replaying the last block after an unclean shutdown leaves the balances alone
+    BOOST_CHECK(db.WriteAddressIndex(block2, hash2));
+
+    CAddressBalanceValue balance;
+    BOOST_CHECK(db.ReadAddressBalance(addr1, 1, balance));
+    BOOST_CHECK_EQUAL(balance.balance, 55);
+    BOOST_CHECK_EQUAL(balance.received, 105);
+    BOOST_CHECK_EQUAL(balance.txCount, 2U);
+    BOOST_CHECK(db.ReadAddressBalance(addr2, 1, balance));
+    BOOST_CHECK_EQUAL(balance.balance, 10);
+    BOOST_CHECK_EQUAL(balance.txCount, 1U);
+    BOOST_CHECK(db.ReadAddressBalance(addr1, 2, balance));
+    BOOST_CHECK(balance.IsNull());
+
+    // rebuilding from the deltas gives the same records
+    BOOST_CHECK(db.BuildAddressBalanceIndex());
+    BOOST_CHECK(db.ReadAddressBalance(addr1, 1, balance));
+    BOOST_CHECK_EQUAL(balance.balance, 55);
+    BOOST_CHECK_EQUAL(balance.received, 105);
+    BOOST_CHECK_EQUAL(balance.txCount, 2U);
+
+    // disconnecting both blocks removes the records again
+    BOOST_CHECK(db.EraseAddressIndex(block2, hash2));
+    BOOST_CHECK(db.EraseAddressIndex(block2, hash2));
+    BOOST_CHECK(db.ReadAddressBalance(addr1, 1, balance));
+    BOOST_CHECK_EQUAL(balance.balance, 75);
+    BOOST_CHECK_EQUAL(balance.txCount, 1U);
+    BOOST_CHECK(db.EraseAddressIndex(block1, hash1));
+    BOOST_CHECK(db.ReadAddressBalance(addr1, 1, balance));
+    BOOST_CHECK(balance.IsNull());
+    BOOST_CHECK(db.ReadAddressBalance(addr2, 1, balance));
+    BOOST_CHECK(balance.IsNull());
+}
+
+// After an unclean shutdown the coin database may be many blocks behind the
+// index database, so several blocks are connected again.
+BOOST_AUTO_TEST_CASE(address_balance_index_replay)
+{
+    CIndexDB db(CDBOptions(1 << 20), true);
+    uint160 addr(std::vector<unsigned char>(20, 0x01));
+    std::vector<std::vector<std::pair<CAddressIndexKey, CAmount> > > blocks(5);
+    std::vector<uint256> hashes;
+    for (int i = 0; i < 5; i++) {
+        blocks[i].push_back(std::make_pair(CAddressIndexKey(1, addr, i + 1, 0, ArithToUint256(arith_uint256(i + 1)), 0, false), 10));
+        hashes.push_back(ArithToUint256(arith_uint256(0xb0 + i)));
+        BOOST_CHECK(db.WriteAddressIndex(blocks[i], hashes[i]));
+    }
+
+    // blocks 2 to 5 again, as if the coin database was at block 1
+    for (int i = 1; i < 5; i++)
+        BOOST_CHECK(db.WriteAddressIndex(blocks[i], hashes[i]));
+    CAddressBalanceValue balance;
+    BOOST_CHECK(db.ReadAddressBalance(addr, 1, balance));
+    BOOST_CHECK_EQUAL(balance.balance, 50);
+    BOOST_CHECK_EQUAL(balance.txCount, 5U);
+
+    // a reorg that was interrupted after disconnecting blocks 5 and 4 disconnects them again
+    BOOST_CHECK(db.EraseAddressIndex(blocks[4], hashes[4]));
+    BOOST_CHECK(db.EraseAddressIndex(blocks[3], hashes[3]));
+    BOOST_CHECK(db.EraseAddressIndex(blocks[4], hashes[4]));
+    BOOST_CHECK(db.EraseAddressIndex(blocks[3], hashes[3]));
+    BOOST_CHECK(db.ReadAddressBalance(addr, 1, balance));
+    BOOST_CHECK_EQUAL(balance.balance, 30);
+    BOOST_CHECK_EQUAL(balance.txCount, 3U);
+
+    // blocks written by the index builder are not added again by ConnectBlock
+    std::vector<uint256> built(1, hashes[3]);
+    BOOST_CHECK(db.WriteIndexBuildBatch(blocks[3], std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >(),
+                                        std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> >(),
+                                        std::vector<CTimestampIndexKey>(), built, false,
+                                        std::vector<std::pair<std::string, uint256> >()));
+    BOOST_CHECK(db.WriteAddressIndex(blocks[3], hashes[3]));
+    BOOST_CHECK(db.ReadAddressBalance(addr, 1, balance));
+    BOOST_CHECK_EQUAL(balance.balance, 40);
+    BOOST_CHECK_EQUAL(balance.txCount, 4U);
+}
+
+BOOST_AUTO_TEST_CASE(address_index_paging)
+{
+    CIndexDB db(CDBOptions(1 << 20), true);
+    uint160 addr0(std::vector<unsigned char>(20, 0x00));
+    uint160 addr1(std::vector<unsigned char>(20, 0x01));
+    uint160 addr2(std::vector<unsigned char>(20, 0x02));
+
+    // one delta per height for addr1, with neighbours on both sides in key order
+    std::vector<std::pair<CAddressIndexKey, CAmount> > deltas;
+    for (int i = 1; i <= 10; i++)
+        deltas.push_back(std::make_pair(CAddressIndexKey(1, addr1, i, 0, ArithToUint256(arith_uint256(i)), 0, false), i));
+    deltas.push_back(std::make_pair(CAddressIndexKey(1, addr0, 5, 1, uint256S("aa"), 0, false), 1));
+    deltas.push_back(std::make_pair(CAddressIndexKey(1, addr2, 5, 2, uint256S("bb"), 0, false), 1));
+    BOOST_CHECK(db.WriteAddressIndex(deltas, uint256S("b1")));
+
+    // ascending pages continue after the last key of the previous page
+    std::vector<std::pair<CAddressIndexKey, CAmount> > page;
+    BOOST_CHECK(db.ReadAddressIndex(addr1, 1, page, 0, 0, NULL, 4, false));
+    BOOST_CHECK_EQUAL(page.size(), 4U);
+    BOOST_CHECK_EQUAL(page.front().first.blockHeight, 1);
+    CAddressIndexKey cursor = page.back().first;
+    page.clear();
+    BOOST_CHECK(db.ReadAddressIndex(addr1, 1, page, 0, 0, &cursor, 4, false));
+    BOOST_CHECK_EQUAL(page.size(), 4U);
+    BOOST_CHECK_EQUAL(page.front().first.blockHeight, 5);
+    cursor = page.back().first;
+    page.clear();
+    BOOST_CHECK(db.ReadAddressIndex(addr1, 1, page, 0, 0, &cursor, 4, false));
+    BOOST_CHECK_EQUAL(page.size(), 2U);
+    BOOST_CHECK_EQUAL(page.back().first.blockHeight, 10);
+
+    // descending pages walk back from the tip and stop at the address
+    page.clear();
+    BOOST_CHECK(db.ReadAddressIndex(addr1, 1, page, 0, 0, NULL, 4, true));
+    BOOST_CHECK_EQUAL(page.size(), 4U);
+    BOOST_CHECK_EQUAL(page.front().first.blockHeight, 10);
+    BOOST_CHECK_EQUAL(page.back().first.blockHeight, 7);
+    cursor = page.back().first;
+    page.clear();
+    BOOST_CHECK(db.ReadAddressIndex(addr1, 1, page, 0, 0, &cursor, 0, true));
+    BOOST_CHECK_EQUAL(page.size(), 6U);
+    BOOST_CHECK_EQUAL(page.front().first.blockHeight, 6);
+    BOOST_CHECK_EQUAL(page.back().first.blockHeight, 1);
+
+    // height ranges apply in both directions
+    page.clear();
+    BOOST_CHECK(db.ReadAddressIndex(addr1, 1, page, 3, 6, NULL, 0, true));
+    BOOST_CHECK_EQUAL(page.size(), 4U);
+    BOOST_CHECK_EQUAL(page.front().first.blockHeight, 6);
+    BOOST_CHECK_EQUAL(page.back().first.blockHeight, 3);
+    page.clear();
+    BOOST_CHECK(db.ReadAddressIndex(addr2, 1, page, 0, 0, NULL, 0, true));
+    BOOST_CHECK_EQUAL(page.size(), 1U);
+
+    // unspent outputs page in key order
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > unspent;
+    for (int i = 1; i <= 3; i++)
+        unspent.push_back(std::make_pair(CAddressUnspentKey(1, addr1, ArithToUint256(arith_uint256(i)), 0),
+                                         CAddressUnspentValue(i, CScript(), i)));
+    BOOST_CHECK(db.UpdateAddressUnspentIndex(unspent));
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > outputs;
+    BOOST_CHECK(db.ReadAddressUnspentIndex(addr1, 1, outputs, NULL, 2));
+    BOOST_CHECK_EQUAL(outputs.size(), 2U);
+    CAddressUnspentKey unspentCursor = outputs.back().first;
+    outputs.clear();
+    BOOST_CHECK(db.ReadAddressUnspentIndex(addr1, 1, outputs, &unspentCursor, 2));
+    BOOST_CHECK_EQUAL(outputs.size(), 1U);
+    BOOST_CHECK(outputs[0].first.txhash != unspentCursor.txhash);
+}
+
+BOOST_AUTO_TEST_CASE(address_index_merge)
+{
+    CIndexDB db(CDBOptions(1 << 20), true);
+    uint160 addr1(std::vector<unsigned char>(20, 0x01));
+    uint160 addr2(std::vector<unsigned char>(20, 0x02));
+    uint256 txid[6];
+    for (int i = 0; i < 6; i++)
+        txid[i] = ArithToUint256(arith_uint256(i));
+
+    // txid[3] touches both addresses
+    std::vector<std::pair<CAddressIndexKey, CAmount> > deltas;
+    deltas.push_back(std::make_pair(CAddressIndexKey(1, addr1, 1, 0, txid[1], 0, false), 1));
+    deltas.push_back(std::make_pair(CAddressIndexKey(1, addr1, 3, 0, txid[3], 0, false), 3));
+    deltas.push_back(std::make_pair(CAddressIndexKey(1, addr1, 4, 1, txid[5], 0, false), 5));
+    deltas.push_back(std::make_pair(CAddressIndexKey(1, addr2, 2, 0, txid[2], 0, false), 2));
+    deltas.push_back(std::make_pair(CAddressIndexKey(1, addr2, 3, 0, txid[3], 1, false), 3));
+    deltas.push_back(std::make_pair(CAddressIndexKey(1, addr2, 4, 0, txid[4], 0, false), 4));
+    BOOST_CHECK(db.WriteAddressIndex(deltas, uint256S("b1")));
+
+    std::vector<std::pair<uint160, int> > addresses;
+    addresses.push_back(std::make_pair(addr1, 1));
+    addresses.push_back(std::make_pair(addr2, 1));
+    addresses.push_back(std::make_pair(addr1, 1));
+
+    // merged by height and position in the block, duplicate addresses read once
+    std::vector<std::pair<CAddressIndexKey, CAmount> > merged;
+    BOOST_CHECK(db.ReadAddressIndexes(addresses, merged));
+    BOOST_CHECK_EQUAL(merged.size(), 6U);
+    CAmount expected[] = {1, 2, 3, 3, 4, 5};
+    for (size_t i = 0; i < merged.size() && i < 6; i++)
+        BOOST_CHECK_EQUAL(merged[i].second, expected[i]);
+    BOOST_CHECK(merged[2].first.hashBytes == addr1);
+    BOOST_CHECK(merged[3].first.hashBytes == addr2);
+
+    // a page ending inside a block position continues with the next address
+    std::vector<std::pair<CAddressIndexKey, CAmount> > page;
+    BOOST_CHECK(db.ReadAddressIndexes(addresses, page, 0, 0, NULL, 3));
+    BOOST_CHECK_EQUAL(page.size(), 3U);
+    CAddressIndexKey cursor = page.back().first;
+    page.clear();
+    BOOST_CHECK(db.ReadAddressIndexes(addresses, page, 0, 0, &cursor, 3));
+    BOOST_CHECK_EQUAL(page.size(), 3U);
+    BOOST_CHECK(page[0].first.hashBytes == addr2 && page[0].second == 3);
+    BOOST_CHECK_EQUAL(page[2].second, 5);
+
+    // the same in descending order
+    page.clear();
+    BOOST_CHECK(db.ReadAddressIndexes(addresses, page, 0, 0, NULL, 3, true));
+    BOOST_CHECK_EQUAL(page.size(), 3U);
+    BOOST_CHECK_EQUAL(page[0].second, 5);
+    BOOST_CHECK(page[2].first.hashBytes == addr1 && page[2].second == 3);
+    cursor = page.back().first;
+    page.clear();
+    BOOST_CHECK(db.ReadAddressIndexes(addresses, page, 0, 0, &cursor, 0, true));
+    BOOST_CHECK_EQUAL(page.size(), 3U);
+    BOOST_CHECK(page[0].first.hashBytes == addr2 && page[0].second == 3);
+    BOOST_CHECK_EQUAL(page[2].second, 1);
+
+    // height ranges
+    page.clear();
+    BOOST_CHECK(db.ReadAddressIndexes(addresses, page, 2, 3));
+    BOOST_CHECK_EQUAL(page.size(), 3U);
+}
+
+BOOST_AUTO_TEST_CASE(index_db_move)
+{
+    CBlockTreeDB blocktree(1 << 20, true);
+    CIndexDB indexdb(CDBOptions(1 << 20), true);
+    uint160 addr(std::vector<unsigned char>(20, 0x01));
+    uint256 txid = uint256S("01");
+
+    // entries as older versions kept them in the block tree database
+    CDiskTxPos pos(CDiskBlockPos(1, 2), 3);
+    CAddressIndexKey key(1, addr, 10, 1, txid, 0, false);
+    BOOST_CHECK(blocktree.Write(std::make_pair('t', txid), pos));
+    BOOST_CHECK(blocktree.Write(std::make_pair('a', key), (CAmount)50));
+    BOOST_CHECK(blocktree.WriteFlag("addressindex", true));
+
+    BOOST_CHECK(indexdb.MoveFromBlockTree(blocktree));
+
+    CDiskTxPos posRead;
+    BOOST_CHECK(indexdb.ReadTxIndex(txid, posRead));
+    BOOST_CHECK(posRead.nFile == 1 && posRead.nPos == 2 && posRead.nTxOffset == 3);
+    std::vector<std::pair<CAddressIndexKey, CAmount> > entries;
+    BOOST_CHECK(indexdb.ReadAddressIndex(addr, 1, entries));
+    BOOST_CHECK_EQUAL(entries.size(), 1U);
+    BOOST_CHECK_EQUAL(entries[0].second, 50);
+
+    // the block tree keeps its own records only
+    BOOST_CHECK(!blocktree.Exists(std::make_pair('t', txid)));
+    BOOST_CHECK(!blocktree.Exists(std::make_pair('a', key)));
+    bool fFlag = false;
+    BOOST_CHECK(blocktree.ReadFlag("addressindex", fFlag) && fFlag);
+
+    // moving again finds nothing left to move
+    BOOST_CHECK(indexdb.MoveFromBlockTree(blocktree));
+    BOOST_CHECK(indexdb.ReadTxIndex(txid, posRead));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
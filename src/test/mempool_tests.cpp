@@ -317,6 +317,136 @@ BOOST_AUTO_TEST_CASE(MempoolIndexingTest)
     CheckSort<3>(pool, sortedOrder);
 }
 
+BOOST_AUTO_TEST_CASE(MempoolAncestorIndexingTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+    entry.hadNoDependencies = true;
+
+    /* 3rd highest fee */
+    CMutableTransaction tx1 = CMutableTransaction();
+    tx1.vout.resize(1);
+    tx1.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx1.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(tx1.GetHash(), entry.Fee(10000LL).Priority(10.0).FromTx(tx1));
+
+    /* highest fee */
+    CMutableTransaction tx2 = CMutableTransaction();
+    tx2.vout.resize(1);
+    tx2.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx2.vout[0].nValue = 2 * COIN;
+    pool.addUnchecked(tx2.GetHash(), entry.Fee(20000LL).Priority(9.0).FromTx(tx2));
+    uint64_t tx2Size = ::GetSerializeSize(tx2, SER_NETWORK, PROTOCOL_VERSION);
+
+    /* lowest fee */
+    CMutableTransaction tx3 = CMutableTransaction();
+    tx3.vout.resize(1);
+    tx3.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx3.vout[0].nValue = 5 * COIN;
+    pool.addUnchecked(tx3.GetHash(), entry.Fee(0LL).Priority(100.0).FromTx(tx3));
+
+    /* 2nd highest fee */
+    CMutableTransaction tx4 = CMutableTransaction();
+    tx4.vout.resize(1);
+    tx4.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx4.vout[0].nValue = 6 * COIN;
+    pool.addUnchecked(tx4.GetHash(), entry.Fee(15000LL).Priority(1.0).FromTx(tx4));
+
+    /* equal fee rate to tx1, but newer */
+    CMutableTransaction tx5 = CMutableTransaction();
+    tx5.vout.resize(1);
+    tx5.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx5.vout[0].nValue = 11 * COIN;
+    pool.addUnchecked(tx5.GetHash(), entry.Fee(10000LL).FromTx(tx5));
+    BOOST_CHECK_EQUAL(pool.size(), 5);
+
+    std::vector<std::string> sortedOrder;
+    sortedOrder.resize(5);
+    sortedOrder[0] = tx2.GetHash().ToString(); // 20000
+    sortedOrder[1] = tx4.GetHash().ToString(); // 15000
+    // tx1 and tx5 are both 10000
+    // Ties are broken by hash, not timestamp, so determine which
+    // hash comes first.
+    if (tx1.GetHash() < tx5.GetHash()) {
+        sortedOrder[2] = tx1.GetHash().ToString();
+        sortedOrder[3] = tx5.GetHash().ToString();
+    } else {
+        sortedOrder[2] = tx5.GetHash().ToString();
+        sortedOrder[3] = tx1.GetHash().ToString();
+    }
+    sortedOrder[4] = tx3.GetHash().ToString(); // 0
+
+    CheckSort<4>(pool, sortedOrder);
+
+    /* low fee parent with high fee child */
+    /* tx6 (0) -> tx7 (high) */
+    CMutableTransaction tx6 = CMutableTransaction();
+    tx6.vout.resize(1);
+    tx6.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx6.vout[0].nValue = 20 * COIN;
+    uint64_t tx6Size = ::GetSerializeSize(tx6, SER_NETWORK, PROTOCOL_VERSION);
+
+    pool.addUnchecked(tx6.GetHash(), entry.Fee(0LL).FromTx(tx6));
+    BOOST_CHECK_EQUAL(pool.size(), 6);
+    // Ties are broken by hash
+    if (tx3.GetHash() < tx6.GetHash())
+        sortedOrder.push_back(tx6.GetHash().ToString());
+    else
+        sortedOrder.insert(sortedOrder.end()-1, tx6.GetHash().ToString());
+
+    CheckSort<4>(pool, sortedOrder);
+
+    CMutableTransaction tx7 = CMutableTransaction();
+    tx7.vin.resize(1);
+    tx7.vin[0].prevout = COutPoint(tx6.GetHash(), 0);
+    tx7.vin[0].scriptSig = CScript() << OP_11;
+    tx7.vout.resize(1);
+    tx7.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx7.vout[0].nValue = 10 * COIN;
+    uint64_t tx7Size = ::GetSerializeSize(tx7, SER_NETWORK, PROTOCOL_VERSION);
+
+    /* set the fee to just below tx2's feerate when including ancestor */
+    CAmount fee = (20000/tx2Size)*(tx7Size + tx6Size) - 1;
+
+    entry.hadNoDependencies = false;
+    pool.addUnchecked(tx7.GetHash(), entry.Fee(fee).FromTx(tx7));
+    BOOST_CHECK_EQUAL(pool.size(), 7);
+    sortedOrder.insert(sortedOrder.begin()+1, tx7.GetHash().ToString());
+    CheckSort<4>(pool, sortedOrder);
+
+    CTxMemPool::txiter it7 = pool.mapTx.find(tx7.GetHash());
+    BOOST_CHECK_EQUAL(it7->GetCountWithAncestors(), 2U);
+    BOOST_CHECK_EQUAL(it7->GetSizeWithAncestors(), tx6Size + tx7Size);
+    BOOST_CHECK_EQUAL(it7->GetModFeesWithAncestors(), fee);
+    BOOST_CHECK_EQUAL(it7->GetSigOpCountWithAncestors(), 2U);
+
+    /* prioritising the parent raises the child's package */
+    pool.PrioritiseTransaction(tx6.GetHash(), tx6.GetHash().ToString(), 0, 10000);
+    BOOST_CHECK_EQUAL(it7->GetModFeesWithAncestors(), fee + 10000);
+    pool.PrioritiseTransaction(tx6.GetHash(), tx6.GetHash().ToString(), 0, -10000);
+    BOOST_CHECK_EQUAL(it7->GetModFeesWithAncestors(), fee);
+
+    /* after tx6 is mined, tx7 should move up in the sort */
+    std::vector<CTransaction> vtx;
+    vtx.push_back(tx6);
+    std::list<CTransaction> dummy;
+    pool.removeForBlock(vtx, 1, dummy, false);
+
+    sortedOrder.erase(sortedOrder.begin()+1);
+    // Ties are broken by hash
+    if (tx3.GetHash() < tx6.GetHash())
+        sortedOrder.pop_back();
+    else
+        sortedOrder.erase(sortedOrder.end()-2);
+    sortedOrder.insert(sortedOrder.begin(), tx7.GetHash().ToString());
+    CheckSort<4>(pool, sortedOrder);
+
+    BOOST_CHECK_EQUAL(it7->GetCountWithAncestors(), 1U);
+    BOOST_CHECK_EQUAL(it7->GetSizeWithAncestors(), tx7Size);
+    BOOST_CHECK_EQUAL(it7->GetModFeesWithAncestors(), fee);
+    BOOST_CHECK_EQUAL(it7->GetSigOpCountWithAncestors(), 1U);
+}
+
 
 BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
 {
@@ -473,4 +603,93 @@ BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
     SetMockTime(0);
 }
 
+static CAmount SumAddressDeltas(CTxMemPool& pool, const uint160& hash, size_t& nDeltas)
+{
+    std::vector<std::pair<uint160, int> > addresses;
+    addresses.push_back(std::make_pair(hash, 1));
+    std::vector<std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta> > results;
+    BOOST_CHECK(pool.getAddressIndex(addresses, results));
+    nDeltas = results.size();
+    CAmount nSum = 0;
+    for (size_t i = 0; i < results.size(); i++) {
+        nSum += results[i].second.amount;
+        if (i > 0)
+            BOOST_CHECK(CMempoolAddressDeltaKeyCompare()(results[i - 1].first, results[i].first));
+    }
+    return nSum;
+}
+
+BOOST_AUTO_TEST_CASE(MempoolAddressIndexTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+    uint160 hashA(std::vector<unsigned char>(20, 0xaa));
+    uint160 hashB(std::vector<unsigned char>(20, 0xbb));
+    CScript scriptA = CScript() << OP_DUP << OP_HASH160 << ToByteVector(hashA) << OP_EQUALVERIFY << OP_CHECKSIG;
+    CScript scriptB = CScript() << OP_DUP << OP_HASH160 << ToByteVector(hashB) << OP_EQUALVERIFY << OP_CHECKSIG;
+
+    // Three outputs to each address in the chain
+    CMutableTransaction txFund;
+    txFund.vin.resize(1);
+    txFund.vout.resize(6);
+    for (int i = 0; i < 6; i++) {
+        txFund.vout[i].scriptPubKey = i < 3 ? scriptA : scriptB;
+        txFund.vout[i].nValue = 1000;
+    }
+    CCoinsView base;
+    CCoinsViewCache view(&base);
+    view.ModifyCoins(txFund.GetHash())->FromTx(txFund, 1);
+
+    CMutableTransaction tx1, tx2, tx3;
+    tx1.vin.resize(1);
+    tx1.vin[0].prevout = COutPoint(txFund.GetHash(), 0);
+    tx1.vout.resize(2);
+    tx1.vout[0].scriptPubKey = scriptA;
+    tx1.vout[0].nValue = 400;
+    tx1.vout[1].scriptPubKey = scriptB;
+    tx1.vout[1].nValue = 500;
+    tx2.vin.resize(2);
+    tx2.vin[0].prevout = COutPoint(txFund.GetHash(), 1);
+    tx2.vin[1].prevout = COutPoint(txFund.GetHash(), 3);
+    tx2.vout.resize(2);
+    tx2.vout[0].scriptPubKey = scriptA;
+    tx2.vout[0].nValue = 700;
+    tx2.vout[1].scriptPubKey = scriptA;
+    tx2.vout[1].nValue = 800;
+    tx3.vin.resize(1);
+    tx3.vin[0].prevout = COutPoint(txFund.GetHash(), 2);
+    tx3.vout.resize(1);
+    tx3.vout[0].scriptPubKey = scriptB;
+    tx3.vout[0].nValue = 900;
+
+    pool.addAddressIndex(entry.FromTx(tx1), view);
+    pool.addAddressIndex(entry.FromTx(tx2), view);
+    pool.addAddressIndex(entry.FromTx(tx3), view);
+
+    size_t nDeltas;
+    BOOST_CHECK_EQUAL(SumAddressDeltas(pool, hashA, nDeltas), -1100);
+    BOOST_CHECK_EQUAL(nDeltas, 6U);
+    BOOST_CHECK_EQUAL(SumAddressDeltas(pool, hashB, nDeltas), 400);
+    BOOST_CHECK_EQUAL(nDeltas, 3U);
+
+    // Removing from the front of the buckets moves later deltas around
+    pool.removeAddressIndex(tx1.GetHash());
+    BOOST_CHECK_EQUAL(SumAddressDeltas(pool, hashA, nDeltas), -500);
+    BOOST_CHECK_EQUAL(nDeltas, 4U);
+    BOOST_CHECK_EQUAL(SumAddressDeltas(pool, hashB, nDeltas), -100);
+    BOOST_CHECK_EQUAL(nDeltas, 2U);
+
+    pool.removeAddressIndex(tx2.GetHash());
+    BOOST_CHECK_EQUAL(SumAddressDeltas(pool, hashA, nDeltas), -1000);
+    BOOST_CHECK_EQUAL(nDeltas, 1U);
+    BOOST_CHECK_EQUAL(SumAddressDeltas(pool, hashB, nDeltas), 900);
+    BOOST_CHECK_EQUAL(nDeltas, 1U);
+
+    pool.removeAddressIndex(tx3.GetHash());
+    BOOST_CHECK_EQUAL(SumAddressDeltas(pool, hashA, nDeltas), 0);
+    BOOST_CHECK_EQUAL(nDeltas, 0U);
+    BOOST_CHECK_EQUAL(SumAddressDeltas(pool, hashB, nDeltas), 0);
+    BOOST_CHECK_EQUAL(nDeltas, 0U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -11,6 +11,7 @@
 #include "masternode-payments.h"
 #include "miner.h"
 #include "pubkey.h"
+#include "random.h"
 #include "script/standard.h"
 #include "txmempool.h"
 #include "uint256.h"
@@ -390,4 +391,165 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     fCheckpointsEnabled = true;
 }
 
+static CMutableTransaction RandomTx(const uint256& hashPrev, unsigned int nOut)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(hashPrev, nOut);
+    tx.vin[0].scriptSig = CScript() << OP_1;
+    tx.vout.resize(2);
+    for (int i = 0; i < 2; i++) {
+        tx.vout[i].scriptPubKey = CScript() << OP_1;
+        tx.vout[i].nValue = insecure_rand();
+    }
+    return tx;
+}
+
+static std::vector<uint256> SelectedHashes(const CBlockTemplateBuilder& builder)
+{
+    std::vector<uint256> vHashes;
+    BOOST_FOREACH(CTxMemPool::txiter it, builder.GetSelected())
+        vHashes.push_back(it->GetTx().GetHash());
+    return vHashes;
+}
+
+BOOST_AUTO_TEST_CASE(BlockTemplateBuilder_packages)
+{
+    CTxMemPool pool(CFeeRate(0));
+    LOCK(pool.cs);
+    TestMemPoolEntryHelper entry;
+    CBlockTemplateLimits limits;
+    limits.nBlockPrioritySize = 0;
+
+    // A low fee parent with a high fee child goes before a transaction with
+    // a fee rate between the parent's and the package's
+    CMutableTransaction txParent = RandomTx(GetRandHash(), 0);
+    pool.addUnchecked(txParent.GetHash(), entry.Fee(0).Time(GetTime()).FromTx(txParent));
+    CMutableTransaction txChild = RandomTx(txParent.GetHash(), 0);
+    pool.addUnchecked(txChild.GetHash(), entry.Fee(1000000).Time(GetTime()).FromTx(txChild));
+    CMutableTransaction txMedium = RandomTx(GetRandHash(), 0);
+    pool.addUnchecked(txMedium.GetHash(), entry.Fee(400000).Time(GetTime()).FromTx(txMedium));
+
+    CBlockTemplateBuilder builder(pool);
+    BOOST_CHECK_EQUAL(builder.Select(uint256(), 1, 0, limits), 0U);
+    std::vector<uint256> vHashes = SelectedHashes(builder);
+    BOOST_CHECK_EQUAL(vHashes.size(), 3U);
+    BOOST_CHECK(vHashes[0] == txParent.GetHash());
+    BOOST_CHECK(vHashes[1] == txChild.GetHash());
+    BOOST_CHECK(vHashes[2] == txMedium.GetHash());
+    builder.SetValid();
+
+    // A new transaction with a lower fee rate is only appended
+    CMutableTransaction txLow = RandomTx(GetRandHash(), 0);
+    pool.addUnchecked(txLow.GetHash(), entry.Fee(100000).Time(GetTime()).FromTx(txLow));
+    BOOST_CHECK_EQUAL(builder.Select(uint256(), 1, 0, limits), 3U);
+    BOOST_CHECK_EQUAL(builder.GetSelected().size(), 4U);
+    builder.SetValid();
+
+    // A new transaction with a higher fee rate than the medium one cuts the
+    // selection before it
+    CMutableTransaction txHigh = RandomTx(GetRandHash(), 0);
+    pool.addUnchecked(txHigh.GetHash(), entry.Fee(450000).Time(GetTime()).FromTx(txHigh));
+    BOOST_CHECK_EQUAL(builder.Select(uint256(), 1, 0, limits), 2U);
+    vHashes = SelectedHashes(builder);
+    BOOST_CHECK_EQUAL(vHashes.size(), 5U);
+    BOOST_CHECK(vHashes[2] == txHigh.GetHash());
+    builder.SetValid();
+
+    // Removing a selected transaction cuts the selection before its package
+    std::list<CTransaction> removed;
+    pool.remove(txChild, removed, true);
+    BOOST_CHECK_EQUAL(builder.Select(uint256(), 1, 0, limits), 0U);
+    builder.SetValid();
+
+    // Nothing is kept on another tip, or without a validated selection
+    BOOST_CHECK_EQUAL(builder.Select(uint256S("1"), 1, 0, limits), 0U);
+    BOOST_CHECK_EQUAL(builder.Select(uint256S("1"), 1, 0, limits), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(BlockTemplateBuilder_incremental)
+{
+    // Whatever the builder keeps, it must end up with the selection a fresh
+    // builder makes
+    seed_insecure_rand(true);
+    CTxMemPool pool(CFeeRate(0));
+    LOCK(pool.cs);
+    TestMemPoolEntryHelper entry;
+    CBlockTemplateLimits limits;
+    limits.nBlockMaxSize = 20000;
+
+    CBlockTemplateBuilder builder(pool);
+    std::vector<CTransaction> vTxs;
+    unsigned int nKeptTotal = 0;
+    for (int nRound = 0; nRound < 50; nRound++) {
+        // Remove a few transactions along with their descendants
+        for (int i = 0; i < 3 && !vTxs.empty(); i++) {
+            std::list<CTransaction> removed;
+            pool.remove(vTxs[insecure_rand() % vTxs.size()], removed, true);
+        }
+        vTxs.clear();
+        for (CTxMemPool::indexed_transaction_set::iterator it = pool.mapTx.begin(); it != pool.mapTx.end(); ++it)
+            vTxs.push_back(it->GetTx());
+
+        // Add new transactions, some spending transactions in the mempool
+        for (int i = 0; i < 10; i++) {
+            uint256 hashPrev = GetRandHash();
+            if (!vTxs.empty() && insecure_rand() % 2)
+                hashPrev = vTxs[insecure_rand() % vTxs.size()].GetHash();
+            CMutableTransaction tx = RandomTx(hashPrev, insecure_rand() % 2);
+            if (pool.mapNextTx.count(tx.vin[0].prevout))
+                continue;
+            entry.Priority(insecure_rand() % 1000000);
+            pool.addUnchecked(tx.GetHash(), entry.Fee(10000 + insecure_rand() % 1000000).Time(GetTime()).FromTx(tx));
+            vTxs.push_back(tx);
+        }
+
+        nKeptTotal += builder.Select(uint256(), 1, 0, limits);
+        builder.SetValid();
+        CBlockTemplateBuilder fresh(pool);
+        BOOST_CHECK_EQUAL(fresh.Select(uint256(), 1, 0, limits), 0U);
+        BOOST_CHECK(SelectedHashes(builder) == SelectedHashes(fresh));
+        BOOST_CHECK_EQUAL(builder.GetBlockSize(), fresh.GetBlockSize());
+        BOOST_CHECK_EQUAL(builder.GetFees(), fresh.GetFees());
+    }
+    BOOST_CHECK(nKeptTotal > 0);
+}
+
+BOOST_AUTO_TEST_CASE(ScanHash_matches_GetHash)
+{
+    CBlockHeader header;
+    header.nVersion = 1;
+    header.hashPrevBlock = uint256S("0x01");
+    header.hashMerkleRoot = uint256S("0x02");
+    header.nTime = 1500000000;
+    header.nBits = 0x207fffff;
+    header.nNonce = 0;
+
+    // Roughly every other hash is below this target
+    arith_uint256 hashTarget = UintToArith256(uint256S("0x7fffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff"));
+    CMinerScratchpad scratchpad;
+
+    uint32_t nExpected = 0;
+    CBlockHeader check = header;
+    for (check.nNonce = 5; UintToArith256(check.GetHash()) > hashTarget; check.nNonce++);
+    nExpected = check.nNonce;
+
+    uint64_t nNonce = 5;
+    uint64_t nHashesDone = 0;
+    uint256 hash;
+    BOOST_CHECK(ScanHash(&header, nNonce, UINT64_C(1) << 32, hashTarget, scratchpad, hash, nHashesDone));
+    BOOST_CHECK_EQUAL(header.nNonce, nExpected);
+    BOOST_CHECK(hash == header.GetHash());
+    BOOST_CHECK_EQUAL(nNonce, (uint64_t)nExpected + 1);
+    BOOST_CHECK_EQUAL(nHashesDone, (uint64_t)(nExpected - 5 + 1));
+
+    // An impossible target scans one call's 64 rounds of four nonces, 256 hashes
+    // from nonce 5 up to 261, and gives up
+    nNonce = 5;
+    nHashesDone = 0;
+    BOOST_CHECK(!ScanHash(&header, nNonce, UINT64_C(1) << 32, arith_uint256(), scratchpad, hash, nHashesDone));
+    BOOST_CHECK_EQUAL(nNonce, 261U);
+    BOOST_CHECK_EQUAL(nHashesDone, 256U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
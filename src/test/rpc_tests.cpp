@@ -7,11 +7,14 @@
 
 #include "base58.h"
 #include "netbase.h"
+#include "util.h"
 
 #include "test/test_digitslate.h"
 
 #include <boost/algorithm/string.hpp>
+#include <boost/bind.hpp>
 #include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
 
 #include <univalue.h>
 
@@ -307,4 +310,70 @@ BOOST_AUTO_TEST_CASE(rpc_ban)
     BOOST_CHECK_EQUAL(adr.get_str(), "2001:4d48:ac57:400:cacf:e9ff:fe1d:9c63/128");
 }
 
+static UniValue BatchRequest(const string& strMethod, const UniValue& params, int nId)
+{
+    UniValue req(UniValue::VOBJ);
+    req.push_back(Pair("method", strMethod));
+    req.push_back(Pair("params", params));
+    req.push_back(Pair("id", nId));
+    return req;
+}
+
+static void BatchHelper(boost::function<bool ()> func)
+{
+    while (func())
+        ;
+}
+
+static bool DispatchToThread(boost::thread_group* threadGroup, const boost::function<bool ()>& func)
+{
+    threadGroup->create_thread(boost::bind(&BatchHelper, func));
+    return true;
+}
+
+BOOST_AUTO_TEST_CASE(rpc_batch)
+{
+    // Unlike tableRPC.execute, batches are refused during warmup
+    SetRPCWarmupFinished();
+
+    // Concurrent and sequential elements mixed, the results must come in order
+    UniValue vReq(UniValue::VARR);
+    UniValue params(UniValue::VARR);
+    params.push_back("notanaddress");
+    for (int i = 0; i < 50; i++) {
+        if (i % 20 == 10)
+            vReq.push_back(BatchRequest("getblockcount", UniValue(UniValue::VARR), i));
+        else if (i % 20 == 15)
+            vReq.push_back(BatchRequest("nosuchmethod", UniValue(UniValue::VARR), i));
+        else
+            vReq.push_back(BatchRequest("validateaddress", params, i));
+    }
+
+    boost::thread_group threadGroup;
+    RPCBatchDispatcher dispatchers[] = {RPCBatchDispatcher(), boost::bind(&DispatchToThread, &threadGroup, _1)};
+    for (unsigned int d = 0; d < ARRAYLEN(dispatchers); d++) {
+        UniValue ret;
+        BOOST_CHECK(ret.read(JSONRPCExecBatch(vReq, dispatchers[d])));
+        BOOST_CHECK_EQUAL(ret.size(), vReq.size());
+        for (unsigned int i = 0; i < ret.size(); i++) {
+            BOOST_CHECK_EQUAL(find_value(ret[i], "id").get_int(), (int)i);
+            const UniValue& result = find_value(ret[i], "result");
+            if (i % 20 == 10)
+                BOOST_CHECK_EQUAL(result.get_int(), 0);
+            else if (i % 20 == 15)
+                BOOST_CHECK_EQUAL(find_value(find_value(ret[i], "error"), "code").get_int(), (int)RPC_METHOD_NOT_FOUND);
+            else
+                BOOST_CHECK(!find_value(result, "isvalid").get_bool());
+        }
+    }
+    threadGroup.join_all();
+
+    // Batches over the size limit are rejected as a whole
+    mapArgs["-rpcbatchmaxsize"] = "49";
+    BOOST_CHECK_THROW(JSONRPCExecBatch(vReq), UniValue);
+    mapArgs["-rpcbatchmaxsize"] = "50";
+    BOOST_CHECK_NO_THROW(JSONRPCExecBatch(vReq));
+    mapArgs.erase("-rpcbatchmaxsize");
+}
+
 BOOST_AUTO_TEST_SUITE_END()
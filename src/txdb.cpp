@@ -8,23 +8,33 @@
 #include "chain.h"
 #include "chainparams.h"
 #include "hash.h"
+#include "init.h"
 #include "main.h"
 #include "pow.h"
 #include "uint256.h"
 
+#include <limits>
+#include <queue>
 #include <stdint.h>
 
+#include <boost/shared_ptr.hpp>
 #include <boost/thread.hpp>
 
 using namespace std;
 
-static const char DB_COINS = 'c';
+static const char DB_COIN = 'C';
+static const char DB_COINS = 'c'; // per-transaction records of older databases, see CCoinsViewDB::Upgrade()
+static const char DB_COIN_TX = 'T'; // present for every transaction with unspent outputs
+static const char DB_COINS_VERSION = 'V';
 static const char DB_BLOCK_FILES = 'f';
 static const char DB_TXINDEX = 't';
 static const char DB_ADDRESSINDEX = 'a';
 static const char DB_ADDRESSUNSPENTINDEX = 'u';
 static const char DB_TIMESTAMPINDEX = 's';
 static const char DB_SPENTINDEX = 'p';
+static const char DB_ADDRESSBALANCE = 'A';
+static const char DB_ADDRESSBALANCE_BLOCK = 'N'; // blocks whose deltas the balance records include
+static const char DB_INDEXBUILD = 'I';
 static const char DB_BLOCK_INDEX = 'b';
 
 static const char DB_BEST_BLOCK = 'B';
@@ -33,35 +43,151 @@ static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
 
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true) 
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true), fPending(false), fWriteFailed(false)
 {
 }
 
+CCoinsViewDB::CCoinsViewDB(const CDBOptions& dbOptions, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", dbOptions, fMemory, fWipe, true), fPending(false), fWriteFailed(false)
+{
+}
+
+CCoinsViewDB::~CCoinsViewDB()
+{
+    if (threadWriter.joinable()) {
+        WaitForWrites();
+        threadWriter.interrupt();
+        threadWriter.join();
+    }
+}
+
 bool CCoinsViewDB::GetCoins(const uint256 &txid, CCoins &coins) const {
-    return db.Read(make_pair(DB_COINS, txid), coins);
+    {
+        boost::unique_lock<boost::mutex> lock(csPending);
+        if (fPending) {
+            // The entries of a cache hold all outputs of their transaction, not only the changed ones
+            CCoinsMap::const_iterator it = mapPending.find(txid);
+            if (it != mapPending.end()) {
+                coins = it->second.coins;
+                return !coins.IsPruned();
+            }
+        }
+    }
+
+    coins.Clear();
+    // A seek reads a table file of every level, while a missing marker is
+    // mostly told by the bloom filters. Most lookups are misses.
+    if (!db.Exists(make_pair(DB_COIN_TX, txid)))
+        return false;
+
+    // The outputs of a transaction are stored next to each other, behind the
+    // one with the lowest key, which is that of output 0.
+    boost::scoped_ptr<CDBIterator> pcursor(const_cast<CDBWrapper*>(&db)->NewIterator());
+    pcursor->Seek(make_pair(DB_COIN, COutPoint(txid, 0)));
+
+    bool fFound = false;
+    while (pcursor->Valid()) {
+        std::pair<char, COutPoint> key;
+        if (!pcursor->GetKey(key) || key.first != DB_COIN || key.second.hash != txid)
+            break;
+        CDiskTxOut out;
+        if (!pcursor->GetValue(out))
+            return error("CCoinsViewDB::GetCoins() : unable to read value");
+        if (coins.vout.size() <= key.second.n)
+            coins.vout.resize(key.second.n + 1);
+        coins.vout[key.second.n] = out.txout;
+        coins.fCoinBase = out.fCoinBase;
+        coins.nHeight = out.nHeight;
+        coins.nVersion = out.nVersion;
+        fFound = true;
+        pcursor->Next();
+    }
+    return fFound;
 }
 
 bool CCoinsViewDB::HaveCoins(const uint256 &txid) const {
-    return db.Exists(make_pair(DB_COINS, txid));
+    {
+        boost::unique_lock<boost::mutex> lock(csPending);
+        if (fPending) {
+            CCoinsMap::const_iterator it = mapPending.find(txid);
+            if (it != mapPending.end())
+                return !it->second.coins.IsPruned();
+        }
+    }
+
+    return db.Exists(make_pair(DB_COIN_TX, txid));
 }
 
 uint256 CCoinsViewDB::GetBestBlock() const {
+    {
+        boost::unique_lock<boost::mutex> lock(csPending);
+        if (fPending && !hashPending.IsNull())
+            return hashPending;
+    }
     uint256 hashBestChain;
     if (!db.Read(DB_BEST_BLOCK, hashBestChain))
         return uint256();
     return hashBestChain;
 }
 
+/** Add the changed outputs of one cache entry to a coin database batch, return how many there are */
+static size_t BatchWriteCoins(CDBBatch &batch, const uint256 &txid, const CCoinsCacheEntry &entry)
+{
+    const CCoins &coins = entry.coins;
+    size_t outputs = 0;
+    // The entry holds all outputs of the transaction, so it tells whether any are left
+    if (coins.IsPruned())
+        batch.Erase(make_pair(DB_COIN_TX, txid));
+    else
+        batch.Write(make_pair(DB_COIN_TX, txid), '1');
+    if (entry.flags & CCoinsCacheEntry::FRESH) {
+        // None of the outputs are in the database yet
+        for (unsigned int i = 0; i < coins.vout.size(); i++) {
+            if (coins.IsAvailable(i)) {
+                batch.Write(make_pair(DB_COIN, COutPoint(txid, i)), CDiskTxOut(coins, i));
+                outputs++;
+            }
+        }
+    } else {
+        // Only the outputs that were spent or restored since the entry was read
+        for (unsigned int i = 0; i < entry.vDirtyOutputs.size(); i++) {
+            if (!entry.vDirtyOutputs[i])
+                continue;
+            if (coins.IsAvailable(i))
+                batch.Write(make_pair(DB_COIN, COutPoint(txid, i)), CDiskTxOut(coins, i));
+            else
+                batch.Erase(make_pair(DB_COIN, COutPoint(txid, i)));
+            outputs++;
+        }
+    }
+    return outputs;
+}
+
 bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+    if (threadWriter.joinable()) {
+        boost::this_thread::disable_interruption di;
+        boost::unique_lock<boost::mutex> lock(csPending);
+        int64_t nStart = GetTimeMicros();
+        while (fPending && !fWriteFailed)
+            condPending.wait(lock);
+        writerStats.nTotalWaitMicros += GetTimeMicros() - nStart;
+        if (fWriteFailed)
+            return false;
+        // The caller is left with the empty map of the last snapshot
+        mapPending.swap(mapCoins);
+        hashPending = hashBlock;
+        fPending = true;
+        writerStats.fPending = true;
+        condPending.notify_all();
+        return true;
+    }
+
     CDBBatch batch(&db.GetObfuscateKey());
     size_t count = 0;
     size_t changed = 0;
+    size_t outputs = 0;
     for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
-            if (it->second.coins.IsPruned())
-                batch.Erase(make_pair(DB_COINS, it->first));
-            else
-                batch.Write(make_pair(DB_COINS, it->first), it->second.coins);
+            outputs += BatchWriteCoins(batch, it->first, it->second);
             changed++;
         }
         count++;
@@ -71,13 +197,180 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     if (!hashBlock.IsNull())
         batch.Write(DB_BEST_BLOCK, hashBlock);
 
-    LogPrint("coindb", "Committing %u changed transactions (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
+    LogPrint("coindb", "Committing %u changed outputs of %u changed transactions (out of %u) to coin database...\n", (unsigned int)outputs, (unsigned int)changed, (unsigned int)count);
+    return db.WriteBatch(batch);
+}
+
+/** Like BatchWrite, but leaves the map alone, so that it can be read meanwhile */
+bool CCoinsViewDB::WriteCoins(const CCoinsMap &mapCoins, const uint256 &hashBlock) {
+    CDBBatch batch(&db.GetObfuscateKey());
+    size_t changed = 0;
+    size_t outputs = 0;
+    for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); it++) {
+        if (it->second.flags & CCoinsCacheEntry::DIRTY) {
+            outputs += BatchWriteCoins(batch, it->first, it->second);
+            changed++;
+        }
+    }
+    if (!hashBlock.IsNull())
+        batch.Write(DB_BEST_BLOCK, hashBlock);
+
+    LogPrint("coindb", "Committing %u changed outputs of %u changed transactions (out of %u) to coin database in the background...\n", (unsigned int)outputs, (unsigned int)changed, (unsigned int)mapCoins.size());
     return db.WriteBatch(batch);
 }
 
+void CCoinsViewDB::StartWriter()
+{
+    assert(!threadWriter.joinable());
+    threadWriter = boost::thread(boost::bind(&TraceThread<boost::function<void()> >, "coinwrite",
+                                             boost::function<void()>(boost::bind(&CCoinsViewDB::ThreadWrite, this))));
+}
+
+void CCoinsViewDB::ThreadWrite()
+{
+    while (true) {
+        uint256 hashBlock;
+        {
+            boost::unique_lock<boost::mutex> lock(csPending);
+            while (!fPending)
+                condPending.wait(lock);
+            hashBlock = hashPending;
+        }
+
+        // Nothing else changes the snapshot until it is cleared below, and
+        // readers only look entries up, so it is read without the lock.
+        size_t nUsage = memusage::DynamicUsage(mapPending);
+        for (CCoinsMap::const_iterator it = mapPending.begin(); it != mapPending.end(); it++)
+            nUsage += it->second.DynamicMemoryUsage();
+        size_t nTransactions = mapPending.size();
+        {
+            boost::unique_lock<boost::mutex> lock(csPending);
+            writerStats.nTransactions = nTransactions;
+            writerStats.nUsage = nUsage;
+        }
+
+        int64_t nStart = GetTimeMicros();
+        bool fOk;
+        try {
+            fOk = WriteCoins(mapPending, hashBlock);
+        } catch (const std::runtime_error& e) {
+            LogPrintf("%s: %s\n", __func__, e.what());
+            fOk = false;
+        }
+        int64_t nTime = GetTimeMicros() - nStart;
+        LogPrint("bench", "    - Coin database write: %.2fms (%u transactions, %.1fMiB)\n",
+                 0.001 * nTime, (unsigned int)nTransactions, nUsage * (1.0 / (1 << 20)));
+
+        boost::unique_lock<boost::mutex> lock(csPending);
+        if (!fOk) {
+            // Keep the snapshot, so reads still see the state the caller handed over until it shuts down
+            LogPrintf("%s: failed to write to coin database\n", __func__);
+            fWriteFailed = true;
+            condPending.notify_all();
+            return;
+        }
+        mapPending.clear();
+        hashPending.SetNull();
+        fPending = false;
+        writerStats.fPending = false;
+        writerStats.nWrites++;
+        writerStats.nLastWriteMicros = nTime;
+        writerStats.nMaxWriteMicros = std::max(writerStats.nMaxWriteMicros, nTime);
+        writerStats.nTotalWriteMicros += nTime;
+        condPending.notify_all();
+    }
+}
+
+bool CCoinsViewDB::WaitForWrites() const
+{
+    boost::this_thread::disable_interruption di;
+    boost::unique_lock<boost::mutex> lock(csPending);
+    while (fPending && !fWriteFailed)
+        condPending.wait(lock);
+    return !fWriteFailed;
+}
+
+bool CCoinsViewDB::WriteFailed() const
+{
+    boost::unique_lock<boost::mutex> lock(csPending);
+    return fWriteFailed;
+}
+
+CCoinsWriterStats CCoinsViewDB::GetWriterStats() const
+{
+    boost::unique_lock<boost::mutex> lock(csPending);
+    return writerStats;
+}
+
+int CCoinsViewDB::GetFormatVersion() const {
+    int nVersion = 0;
+    db.Read(DB_COINS_VERSION, nVersion);
+    return nVersion;
+}
+
+bool CCoinsViewDB::Upgrade() {
+    int nVersion = GetFormatVersion();
+    if (nVersion > COINS_DB_VERSION)
+        return error("%s: the coin database has format version %d, only up to %d is supported", __func__, nVersion, COINS_DB_VERSION);
+    if (nVersion == COINS_DB_VERSION)
+        return true;
+
+    boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator());
+    pcursor->Seek(make_pair(DB_COINS, uint256()));
+    std::pair<char, uint256> key;
+    if (!pcursor->Valid() || !pcursor->GetKey(key) || key.first != DB_COINS)
+        return db.Write(DB_COINS_VERSION, COINS_DB_VERSION);
+
+    LogPrintf("Upgrading the coin database to per-output records...\n");
+    LogPrintf("Older versions see an empty UTXO set in the upgraded database, downgrading needs -reindex\n");
+    CDBBatch batch(&db.GetObfuscateKey());
+    size_t nBatch = 0;
+    int64_t nUpgraded = 0;
+    while (true) {
+        bool fValid = pcursor->Valid() && pcursor->GetKey(key) && key.first == DB_COINS;
+        if (fValid) {
+            CCoins coins;
+            if (!pcursor->GetValue(coins))
+                return error("%s: unable to read value", __func__);
+            for (unsigned int i = 0; i < coins.vout.size(); i++) {
+                if (coins.IsAvailable(i))
+                    batch.Write(make_pair(DB_COIN, COutPoint(key.second, i)), CDiskTxOut(coins, i));
+            }
+            if (!coins.IsPruned())
+                batch.Write(make_pair(DB_COIN_TX, key.second), '1');
+            batch.Erase(key);
+            nBatch++;
+            pcursor->Next();
+        }
+        // each batch writes the new records and erases the old ones at once,
+        // so an interrupted upgrade is picked up again on the next start
+        // and the last one marks the database as converted
+        if (!fValid)
+            batch.Write(DB_COINS_VERSION, COINS_DB_VERSION);
+        if (!fValid || nBatch >= 100000) {
+            if (!db.WriteBatch(batch))
+                return false;
+            nUpgraded += nBatch;
+            nBatch = 0;
+            batch = CDBBatch(&db.GetObfuscateKey());
+            LogPrintf("%s: %d transactions upgraded\n", __func__, nUpgraded);
+            // the next start continues after the batches written so far
+            if (fValid && ShutdownRequested()) {
+                LogPrintf("%s: interrupted, the upgrade continues on the next start\n", __func__);
+                return true;
+            }
+        }
+        if (!fValid)
+            return true;
+    }
+}
+
 CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
 }
 
+CBlockTreeDB::CBlockTreeDB(const CDBOptions& dbOptions, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "index", dbOptions, fMemory, fWipe) {
+}
+
 bool CBlockTreeDB::ReadBlockFileInfo(int nFile, CBlockFileInfo &info) {
     return Read(make_pair(DB_BLOCK_FILES, nFile), info);
 }
@@ -99,45 +392,62 @@ bool CBlockTreeDB::ReadLastBlockFile(int &nFile) {
 }
 
 bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
+    // The snapshot being written, if any, has to be in the database first
+    if (!WaitForWrites())
+        return error("CCoinsViewDB::GetStats() : a write to the coin database failed");
+
     /* It seems that there are no "const iterators" for LevelDB.  Since we
        only need read operations on it, use a const-cast to get around
        that restriction.  */
-    boost::scoped_ptr<CDBIterator> pcursor(const_cast<CDBWrapper*>(&db)->NewIterator());
-    pcursor->Seek(DB_COINS);
+    // The best block is read from the same snapshot as the outputs, so that
+    // they match even when the coin database is written to meanwhile.
+    CDBSnapshot snapshot(db);
+    boost::scoped_ptr<CDBIterator> pcursor(const_cast<CDBWrapper*>(&db)->NewIterator(snapshot));
+    pcursor->Seek(DB_BEST_BLOCK);
+    char chKey;
+    stats.hashBlock.SetNull();
+    if (pcursor->Valid() && pcursor->GetKey(chKey) && chKey == DB_BEST_BLOCK && !pcursor->GetValue(stats.hashBlock))
+        return error("CCoinsViewDB::GetStats() : unable to read best block");
+    pcursor->Seek(DB_COIN);
 
     CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
-    stats.hashBlock = GetBestBlock();
     ss << stats.hashBlock;
     CAmount nTotalAmount = 0;
-    while (pcursor->Valid()) {
+    // The outputs of one transaction are next to each other, but not in the
+    // order of their index, so they are sorted before they are hashed. This
+    // gives the same hash as the per-transaction records did.
+    uint256 txidLast;
+    std::map<uint32_t, CTxOut> mapOutputs;
+    while (true) {
         boost::this_thread::interruption_point();
-        std::pair<char, uint256> key;
-        CCoins coins;
-        if (pcursor->GetKey(key) && key.first == DB_COINS) {
-            if (pcursor->GetValue(coins)) {
-                stats.nTransactions++;
-                for (unsigned int i=0; i<coins.vout.size(); i++) {
-                    const CTxOut &out = coins.vout[i];
-                    if (!out.IsNull()) {
-                        stats.nTransactionOutputs++;
-                        ss << VARINT(i+1);
-                        ss << out;
-                        nTotalAmount += out.nValue;
-                    }
-                }
-                stats.nSerializedSize += 32 + pcursor->GetValueSize();
-                ss << VARINT(0);
-            } else {
-                return error("CCoinsViewDB::GetStats() : unable to read value");
+        std::pair<char, COutPoint> key;
+        bool fValid = pcursor->Valid() && pcursor->GetKey(key) && key.first == DB_COIN;
+        if (!mapOutputs.empty() && (!fValid || key.second.hash != txidLast)) {
+            stats.nTransactions++;
+            for (std::map<uint32_t, CTxOut>::const_iterator it = mapOutputs.begin(); it != mapOutputs.end(); it++) {
+                ss << VARINT(it->first+1);
+                ss << it->second;
             }
-        } else {
-            break;
+            ss << VARINT(0);
+            mapOutputs.clear();
         }
+        if (!fValid)
+            break;
+        CDiskTxOut out;
+        if (!pcursor->GetValue(out))
+            return error("CCoinsViewDB::GetStats() : unable to read value");
+        stats.nTransactionOutputs++;
+        stats.nSerializedSize += 36 + pcursor->GetValueSize();
+        nTotalAmount += out.txout.nValue;
+        mapOutputs[key.second.n] = out.txout;
+        txidLast = key.second.hash;
         pcursor->Next();
     }
     {
         LOCK(cs_main);
-        stats.nHeight = mapBlockIndex.find(stats.hashBlock)->second->nHeight;
+        BlockMap::const_iterator mi = mapBlockIndex.find(stats.hashBlock);
+        if (mi != mapBlockIndex.end())
+            stats.nHeight = mi->second->nHeight;
     }
     stats.hashSerialized = ss.GetHash();
     stats.nTotalAmount = nTotalAmount;
@@ -156,23 +466,37 @@ bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockF
     return WriteBatch(batch, true);
 }
 
-bool CBlockTreeDB::ReadTxIndex(const uint256 &txid, CDiskTxPos &pos) {
+bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
+    return Write(std::make_pair(DB_FLAG, name), fValue ? '1' : '0');
+}
+
+bool CBlockTreeDB::ReadFlag(const std::string &name, bool &fValue) {
+    char ch;
+    if (!Read(std::make_pair(DB_FLAG, name), ch))
+        return false;
+    fValue = ch == '1';
+    return true;
+}
+
+CIndexDB::CIndexDB(const CDBOptions& dbOptions, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "indexes", dbOptions, fMemory, fWipe) {
+}
+
+bool CIndexDB::ReadTxIndex(const uint256 &txid, CDiskTxPos &pos) {
     return Read(make_pair(DB_TXINDEX, txid), pos);
 }
 
-bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> >&vect) {
+bool CIndexDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> >&vect) {
     CDBBatch batch(&GetObfuscateKey());
     for (std::vector<std::pair<uint256,CDiskTxPos> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
         batch.Write(make_pair(DB_TXINDEX, it->first), it->second);
     return WriteBatch(batch);
 }
 
-bool CBlockTreeDB::ReadSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value) {
+bool CIndexDB::ReadSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value) {
     return Read(make_pair(DB_SPENTINDEX, key), value);
 }
 
-bool CBlockTreeDB::UpdateSpentIndex(const std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> >&vect) {
-    CDBBatch batch(&GetObfuscateKey());
+static void BatchSpentIndex(CDBBatch &batch, const std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> >&vect) {
     for (std::vector<std::pair<CSpentIndexKey,CSpentIndexValue> >::const_iterator it=vect.begin(); it!=vect.end(); it++) {
         if (it->second.IsNull()) {
             batch.Erase(make_pair(DB_SPENTINDEX, it->first));
@@ -180,11 +504,15 @@ bool CBlockTreeDB::UpdateSpentIndex(const std::vector<std::pair<CSpentIndexKey,
             batch.Write(make_pair(DB_SPENTINDEX, it->first), it->second);
         }
     }
-    return WriteBatch(batch);
 }
 
-bool CBlockTreeDB::UpdateAddressUnspentIndex(const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue > >&vect) {
+bool CIndexDB::UpdateSpentIndex(const std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> >&vect) {
     CDBBatch batch(&GetObfuscateKey());
+    BatchSpentIndex(batch, vect);
+    return WriteBatch(batch);
+}
+
+static void BatchAddressUnspentIndex(CDBBatch &batch, const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue > >&vect) {
     for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator it=vect.begin(); it!=vect.end(); it++) {
         if (it->second.IsNull()) {
             batch.Erase(make_pair(DB_ADDRESSUNSPENTINDEX, it->first));
@@ -192,23 +520,43 @@ bool CBlockTreeDB::UpdateAddressUnspentIndex(const std::vector<std::pair<CAddres
             batch.Write(make_pair(DB_ADDRESSUNSPENTINDEX, it->first), it->second);
         }
     }
+}
+
+bool CIndexDB::UpdateAddressUnspentIndex(const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue > >&vect) {
+    CDBBatch batch(&GetObfuscateKey());
+    BatchAddressUnspentIndex(batch, vect);
     return WriteBatch(batch);
 }
 
-bool CBlockTreeDB::ReadAddressUnspentIndex(uint160 addressHash, int type,
-                                           std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs) {
+bool CIndexDB::ReadAddressUnspentIndex(uint160 addressHash, int type,
+                                           std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs,
+                                           const CAddressUnspentKey *pAfter, size_t nLimit) {
 
     boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
 
-    pcursor->Seek(make_pair(DB_ADDRESSUNSPENTINDEX, CAddressIndexIteratorKey(type, addressHash)));
+    if (pAfter) {
+        pcursor->Seek(make_pair(DB_ADDRESSUNSPENTINDEX, *pAfter));
+    } else {
+        pcursor->Seek(make_pair(DB_ADDRESSUNSPENTINDEX, CAddressIndexIteratorKey(type, addressHash)));
+    }
 
+    size_t nFound = 0;
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
         std::pair<char,CAddressUnspentKey> key;
         if (pcursor->GetKey(key) && key.first == DB_ADDRESSUNSPENTINDEX && key.second.hashBytes == addressHash) {
+            if (pAfter && key.second.txhash == pAfter->txhash && key.second.index == pAfter->index) {
+                // The continuation key itself was returned by the previous page
+                pcursor->Next();
+                continue;
+            }
+            if (nLimit > 0 && nFound >= nLimit) {
+                break;
+            }
             CAddressUnspentValue nValue;
             if (pcursor->GetValue(nValue)) {
                 unspentOutputs.push_back(make_pair(key.second, nValue));
+                nFound++;
                 pcursor->Next();
             } else {
                 return error("failed to get address unspent value");
@@ -221,43 +569,207 @@ bool CBlockTreeDB::ReadAddressUnspentIndex(uint160 addressHash, int type,
     return true;
 }
 
-bool CBlockTreeDB::WriteAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount > >&vect) {
+void CIndexDB::UpdateAddressBalances(CDBBatch &batch, const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect, bool fErase) {
+    // Sum up the deltas per address first, so every balance record is read and written once
+    struct BalanceDelta {
+        CAmount received;
+        CAmount balance;
+        std::set<uint256> setTxids;
+        BalanceDelta() : received(0), balance(0) {}
+    };
+    std::map<std::pair<unsigned int, uint160>, BalanceDelta> mapDeltas;
+    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=vect.begin(); it!=vect.end(); it++) {
+        BalanceDelta &delta = mapDeltas[make_pair(it->first.type, it->first.hashBytes)];
+        if (it->second > 0)
+            delta.received += it->second;
+        delta.balance += it->second;
+        delta.setTxids.insert(it->first.txhash);
+    }
+
+    for (std::map<std::pair<unsigned int, uint160>, BalanceDelta>::const_iterator it=mapDeltas.begin(); it!=mapDeltas.end(); it++) {
+        const CAddressIndexIteratorKey key(it->first.first, it->first.second);
+        CAddressBalanceValue value;
+        Read(make_pair(DB_ADDRESSBALANCE, key), value);
+        if (fErase) {
+            value.received -= it->second.received;
+            value.balance -= it->second.balance;
+            value.txCount -= std::min(value.txCount, (unsigned int)it->second.setTxids.size());
+        } else {
+            value.received += it->second.received;
+            value.balance += it->second.balance;
+            value.txCount += it->second.setTxids.size();
+        }
+        if (value.IsNull()) {
+            batch.Erase(make_pair(DB_ADDRESSBALANCE, key));
+        } else {
+            batch.Write(make_pair(DB_ADDRESSBALANCE, key), value);
+        }
+    }
+}
+
+void CIndexDB::BatchAddressIndex(CDBBatch &batch, const std::vector<std::pair<CAddressIndexKey, CAmount > >&vect, bool fErase, bool fBalances) {
+    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=vect.begin(); it!=vect.end(); it++) {
+        if (fErase) {
+            batch.Erase(make_pair(DB_ADDRESSINDEX, it->first));
+        } else {
+            batch.Write(make_pair(DB_ADDRESSINDEX, it->first), it->second);
+        }
+    }
+    if (fBalances)
+        UpdateAddressBalances(batch, vect, fErase);
+}
+
+bool CIndexDB::WriteAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount > >&vect, const uint256 &hashBlock) {
+    // The balance records add up deltas, while the coin database may be many
+    // blocks behind after an unclean shutdown. Every block whose deltas were
+    // added is recorded in the same batch, so a replayed one is not added again.
+    // The entries themselves are simply rewritten.
+    bool fApplied = Exists(make_pair(DB_ADDRESSBALANCE_BLOCK, hashBlock));
+    if (fApplied)
+        LogPrintf("%s: balances already include block %s\n", __func__, hashBlock.ToString());
+
+    CDBBatch batch(&GetObfuscateKey());
+    BatchAddressIndex(batch, vect, false, !fApplied);
+    batch.Write(make_pair(DB_ADDRESSBALANCE_BLOCK, hashBlock), '1');
+    return WriteBatch(batch);
+}
+
+bool CIndexDB::EraseAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount > >&vect, const uint256 &hashBlock) {
+    bool fApplied = Exists(make_pair(DB_ADDRESSBALANCE_BLOCK, hashBlock));
+    if (!fApplied)
+        LogPrintf("%s: balances already exclude block %s\n", __func__, hashBlock.ToString());
+
     CDBBatch batch(&GetObfuscateKey());
-    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
-        batch.Write(make_pair(DB_ADDRESSINDEX, it->first), it->second);
+    BatchAddressIndex(batch, vect, true, fApplied);
+    batch.Erase(make_pair(DB_ADDRESSBALANCE_BLOCK, hashBlock));
     return WriteBatch(batch);
 }
 
-bool CBlockTreeDB::EraseAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount > >&vect) {
+bool CIndexDB::ReadAddressBalance(uint160 addressHash, int type, CAddressBalanceValue &balance) {
+    balance.SetNull();
+    // addresses that never had any activity have no record, read errors throw
+    Read(make_pair(DB_ADDRESSBALANCE, CAddressIndexIteratorKey(type, addressHash)), balance);
+    return true;
+}
+
+bool CIndexDB::BuildAddressBalanceIndex() {
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+
+    // Address index keys are sorted by address and then by height, so one pass
+    // sees all the deltas of an address, and of each of its transactions, in a row.
+    pcursor->Seek(DB_ADDRESSINDEX);
+
     CDBBatch batch(&GetObfuscateKey());
-    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
-        batch.Erase(make_pair(DB_ADDRESSINDEX, it->first));
+    CAddressIndexIteratorKey current;
+    CAddressBalanceValue value;
+    uint256 lastTxid;
+    int64_t nAddresses = 0;
+
+    while (true) {
+        boost::this_thread::interruption_point();
+        std::pair<char,CAddressIndexKey> key;
+        bool fValid = pcursor->Valid() && pcursor->GetKey(key) && key.first == DB_ADDRESSINDEX;
+
+        if (!value.IsNull() && (!fValid || key.second.type != current.type || key.second.hashBytes != current.hashBytes)) {
+            batch.Write(make_pair(DB_ADDRESSBALANCE, current), value);
+            value.SetNull();
+            if (++nAddresses % 100000 == 0) {
+                LogPrintf("%s: %d addresses done\n", __func__, nAddresses);
+                if (!WriteBatch(batch))
+                    return error("%s: failed to write address balances", __func__);
+                batch = CDBBatch(&GetObfuscateKey());
+            }
+        }
+        if (!fValid)
+            break;
+
+        CAmount nValue;
+        if (!pcursor->GetValue(nValue))
+            return error("failed to get address index value");
+
+        if (value.IsNull()) {
+            current = CAddressIndexIteratorKey(key.second.type, key.second.hashBytes);
+            lastTxid.SetNull();
+        }
+        if (nValue > 0)
+            value.received += nValue;
+        value.balance += nValue;
+        if (key.second.txhash != lastTxid) {
+            value.txCount++;
+            lastTxid = key.second.txhash;
+        }
+        pcursor->Next();
+    }
+
+    LogPrintf("%s: %d addresses done\n", __func__, nAddresses);
     return WriteBatch(batch);
 }
 
-bool CBlockTreeDB::ReadAddressIndex(uint160 addressHash, int type,
+static bool IsSameAddressIndexKey(const CAddressIndexKey &a, const CAddressIndexKey &b) {
+    return a.type == b.type && a.hashBytes == b.hashBytes && a.blockHeight == b.blockHeight &&
+           a.txindex == b.txindex && a.txhash == b.txhash && a.index == b.index && a.spending == b.spending;
+}
+
+bool CIndexDB::ReadAddressIndex(uint160 addressHash, int type,
                                     std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
-                                    int start, int end) {
+                                    int start, int end,
+                                    const CAddressIndexKey *pAfter, size_t nLimit, bool fDescending) {
 
     boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
 
-    if (start > 0 && end > 0) {
-        pcursor->Seek(make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorHeightKey(type, addressHash, start)));
+    if (!fDescending) {
+        if (pAfter) {
+            pcursor->Seek(make_pair(DB_ADDRESSINDEX, *pAfter));
+        } else if (start > 0 && end > 0) {
+            pcursor->Seek(make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorHeightKey(type, addressHash, start)));
+        } else {
+            pcursor->Seek(make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorKey(type, addressHash)));
+        }
     } else {
-        pcursor->Seek(make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorKey(type, addressHash)));
+        // Position on the first key past the range and step back from there
+        if (pAfter) {
+            pcursor->Seek(make_pair(DB_ADDRESSINDEX, *pAfter));
+        } else if (start > 0 && end > 0 && end < std::numeric_limits<int>::max()) {
+            pcursor->Seek(make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorHeightKey(type, addressHash, end + 1)));
+        } else {
+            // Heights are serialized unsigned, so this sorts after every entry of the address
+            pcursor->Seek(make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorHeightKey(type, addressHash, std::numeric_limits<unsigned int>::max())));
+        }
+        if (pcursor->Valid()) {
+            pcursor->Prev();
+        } else {
+            pcursor->SeekToLast();
+        }
     }
 
+    size_t nFound = 0;
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
         std::pair<char,CAddressIndexKey> key;
         if (pcursor->GetKey(key) && key.first == DB_ADDRESSINDEX && key.second.hashBytes == addressHash) {
-            if (end > 0 && key.second.blockHeight > end) {
+            if (!fDescending && pAfter && IsSameAddressIndexKey(key.second, *pAfter)) {
+                // The continuation key itself was returned by the previous page
+                pcursor->Next();
+                continue;
+            }
+            if (!fDescending && end > 0 && key.second.blockHeight > end) {
+                break;
+            }
+            if (fDescending && start > 0 && key.second.blockHeight < start) {
+                break;
+            }
+            if (nLimit > 0 && nFound >= nLimit) {
                 break;
             }
             CAmount nValue;
             if (pcursor->GetValue(nValue)) {
                 addressIndex.push_back(make_pair(key.second, nValue));
-                pcursor->Next();
+                nFound++;
+                if (fDescending) {
+                    pcursor->Prev();
+                } else {
+                    pcursor->Next();
+                }
             } else {
                 return error("failed to get address index value");
             }
@@ -269,13 +781,176 @@ bool CBlockTreeDB::ReadAddressIndex(uint160 addressHash, int type,
     return true;
 }
 
-bool CBlockTreeDB::WriteTimestampIndex(const CTimestampIndexKey &timestampIndex) {
+namespace {
+
+/** The read position of one address in a merged read of the address index */
+struct AddressIndexStream {
+    boost::shared_ptr<CDBIterator> pcursor;
+    unsigned int type;
+    uint160 hashBytes;
+    size_t nPos;
+    const CAddressIndexKey *pSkip;
+    bool fValid;
+    CAddressIndexKey key;
+    CAmount value;
+};
+
+/**
+ * Orders streams by the block position of their current entry, with the
+ * address given first winning ties. std::priority_queue pops its largest
+ * element, so this returns true when a has to come out after b.
+ */
+struct AddressIndexStreamCompare {
+    const std::vector<AddressIndexStream> *pstreams;
+    bool fDescending;
+
+    AddressIndexStreamCompare(const std::vector<AddressIndexStream> *pstreamsIn, bool fDescendingIn) :
+        pstreams(pstreamsIn), fDescending(fDescendingIn) {}
+
+    bool operator()(size_t a, size_t b) const {
+        const AddressIndexStream &sa = (*pstreams)[a];
+        const AddressIndexStream &sb = (*pstreams)[b];
+        if (sa.key.blockHeight != sb.key.blockHeight)
+            return fDescending ? sa.key.blockHeight < sb.key.blockHeight : sa.key.blockHeight > sb.key.blockHeight;
+        if (sa.key.txindex != sb.key.txindex)
+            return fDescending ? sa.key.txindex < sb.key.txindex : sa.key.txindex > sb.key.txindex;
+        return sa.nPos > sb.nPos;
+    }
+};
+
+/** Load the entry under the cursor of stream, or mark it done when it left the address or range */
+bool ReadAddressIndexStream(AddressIndexStream &stream, int start, int end, bool fDescending) {
+    stream.fValid = false;
+    while (stream.pcursor->Valid()) {
+        std::pair<char,CAddressIndexKey> key;
+        if (!stream.pcursor->GetKey(key) || key.first != DB_ADDRESSINDEX ||
+            key.second.type != stream.type || key.second.hashBytes != stream.hashBytes)
+            return true;
+        if (stream.pSkip && IsSameAddressIndexKey(key.second, *stream.pSkip)) {
+            stream.pcursor->Next();
+            continue;
+        }
+        if (!fDescending && end > 0 && key.second.blockHeight > end)
+            return true;
+        if (fDescending && start > 0 && key.second.blockHeight < start)
+            return true;
+        if (!stream.pcursor->GetValue(stream.value))
+            return error("failed to get address index value");
+        stream.key = key.second;
+        stream.fValid = true;
+        return true;
+    }
+    return true;
+}
+
+}
+
+bool CIndexDB::ReadAddressIndexes(const std::vector<std::pair<uint160, int> > &addresses,
+                                      std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
+                                      int start, int end,
+                                      const CAddressIndexKey *pAfter, size_t nLimit, bool fDescending) {
+
+    // All cursors read from the same snapshot, so the merged result is consistent
+    // even when a block is connected halfway through
+    CDBSnapshot snapshot(*this);
+
+    std::vector<AddressIndexStream> streams;
+    size_t nCursorPos = addresses.size();
+    for (size_t i = 0; i < addresses.size(); i++) {
+        bool fDuplicate = false;
+        for (size_t j = 0; j < streams.size() && !fDuplicate; j++)
+            fDuplicate = streams[j].hashBytes == addresses[i].first && streams[j].type == (unsigned int)addresses[i].second;
+        if (fDuplicate)
+            continue;
+        if (pAfter && pAfter->hashBytes == addresses[i].first && pAfter->type == (unsigned int)addresses[i].second)
+            nCursorPos = i;
+
+        AddressIndexStream stream;
+        stream.pcursor.reset(NewIterator(snapshot));
+        stream.type = addresses[i].second;
+        stream.hashBytes = addresses[i].first;
+        stream.nPos = i;
+        stream.pSkip = NULL;
+        stream.fValid = false;
+        streams.push_back(stream);
+    }
+    if (pAfter && nCursorPos == addresses.size())
+        return error("%s: continuation key does not belong to any of the addresses", __func__);
+
+    for (std::vector<AddressIndexStream>::iterator it = streams.begin(); it != streams.end(); it++) {
+        CDBIterator *pcursor = it->pcursor.get();
+        if (pAfter) {
+            if (it->nPos == nCursorPos) {
+                pcursor->Seek(make_pair(DB_ADDRESSINDEX, *pAfter));
+                if (!fDescending)
+                    it->pSkip = pAfter;
+            } else {
+                // Entries in the same block position as the continuation key belong to
+                // this page when their address sorts after the key's address
+                bool fAfterTie = (it->nPos < nCursorPos) != fDescending;
+                pcursor->Seek(make_pair(DB_ADDRESSINDEX, CAddressIndexKey(it->type, it->hashBytes, pAfter->blockHeight,
+                                                                          pAfter->txindex + (fAfterTie ? 1 : 0), uint256(), 0, false)));
+            }
+        } else if (!fDescending) {
+            if (start > 0 && end > 0) {
+                pcursor->Seek(make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorHeightKey(it->type, it->hashBytes, start)));
+            } else {
+                pcursor->Seek(make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorKey(it->type, it->hashBytes)));
+            }
+        } else {
+            if (start > 0 && end > 0 && end < std::numeric_limits<int>::max()) {
+                pcursor->Seek(make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorHeightKey(it->type, it->hashBytes, end + 1)));
+            } else {
+                pcursor->Seek(make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorHeightKey(it->type, it->hashBytes, std::numeric_limits<unsigned int>::max())));
+            }
+        }
+        if (fDescending) {
+            if (pcursor->Valid()) {
+                pcursor->Prev();
+            } else {
+                pcursor->SeekToLast();
+            }
+        }
+    }
+
+    AddressIndexStreamCompare compare(&streams, fDescending);
+    std::priority_queue<size_t, std::vector<size_t>, AddressIndexStreamCompare> queue(compare);
+    for (size_t i = 0; i < streams.size(); i++) {
+        if (!ReadAddressIndexStream(streams[i], start, end, fDescending))
+            return false;
+        if (streams[i].fValid)
+            queue.push(i);
+    }
+
+    while (!queue.empty()) {
+        boost::this_thread::interruption_point();
+        if (nLimit > 0 && addressIndex.size() >= nLimit)
+            break;
+        size_t i = queue.top();
+        queue.pop();
+        AddressIndexStream &stream = streams[i];
+        addressIndex.push_back(make_pair(stream.key, stream.value));
+        if (fDescending) {
+            stream.pcursor->Prev();
+        } else {
+            stream.pcursor->Next();
+        }
+        if (!ReadAddressIndexStream(stream, start, end, fDescending))
+            return false;
+        if (stream.fValid)
+            queue.push(i);
+    }
+
+    return true;
+}
+
+bool CIndexDB::WriteTimestampIndex(const CTimestampIndexKey &timestampIndex) {
     CDBBatch batch(&GetObfuscateKey());
     batch.Write(make_pair(DB_TIMESTAMPINDEX, timestampIndex), 0);
     return WriteBatch(batch);
 }
 
-bool CBlockTreeDB::ReadTimestampIndex(const unsigned int &high, const unsigned int &low, std::vector<uint256> &hashes) {
+bool CIndexDB::ReadTimestampIndex(const unsigned int &high, const unsigned int &low, std::vector<uint256> &hashes) {
 
     boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
 
@@ -295,20 +970,100 @@ bool CBlockTreeDB::ReadTimestampIndex(const unsigned int &high, const unsigned i
     return true;
 }
 
-bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
-    return Write(std::make_pair(DB_FLAG, name), fValue ? '1' : '0');
+bool CIndexDB::WriteIndexBuildBatch(const std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
+                                        const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &addressUnspentIndex,
+                                        const std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > &spentIndex,
+                                        const std::vector<CTimestampIndexKey> &timestampIndex,
+                                        const std::vector<uint256> &addressBlocks, bool fErase,
+                                        const std::vector<std::pair<std::string, uint256> > &progress) {
+    CDBBatch batch(&GetObfuscateKey());
+    // The progress keeps the builder from applying a block twice, the block
+    // records keep ConnectBlock from applying it again after an unclean shutdown
+    BatchAddressIndex(batch, addressIndex, fErase, true);
+    for (std::vector<uint256>::const_iterator it=addressBlocks.begin(); it!=addressBlocks.end(); it++) {
+        if (fErase) {
+            batch.Erase(make_pair(DB_ADDRESSBALANCE_BLOCK, *it));
+        } else {
+            batch.Write(make_pair(DB_ADDRESSBALANCE_BLOCK, *it), '1');
+        }
+    }
+    BatchAddressUnspentIndex(batch, addressUnspentIndex);
+    BatchSpentIndex(batch, spentIndex);
+    for (std::vector<CTimestampIndexKey>::const_iterator it=timestampIndex.begin(); it!=timestampIndex.end(); it++) {
+        if (fErase) {
+            batch.Erase(make_pair(DB_TIMESTAMPINDEX, *it));
+        } else {
+            batch.Write(make_pair(DB_TIMESTAMPINDEX, *it), 0);
+        }
+    }
+    for (std::vector<std::pair<std::string, uint256> >::const_iterator it=progress.begin(); it!=progress.end(); it++)
+        batch.Write(make_pair(DB_INDEXBUILD, it->first), it->second);
+    return WriteBatch(batch);
 }
 
-bool CBlockTreeDB::ReadFlag(const std::string &name, bool &fValue) {
-    char ch;
-    if (!Read(std::make_pair(DB_FLAG, name), ch))
-        return false;
-    fValue = ch == '1';
-    return true;
+bool CIndexDB::ReadIndexBuildProgress(const std::string &name, uint256 &hashBlock) {
+    return Read(make_pair(DB_INDEXBUILD, name), hashBlock);
+}
+
+bool CIndexDB::EraseIndexBuildProgress(const std::vector<std::string> &names) {
+    CDBBatch batch(&GetObfuscateKey());
+    for (std::vector<std::string>::const_iterator it=names.begin(); it!=names.end(); it++)
+        batch.Erase(make_pair(DB_INDEXBUILD, *it));
+    return WriteBatch(batch);
+}
+
+/** Copy the entries under one key prefix from the block tree database and erase them there */
+template <typename K, typename V>
+static bool MoveIndexEntries(CBlockTreeDB &blocktree, CIndexDB &indexdb, char chPrefix, int64_t &nMoved) {
+    boost::scoped_ptr<CDBIterator> pcursor(blocktree.NewIterator());
+    pcursor->Seek(chPrefix);
+
+    CDBBatch batchTo(&indexdb.GetObfuscateKey());
+    CDBBatch batchFrom(&blocktree.GetObfuscateKey());
+    size_t nBatch = 0;
+    while (true) {
+        boost::this_thread::interruption_point();
+        std::pair<char, K> key;
+        bool fValid = pcursor->Valid() && pcursor->GetKey(key) && key.first == chPrefix;
+        if (fValid) {
+            V value;
+            if (!pcursor->GetValue(value))
+                return error("%s: failed to read index entry", __func__);
+            batchTo.Write(key, value);
+            batchFrom.Erase(key);
+            nBatch++;
+            pcursor->Next();
+        }
+        // entries are written to the new database before they are erased from the old one,
+        // so an interrupted move is picked up again on the next start
+        if (nBatch > 0 && (!fValid || nBatch >= 100000)) {
+            if (!indexdb.WriteBatch(batchTo, true) || !blocktree.WriteBatch(batchFrom))
+                return false;
+            nMoved += nBatch;
+            nBatch = 0;
+            batchTo = CDBBatch(&indexdb.GetObfuscateKey());
+            batchFrom = CDBBatch(&blocktree.GetObfuscateKey());
+            LogPrintf("%s: %d index entries moved\n", __func__, nMoved);
+        }
+        if (!fValid)
+            return true;
+    }
+}
+
+bool CIndexDB::MoveFromBlockTree(CBlockTreeDB &blocktree) {
+    int64_t nMoved = 0;
+    return MoveIndexEntries<uint256, CDiskTxPos>(blocktree, *this, DB_TXINDEX, nMoved) &&
+           MoveIndexEntries<CAddressIndexKey, CAmount>(blocktree, *this, DB_ADDRESSINDEX, nMoved) &&
+           MoveIndexEntries<CAddressUnspentKey, CAddressUnspentValue>(blocktree, *this, DB_ADDRESSUNSPENTINDEX, nMoved) &&
+           MoveIndexEntries<CTimestampIndexKey, int>(blocktree, *this, DB_TIMESTAMPINDEX, nMoved) &&
+           MoveIndexEntries<CSpentIndexKey, CSpentIndexValue>(blocktree, *this, DB_SPENTINDEX, nMoved) &&
+           MoveIndexEntries<CAddressIndexIteratorKey, CAddressBalanceValue>(blocktree, *this, DB_ADDRESSBALANCE, nMoved) &&
+           MoveIndexEntries<std::string, uint256>(blocktree, *this, DB_INDEXBUILD, nMoved);
 }
 
 bool CBlockTreeDB::LoadBlockIndexGuts()
 {
+    const Consensus::Params& consensusParams = Params().GetConsensus();
     boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
 
     pcursor->Seek(make_pair(DB_BLOCK_INDEX, uint256()));
@@ -335,7 +1090,9 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
                 pindexNew->nStatus        = diskindex.nStatus;
                 pindexNew->nTx            = diskindex.nTx;
 
-                if (!CheckProofOfWork(pindexNew->GetBlockHash(), pindexNew->nBits, Params().GetConsensus()))
+                // The stored block hash is checked against nBits only; this is a target
+                // comparison and does not recompute NeoScrypt for the header.
+                if (!CheckProofOfWork(pindexNew->GetBlockHash(), pindexNew->nBits, consensusParams))
                     return error("LoadBlockIndex(): CheckProofOfWork failed: %s", pindexNew->ToString());
 
                 pcursor->Next();
@@ -14,6 +14,10 @@
 #include <utility>
 #include <vector>
 
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
 class CBlockFileInfo;
 class CBlockIndex;
 struct CDiskTxPos;
@@ -22,6 +26,7 @@ struct CAddressUnspentValue;
 struct CAddressIndexKey;
 struct CAddressIndexIteratorKey;
 struct CAddressIndexIteratorHeightKey;
+struct CAddressBalanceValue;
 struct CTimestampIndexKey;
 struct CTimestampIndexIteratorKey;
 struct CSpentIndexKey;
@@ -34,20 +39,129 @@ static const int64_t nDefaultDbCache = 100;
 static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 16384 : 1024;
 //! min. -dbcache in (MiB)
 static const int64_t nMinDbCache = 4;
+//! -indexdbcache default (MiB)
+static const int64_t nDefaultIndexDbCache = 32;
+//! -indexdbcompression default
+static const bool DEFAULT_INDEXDB_COMPRESSION = true;
+//! -dbbackgroundflush default
+static const bool DEFAULT_DB_BACKGROUND_FLUSH = true;
+//! Format of the coin database: per-output records and a marker per transaction
+static const int COINS_DB_VERSION = 1;
+
+/**
+ * One unspent output in the coin database, with the metadata of its
+ * transaction. Each output has its own record, keyed by its outpoint, so
+ * spending one output only erases that record.
+ *
+ * Serialized format:
+ * - VARINT(nHeight * 2 + fCoinBase)
+ * - VARINT(nVersion)
+ * - the output, compressed with CTxOutCompressor
+ */
+class CDiskTxOut
+{
+public:
+    CTxOut txout;
+    bool fCoinBase;
+    unsigned int nHeight;
+    int nVersion;
+
+    CDiskTxOut() : txout(), fCoinBase(false), nHeight(0), nVersion(0) {}
+    CDiskTxOut(const CCoins &coins, unsigned int nPos) : txout(coins.vout[nPos]), fCoinBase(coins.fCoinBase), nHeight(coins.nHeight), nVersion(coins.nVersion) {}
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const {
+        return ::GetSerializeSize(VARINT(nHeight*2+(fCoinBase ? 1 : 0)), nType, nVersion) +
+               ::GetSerializeSize(VARINT(this->nVersion), nType, nVersion) +
+               ::GetSerializeSize(CTxOutCompressor(REF(txout)), nType, nVersion);
+    }
+
+    template<typename Stream>
+    void Serialize(Stream &s, int nType, int nVersion) const {
+        ::Serialize(s, VARINT(nHeight*2+(fCoinBase ? 1 : 0)), nType, nVersion);
+        ::Serialize(s, VARINT(this->nVersion), nType, nVersion);
+        ::Serialize(s, CTxOutCompressor(REF(txout)), nType, nVersion);
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream &s, int nType, int nVersion) {
+        unsigned int nCode = 0;
+        ::Unserialize(s, VARINT(nCode), nType, nVersion);
+        nHeight = nCode / 2;
+        fCoinBase = nCode & 1;
+        ::Unserialize(s, VARINT(this->nVersion), nType, nVersion);
+        ::Unserialize(s, REF(CTxOutCompressor(REF(txout))), nType, nVersion);
+    }
+};
+
+/** Statistics of the writes of the coin database writer thread, for getdbstats */
+struct CCoinsWriterStats
+{
+    uint64_t nWrites;
+    //! Transactions and memory usage of the snapshot being written, or of the last one
+    uint64_t nTransactions;
+    size_t nUsage;
+    int64_t nLastWriteMicros;
+    int64_t nMaxWriteMicros;
+    int64_t nTotalWriteMicros;
+    //! Time flushes waited for the previous snapshot to be written
+    int64_t nTotalWaitMicros;
+    bool fPending;
+
+    CCoinsWriterStats() : nWrites(0), nTransactions(0), nUsage(0), nLastWriteMicros(0), nMaxWriteMicros(0),
+                          nTotalWriteMicros(0), nTotalWaitMicros(0), fPending(false) {}
+};
 
-/** CCoinsView backed by the coin database (chainstate/) */
+/**
+ * CCoinsView backed by the coin database (chainstate/)
+ *
+ * Once StartWriter() is called, BatchWrite only takes over the map it is
+ * handed, and a writer thread writes it to the database. The snapshot keeps
+ * answering reads until it is written, and only one is written at a time:
+ * the next BatchWrite waits for the previous one first. Failures are
+ * reported by the next BatchWrite or WaitForWrites().
+ */
 class CCoinsViewDB : public CCoinsView
 {
 protected:
     CDBWrapper db;
+
+private:
+    mutable boost::mutex csPending;
+    mutable boost::condition_variable condPending;
+    //! The snapshot handed to the writer thread; not changed until it is written
+    CCoinsMap mapPending;
+    uint256 hashPending;
+    bool fPending;
+    bool fWriteFailed;
+    CCoinsWriterStats writerStats;
+    boost::thread threadWriter;
+
+    void ThreadWrite();
+    bool WriteCoins(const CCoinsMap &mapCoins, const uint256 &hashBlock);
+
 public:
     CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    CCoinsViewDB(const CDBOptions& dbOptions, bool fMemory = false, bool fWipe = false);
+    ~CCoinsViewDB();
 
     bool GetCoins(const uint256 &txid, CCoins &coins) const;
     bool HaveCoins(const uint256 &txid) const;
     uint256 GetBestBlock() const;
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
     bool GetStats(CCoinsStats &stats) const;
+    //! Format version of the database, 0 for databases older than versioning
+    int GetFormatVersion() const;
+    //! Convert older databases to COINS_DB_VERSION, fails for newer ones. Stops early when a shutdown is requested.
+    bool Upgrade();
+    const CDBWrapper& GetDB() const { return db; }
+
+    //! Write the maps handed to BatchWrite in a background thread from now on
+    void StartWriter();
+    bool HasWriter() const { return threadWriter.joinable(); }
+    //! Wait until the snapshot being written, if any, is in the database; false if a write failed
+    bool WaitForWrites() const;
+    bool WriteFailed() const;
+    CCoinsWriterStats GetWriterStats() const;
 };
 
 /** Access to the block database (blocks/index/) */
@@ -55,6 +169,7 @@ class CBlockTreeDB : public CDBWrapper
 {
 public:
     CBlockTreeDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    CBlockTreeDB(const CDBOptions& dbOptions, bool fMemory = false, bool fWipe = false);
 private:
     CBlockTreeDB(const CBlockTreeDB&);
     void operator=(const CBlockTreeDB&);
@@ -64,23 +179,66 @@ public:
     bool ReadLastBlockFile(int &nFile);
     bool WriteReindexing(bool fReindex);
     bool ReadReindexing(bool &fReindex);
+    bool WriteFlag(const std::string &name, bool fValue);
+    bool ReadFlag(const std::string &name, bool &fValue);
+    bool LoadBlockIndexGuts();
+};
+
+/**
+ * Access to the transaction, address, spent and timestamp indexes (indexes/).
+ * They are kept apart from the block index, so large index reads and their
+ * compactions don't push the block index out of its cache or stall it.
+ */
+class CIndexDB : public CDBWrapper
+{
+public:
+    CIndexDB(const CDBOptions& dbOptions, bool fMemory = false, bool fWipe = false);
+private:
+    CIndexDB(const CIndexDB&);
+    void operator=(const CIndexDB&);
+public:
     bool ReadTxIndex(const uint256 &txid, CDiskTxPos &pos);
     bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list);
     bool ReadSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value);
     bool UpdateSpentIndex(const std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> >&vect);
     bool UpdateAddressUnspentIndex(const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue > >&vect);
     bool ReadAddressUnspentIndex(uint160 addressHash, int type,
-                                 std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &vect);
-    bool WriteAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect);
-    bool EraseAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect);
+                                 std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &vect,
+                                 const CAddressUnspentKey *pAfter = NULL, size_t nLimit = 0);
+    /** Write the entries of a connected block, and add them to the balances unless those already include the block */
+    bool WriteAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect, const uint256 &hashBlock);
+    /** Remove the entries of a disconnected block, and subtract them from the balances unless those already exclude the block */
+    bool EraseAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect, const uint256 &hashBlock);
     bool ReadAddressIndex(uint160 addressHash, int type,
                           std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
-                          int start = 0, int end = 0);
+                          int start = 0, int end = 0,
+                          const CAddressIndexKey *pAfter = NULL, size_t nLimit = 0, bool fDescending = false);
+    /** Read the entries of several addresses from one snapshot, merged by block height and position */
+    bool ReadAddressIndexes(const std::vector<std::pair<uint160, int> > &addresses,
+                            std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
+                            int start = 0, int end = 0,
+                            const CAddressIndexKey *pAfter = NULL, size_t nLimit = 0, bool fDescending = false);
+    bool ReadAddressBalance(uint160 addressHash, int type, CAddressBalanceValue &balance);
+    bool BuildAddressBalanceIndex();
     bool WriteTimestampIndex(const CTimestampIndexKey &timestampIndex);
     bool ReadTimestampIndex(const unsigned int &high, const unsigned int &low, std::vector<uint256> &vect);
-    bool WriteFlag(const std::string &name, bool fValue);
-    bool ReadFlag(const std::string &name, bool &fValue);
-    bool LoadBlockIndexGuts();
+    /**
+     * Write (or with fErase, remove) the index entries of a run of blocks together with the progress of the indexes.
+     * addressBlocks are the blocks whose address deltas are included.
+     */
+    bool WriteIndexBuildBatch(const std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
+                              const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &addressUnspentIndex,
+                              const std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > &spentIndex,
+                              const std::vector<CTimestampIndexKey> &timestampIndex,
+                              const std::vector<uint256> &addressBlocks, bool fErase,
+                              const std::vector<std::pair<std::string, uint256> > &progress);
+    bool ReadIndexBuildProgress(const std::string &name, uint256 &hashBlock);
+    bool EraseIndexBuildProgress(const std::vector<std::string> &names);
+    /** Move the index entries that older versions kept in the block tree database over here */
+    bool MoveFromBlockTree(CBlockTreeDB &blocktree);
+private:
+    void BatchAddressIndex(CDBBatch &batch, const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect, bool fErase, bool fBalances);
+    void UpdateAddressBalances(CDBBatch &batch, const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect, bool fErase);
 };
 
 #endif // BITCOIN_TXDB_H